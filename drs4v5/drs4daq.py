@@ -0,0 +1,132 @@
+from ctypes import *
+import numpy as np
+
+# live acquisition through lib/libdrs4daq.so (make libdrs4daq)
+# ctypes releases the GIL during every call into the library, so other
+# python threads keep running while a call waits for triggers
+
+drs4daq=CDLL('./lib/libdrs4daq.so')
+
+INPUTS=4
+BINS=1024
+
+_float_p=POINTER(c_float)
+_ull_p=POINTER(c_ulonglong)
+
+drs4daq.drs4_open.restype=c_void_p
+drs4daq.drs4_open.argtypes=[c_int,c_double]
+drs4daq.drs4_close.argtypes=[c_void_p]
+drs4daq.drs4_error.restype=c_char_p
+drs4daq.drs4_error.argtypes=[c_void_p]
+drs4daq.drs4_serial_number.argtypes=[c_void_p]
+drs4daq.drs4_configure.argtypes=[c_void_p,c_double,c_int,c_double,c_int,c_double]
+drs4daq.drs4_load_pedestal.argtypes=[c_void_p,c_char_p]
+drs4daq.drs4_set_spike_removal.argtypes=[c_void_p,c_int]
+drs4daq.drs4_arm.argtypes=[c_void_p]
+drs4daq.drs4_wait.argtypes=[c_void_p,c_int]
+drs4daq.drs4_transfer.argtypes=[c_void_p]
+drs4daq.drs4_decode.argtypes=[c_void_p,c_int,_float_p,_float_p]
+drs4daq.drs4_trigger_cell.argtypes=[c_void_p]
+drs4daq.drs4_trigger_time_ns.restype=c_ulonglong
+drs4daq.drs4_trigger_time_ns.argtypes=[c_void_p]
+drs4daq.drs4_acquire.argtypes=[c_void_p,c_int,c_int,_float_p,_float_p,_ull_p,c_int]
+drs4daq.drs4_abort.argtypes=[c_void_p]
+drs4daq.drs4_set_live.argtypes=[c_void_p,c_int]
+drs4daq.drs4_live_event.argtypes=[c_void_p,POINTER(_float_p),POINTER(_float_p),POINTER(c_uint),_ull_p]
+
+def _mask(inputs):
+    m=0
+    for i in inputs:
+        m|=1<<i
+    return m
+
+def _float_array(a,shape):
+    # caller supplied arrays are filled in place, they have to be C contiguous float32
+    if a is None:
+        a=np.zeros(shape,dtype=np.float32)
+    if a.dtype!=np.float32 or not a.flags['C_CONTIGUOUS'] or a.size<int(np.prod(shape)):
+        raise ValueError("need a C contiguous float32 array of shape "+str(shape))
+    return a,a.ctypes.data_as(_float_p)
+
+class Board:
+    def __init__(self,board_index=0,freq=5.12):
+        self._d=drs4daq.drs4_open(board_index,freq)
+        if not self._d:
+            raise RuntimeError("no DRS4 evaluation board #%d"%board_index)
+        self.serial=drs4daq.drs4_serial_number(self._d)
+
+    def close(self):
+        if self._d:
+            drs4daq.drs4_close(self._d)
+            self._d=None
+
+    def __del__(self):
+        self.close()
+
+    def _check(self,status):
+        if status<0:
+            raise RuntimeError(drs4daq.drs4_error(self._d).decode('utf-8'))
+        return status
+
+    # trigger_source : OR Bit0..3=CH1..4, AND Bit8..11=CH1..4, see muonDet
+    def configure(self,range_v=0.0,trigger_source=0xB00,trigger_level_mv=-40.0,negative_edge=True,delay_ns=50):
+        return self._check(drs4daq.drs4_configure(self._d,range_v,trigger_source,trigger_level_mv,
+                                                  int(negative_edge),delay_ns))
+
+    def load_pedestal(self,fname='calib/pedestal.cal'):
+        return self._check(drs4daq.drs4_load_pedestal(self._d,fname.encode('utf-8')))
+
+    def set_spike_removal(self,flag=True):
+        return self._check(drs4daq.drs4_set_spike_removal(self._d,int(flag)))
+
+    def arm(self):
+        return self._check(drs4daq.drs4_arm(self._d))
+
+    def wait(self,timeout_ms=1000):
+        return drs4daq.drs4_wait(self._d,timeout_ms)==1
+
+    def transfer(self):
+        return self._check(drs4daq.drs4_transfer(self._d))
+
+    def decode(self,wave=None,time=None,inputs=(0,1,2,3)):
+        wave,wp=_float_array(wave,(INPUTS,BINS))
+        time,tp=_float_array(time,(INPUTS,BINS))
+        self._check(drs4daq.drs4_decode(self._d,_mask(inputs),wp,tp))
+        return wave,time
+
+    def trigger_cell(self):
+        return drs4daq.drs4_trigger_cell(self._d)
+
+    def trigger_time_ns(self):
+        return drs4daq.drs4_trigger_time_ns(self._d)
+
+    # n events in one call, returns the arrays cut to the number of events taken
+    def acquire(self,n,wave=None,time=None,timestamps=None,inputs=(0,1,2,3),timeout_ms=1000):
+        wave,wp=_float_array(wave,(n,INPUTS,BINS))
+        time,tp=_float_array(time,(n,INPUTS,BINS))
+        if timestamps is None:
+            timestamps=np.zeros(n,dtype=np.uint64)
+        if timestamps.dtype!=np.uint64 or timestamps.size<n:
+            raise ValueError("need a uint64 array of %d timestamps"%n)
+        got=self._check(drs4daq.drs4_acquire(self._d,n,_mask(inputs),wp,tp,
+                                             timestamps.ctypes.data_as(_ull_p),timeout_ms))
+        return wave[:got],time[:got],timestamps[:got]
+
+    def abort(self):
+        drs4daq.drs4_abort(self._d)
+
+    # latest event for a display thread while another thread runs acquire()
+    def set_live(self,flag=True):
+        return self._check(drs4daq.drs4_set_live(self._d,int(flag)))
+
+    # views of the library's buffer without a copy, unchanged until the next
+    # call of live(); copy them to keep an event. None before the first event
+    def live(self):
+        wp,tp=_float_p(),_float_p()
+        serial,tns=c_uint(),c_ulonglong()
+        status=drs4daq.drs4_live_event(self._d,byref(wp),byref(tp),byref(serial),byref(tns))
+        if status<0:
+            return None
+        wave=np.ctypeslib.as_array(wp,shape=(INPUTS,BINS))
+        time=np.ctypeslib.as_array(tp,shape=(INPUTS,BINS))
+        return wave,time,serial.value,tns.value,status==1
@@ -38,7 +38,12 @@ def get_adc_events(fname=None,start_eventID=0,end_evetID=0):
         print("pass a valid filename")
         return False,None
 
-    num=(end_evetID-start_eventID+1)*4*1024*2
+    # 4 channels per board, multi-board runs write all boards into one event
+    channels=drs4lib.get_event_channels(fname.encode('utf-8'))
+    if channels<1:
+        print("no valid event in ",fname)
+        return False,None
+    num=(end_evetID-start_eventID+1)*channels*1024*2
     if num<0:
         print("enter valid start_eventID & end_evetID ")
         return None
@@ -48,7 +53,7 @@ def get_adc_events(fname=None,start_eventID=0,end_evetID=0):
     _waveformData=arr_type()
     status=drs4lib.get_event_adcSave(fname.encode('utf-8'),_waveformData,s_id,e_id)
     waveformData=np.ctypeslib.as_array(_waveformData)
-    waveformData=waveformData.reshape((end_evetID-start_eventID+1),4,1024,2)
+    waveformData=waveformData.reshape((end_evetID-start_eventID+1),channels,1024,2)
     return status,waveformData
     
 
@@ -69,3 +74,23 @@ def get_energy(waveform,tme,channel,trigger_level,neg_offset,integrate_window,fr
 	return en
 
 
+
+RLOG_HEADER_DTYPE=np.dtype([('tag','S4'),('version','<u4'),('fold','<u4'),('channel_mask','<u4'),
+                            ('resolving_time','<f8'),('start_wall_ns','<u8'),('interval_ms','<u4'),('reserved','<u4')])
+RLOG_RECORD_DTYPE=np.dtype([('t','<f8'),('dt','<f4'),('singles','<f4',5),('coincidences','<f4'),('accidental','<f4')])
+
+def get_rate_log(fname=None):
+    # rates.dat written by the counter mode of muonDet
+    try :
+        f=open(fname,'rb')
+    except :
+        print("pass a valid filename")
+        return False,None,None
+    header=np.fromfile(f,dtype=RLOG_HEADER_DTYPE,count=1)
+    if len(header)!=1 or header['tag'][0]!=b'RLOG':
+        f.close()
+        print("not a rate log file")
+        return False,None,None
+    records=np.fromfile(f,dtype=RLOG_RECORD_DTYPE)
+    f.close()
+    return True,header[0],records
@@ -24,6 +24,8 @@
 #   include <mvmestd.h>
 #endif                          // HAVE_VME
 
+#include <mutex>
+
 /* disable "deprecated" warning */
 #ifdef _MSC_VER
 #pragma warning(disable: 4996)
@@ -191,6 +193,22 @@ enum DRSErrorCodes {
    kWaveNotAvailable            = -5
 };
 
+/* user pedestal modes, see DRSBoard::SetUserPedestal */
+enum UserPedestalMode {
+   kUserPedestalNone            =  0,
+   kUserPedestalByCell          =  1,   // indexed by physical DRS cell
+   kUserPedestalBySample        =  2    // indexed by sample after the trigger cell
+};
+
+/* voltage calibration tables of a board, see DRSBoard::GetVoltageCalibration */
+typedef struct {
+   double               temperature;    // board temperature at calibration [deg. C]
+   double               range;          // calibrated input range center [V]
+   unsigned short       offset[kNumberOfChipsMax * kNumberOfChannelsMax][kNumberOfBins];
+   unsigned short       offset2[kNumberOfChipsMax * kNumberOfChannelsMax][kNumberOfBins];
+   double               gain[kNumberOfChipsMax * kNumberOfChannelsMax][kNumberOfBins];
+} DRSVoltageCalibration;
+
 /*---- callback class ----*/
 
 class DRSCallback
@@ -486,7 +504,9 @@ protected:
    double               fExternalClockFrequency;
 #ifdef HAVE_USB
    MUSB_INTERFACE      *fUsbInterface;
+   unsigned char       *fUsb2Buffer;
 #endif
+   std::mutex          *fBusMutex;     // shared by all boards on the same interface, locked with USE_DRS_MUTEX
 #ifdef HAVE_VME
    MVME_INTERFACE      *fVmeInterface;
    mvme_addr_t          fBaseAddress;
@@ -551,6 +571,10 @@ protected:
    unsigned short       fCellOffset2[kNumberOfChipsMax * kNumberOfChannelsMax][kNumberOfBins];
    double               fCellGain[kNumberOfChipsMax * kNumberOfChannelsMax][kNumberOfBins];
 
+   // User pedestal in units of 0.1 mV, subtracted in CalibrateWaveform
+   unsigned char        fUserPedestalMode[kNumberOfChipsMax * kNumberOfChannelsMax];
+   float                fUserPedestal[kNumberOfChipsMax * kNumberOfChannelsMax][kNumberOfBins];
+
    double               fTimingCalibratedFrequency;
    double               fCellDT[kNumberOfChipsMax][kNumberOfChannelsMax][kNumberOfBins];
 
@@ -581,6 +605,7 @@ public:
 
    MVME_INTERFACE *GetVMEInterface() const { return fVmeInterface; };
 #endif
+   DRSBoard(int boardType, int serialNumber); // offline board, no hardware access
    ~DRSBoard();
 
    int          SetBoardSerialNumber(unsigned short serialNumber);
@@ -714,6 +739,8 @@ public:
                            unsigned short *waveform, bool adjustToClock = false);
    bool         IsTimingCalibrationValid(void);
    bool         IsVoltageCalibrationValid(void) { return fVoltageCalibrationValid; }
+   bool         GetVoltageCalibration(DRSVoltageCalibration *c) const;
+   void         SetVoltageCalibration(const DRSVoltageCalibration *c);
    int          GetTime(unsigned int chipIndex, int channelIndex, double freq, int tc, float *time, bool tcalibrated=true, bool rotated=true);
    int          GetTime(unsigned int chipIndex, int channelIndex, int tc, float *time, bool tcalibrated=true, bool rotated=true);
    int          GetTimeCalibration(unsigned int chipIndex, int channelIndex, int mode, float *time, bool force=false);
@@ -758,6 +785,9 @@ public:
    int          CalibrateWaveform(unsigned int chipIndex, unsigned char channel, unsigned short *adcWaveform,
                                   short *waveform, bool responseCalib, int triggerCell, bool adjustToClock,
                                   float threshold, bool offsetCalib);
+   int          SetUserPedestal(unsigned int chipIndex, unsigned char channel, const float *pedestal, int mode);
+   int          SetUserPedestal(unsigned int chipIndex, unsigned char channel, const double *pedestal, int mode);
+   int          GetUserPedestalMode(unsigned int chipIndex, unsigned char channel) const;
 
    static void  LinearRegression(double *x, double *y, int n, double *a, double *b);
    
@@ -778,6 +808,7 @@ protected:
    void         ConstructBoard();
    void         ReadSerialNumber();
    void         ReadCalibration(void);
+   bool         ReadCalibrationEEPROM(const unsigned short *const *page = NULL);
 
    TimeData    *GetTimeCalibration(unsigned int chipIndex, bool reinit = false);
 
@@ -918,10 +949,23 @@ protected:
       kMaxNumberOfBoards = 40
    };
 
+public:
+   // phases of the startup, see PrintStartupReport()
+   enum {
+      kStartupScan = 0,
+      kStartupDrain,
+      kStartupConstruct,
+      kStartupInit,
+      kStartupFrequency,
+      kNumberOfStartupPhases
+   };
+
 protected:
    DRSBoard       *fBoard[kMaxNumberOfBoards];
    int             fNumberOfBoards;
    char            fError[256];
+   double          fStartupTime[kNumberOfStartupPhases];                      // wall time [ms]
+   double          fBoardStartupTime[kMaxNumberOfBoards][kNumberOfStartupPhases]; // per board [ms]
 #ifdef HAVE_VME
    MVME_INTERFACE *fVmeInterface;
 #endif
@@ -941,6 +985,9 @@ public:
    int              GetNumberOfBoards() const { return fNumberOfBoards; }
    bool             GetError(char *str, int size);
    void             SortBoards();
+   int              InitBoards(double freq);
+   double           GetStartupTime(int phase) const { return fStartupTime[phase]; }
+   void             PrintStartupReport(FILE *f) const;
 
 #ifdef HAVE_VME
    MVME_INTERFACE *GetVMEInterface() const { return fVmeInterface; };
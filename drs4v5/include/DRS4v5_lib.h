@@ -4,13 +4,15 @@
 #include <unistd.h>
 #include <cstring>
 #include <math.h>
+#include <time.h>
 #include <fstream>
 #include <iostream>
 #include <vector>
 
 #include <drsoscBinary.h>
-
-#define EVENT_SIZE_BYTES_4channelADC 32796
+#include <pedestal.h>
+#include <spikes.h>
+#include <crc32c.h>
 
 #define EVENTS_IN_A_FRAME 50
 
@@ -22,6 +24,7 @@ class DRS_EVENT
 {
 	public:
 	   EHEADER         	eheader;
+	   XHEADER         	xheader;	// written only if eheader.event_header[3] has EHEADER_FLAG_XHEADER
 	   vector<float *>	time;
 	   vector<float *>	waveform;
 	   void clear_data()
@@ -44,14 +47,21 @@ class DRS_EVENT
 
 int get_events( const char * fname="",double * waveformOUT=NULL,int start_eventID=0,int end_evetID=-1,bool offset_caliberate=false) asm ("get_events");
 int get_event_adcSave(const char * fname,double * waveformOUT,int start_eventID=0,int end_evetID=-1) asm ("get_event_adcSave") ;
+int get_event_channels(const char * fname) asm ("get_event_channels");
+void set_spike_removal(bool flag) asm ("set_spike_removal");
+void set_event_checksum(bool flag) asm ("set_event_checksum");
 
-int do_offset_caliberation(string ofile="config/offset_cofig.dat",string configfile="drsosc.config");
+int do_offset_caliberation(string ofile="calib/pedestal.cal",string configfile="drsosc.config",int max_events=-1);
 
 int get_channel_offsets(string ofile="calib/offset_calib.dat",vector<double *> *calib_data =NULL,int channels[]=NULL);
 
+void set_event_time(DRS_EVENT * anevent,unsigned long long trigger_ns,unsigned long long run_start_mono_ns,unsigned long long run_start_wall_ns);
 int save_event_binary(const char * fname,DRS_EVENT events[], int event_count);
 vector<DRS_EVENT> read_event_binary(const char * fname);
 
+double get_channel_energy(const float * waveform,const float * time,
+						double trigger_level=-40.0,double neg_offset=20,double integrate_window=100, double freq =5.12,
+									bool falling_edge=true);
 double get_energy(float waveform[8][1024],float time[8][1024],int channel,
 						double trigger_level=-40.0,double neg_offset=20,double integrate_window=100, double freq =5.12,
 									bool falling_edge=true) asm("get_energy");
@@ -10,19 +10,48 @@
 \********************************************************************/
 
 class Averager {
+   enum {
+      kNumberOfSeeds = 16       // samples kept before a histogram is centered
+   };
+
    int fNx, fNy, fNz, fDim;
+   bool fStreaming;
+
+   // exact mode: all samples are kept
    float *fArray;
    unsigned short *fN;
-   
+
+   // streaming mode: per cell histogram around the median of the first
+   // samples, plus running mean and variance of all samples
+   float fBinWidth;
+   unsigned short *fHist;
+   float *fSeed;
+   float *fCenter;
+   unsigned int *fCount;
+   unsigned int *fUnder;
+   unsigned int *fOver;
+   double *fMean;
+   double *fM2;
+   float *fMin;
+   float *fMax;
+
+   int    Cell(int x, int y, int z) const { return (x*fNy + y)*fNz + z; }
+   void   Fill(int cell, float value);
+   double HistogramMedian(int cell) const;
+   double SeedMedian(int cell);
+
 public:
    Averager(int nx, int ny, int nz, int dim);
+   Averager(int nx, int ny, int nz, int nBins, float binWidth);
    ~Averager();
-   
+
    void Add(int x, int y, int z, float value);
    void Reset();
    double Average(int x, int y, int z);
+   double Sigma(int x, int y, int z);
    double Median(int x, int y, int z);
    double RobustAverage(double range, int x, int y, int z);
    int SaveNormalizedDistribution(const char *filename, int x, float range);
+   bool IsStreaming() const { return fStreaming; }
 
 };
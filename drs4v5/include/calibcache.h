@@ -0,0 +1,56 @@
+/********************************************************************\
+
+  Name:         calibcache.h
+
+  Contents:     On-disk cache of the calibration tables read from the
+                board EEPROM
+
+\********************************************************************/
+
+#ifndef CALIBCACHE_H
+#define CALIBCACHE_H
+
+#define DRS_CALIB_CACHE_VERSION 3
+#define DRS_CALIB_PAGES         9   // EEPROM pages 0..8 may hold calibration data
+
+/* identifies the EEPROM content a cache file was made from */
+typedef struct {
+   int          serial;
+   int          firmware;
+   int          board_type;
+   unsigned int generation;         // calibration generation from the EEPROM page 0 header
+   unsigned int eeprom_checksum;    // of the EEPROM page 0 header
+   double       nominal_frequency;  // used for boards without timing calibration
+} DRS_CALIB_KEY;
+
+/* file header, followed by the sections in the order given to Store() */
+typedef struct {
+   char          tag[4];            // "DRSC"
+   unsigned int  version;
+   DRS_CALIB_KEY key;
+   unsigned int  payload_size;
+   unsigned int  payload_checksum;
+} DRS_CALIB_CACHE_HEADER;
+
+/* one table or value to be cached */
+typedef struct {
+   void         *data;
+   unsigned int  size;
+} DRS_CALIB_SECTION;
+
+/*------------------------------------------------------------------*/
+
+class DRSCalibCache {
+public:
+   static unsigned int Checksum(const void *buffer, unsigned int size, unsigned int seed = 2166136261U);
+
+   static void         SetDirectory(const char *dir);
+   static const char  *GetDirectory();
+
+   static bool         Load(const DRS_CALIB_KEY *key, DRS_CALIB_SECTION *section, int n);
+   static void         Store(const DRS_CALIB_KEY *key, const DRS_CALIB_SECTION *section, int n);
+   static void         Remove(int serial);
+   static void         Flush();
+};
+
+#endif // CALIBCACHE_H
@@ -0,0 +1,73 @@
+/********************************************************************\
+
+  Name:         counter.h
+
+  Contents:     Trigger counter based on the hardware scalers of the
+                DRS4 evaluation board, with a software fallback
+
+\********************************************************************/
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "DRS.h"
+
+/* scaler numbers as used by DRSBoard::GetScaler() */
+enum {
+   kScalerCH1 = 0,
+   kScalerCH2,
+   kScalerCH3,
+   kScalerCH4,
+   kScalerEXT,
+   kScalerTrigger,          // output of the trigger logic set by SetTriggerSource()
+   kNumberOfScalers
+};
+
+class RateLogger;
+
+/*------------------------------------------------------------------*/
+
+class ScalerCounter {
+protected:
+   DRSBoard          *fBoard;
+   bool               fHardware;        // scalers available, otherwise count triggers in software
+   int                fIntervalMs;      // sampling cadence
+   uint64_t           fStart;
+   uint64_t           fLast;
+   double             fRate[kNumberOfScalers];   // last sampled rate [Hz]
+   double             fCount[kNumberOfScalers];  // integrated counts
+   unsigned long long fSamples;
+   unsigned short     fTriggerBus;
+   unsigned long long fTriggerBusChanges;
+   RateLogger        *fLogger;          // optional, gets the counts of every sample
+
+   void Display(FILE *f);
+
+private:
+   ScalerCounter(const ScalerCounter &c);              // not implemented
+   ScalerCounter &operator=(const ScalerCounter &rhs); // not implemented
+
+public:
+   ScalerCounter(DRSBoard *board, int intervalMs = 100);
+
+   static bool HasScalers(DRSBoard *board);
+
+   bool     IsHardware() const { return fHardware; }
+   void     SetLogger(RateLogger *logger) { fLogger = logger; }
+   void     Start();
+   void     Sample();
+   void     Run(volatile bool *stop, FILE *display);
+
+   double   GetCount(int scaler) const { return fCount[scaler]; }
+   double   GetRate(int scaler) const { return fRate[scaler]; }
+   double   GetElapsed() const { return (fLast - fStart) / 1E9; }
+   unsigned long long GetSamples() const { return fSamples; }
+   unsigned long long GetTriggerBusChanges() const { return fTriggerBusChanges; }
+
+   void     PrintSummary(FILE *f) const;
+};
+
+#endif // COUNTER_H
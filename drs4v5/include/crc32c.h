@@ -0,0 +1,21 @@
+/********************************************************************\
+
+  Name:         crc32c.h
+
+  Contents:     CRC-32C (Castagnoli) of event records, with the SSE4.2
+                crc32 instruction where the CPU has it
+
+\********************************************************************/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+
+/* crc is the value of the previous part, 0 to start */
+unsigned int crc32c(unsigned int crc, const void *data, size_t n);
+
+/* "sse4.2", "armv8" or "table" */
+const char  *crc32c_implementation();
+
+#endif // CRC32C_H
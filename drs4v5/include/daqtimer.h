@@ -0,0 +1,117 @@
+/********************************************************************\
+
+  Name:         daqtimer.h
+
+  Contents:     Per-stage latency histograms and dead-time accounting
+                for the DAQ event loop
+
+\********************************************************************/
+
+#ifndef DAQTIMER_H
+#define DAQTIMER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* stages of one event in the readout loop */
+enum DAQStage {
+   kStageStartDomino = 0,   // arm the board
+   kStageWaitTrigger,       // board armed, waiting for trigger (live time)
+   kStageTransfer,          // TransferWaves
+   kStageSwTrigger,         // software coincidence / veto filter on raw ADC
+   kStageDecode,            // DecodeWave/CalibrateWaveform via GetWave
+   kStageGetTime,           // GetTime
+   kStageAnalysis,          // feature extraction, histogramming
+   kStageWrite,             // writing to disk
+   kStageMonitor,           // screen update, fits, plots
+   kNumberOfStages
+};
+
+/* monotonic time in ns, one clock_gettime() call */
+inline uint64_t daq_time_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* wall clock time in ns since the epoch, only used at run start */
+inline uint64_t daq_wall_time_ns()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*------------------------------------------------------------------*/
+
+class LatencyHistogram {
+   // log-linear buckets: 16 sub-buckets per power of two, ~6% resolution
+   enum {
+      kSubBits         = 4,
+      kSubBuckets      = 1 << kSubBits,
+      kNumberOfBuckets = 61 * kSubBuckets
+   };
+
+   uint64_t fBucket[kNumberOfBuckets];
+   uint64_t fCount;
+   uint64_t fSum;
+   uint64_t fMax;
+
+   static int      BucketIndex(uint64_t ns);
+   static uint64_t BucketUpperEdge(int index);
+
+public:
+   LatencyHistogram() { Reset(); }
+
+   void     Reset();
+   void     Add(uint64_t ns) { fBucket[BucketIndex(ns)]++; fCount++; fSum += ns; if (ns > fMax) fMax = ns; }
+   uint64_t GetCount() const { return fCount; }
+   uint64_t GetSum() const { return fSum; }
+   uint64_t GetMax() const { return fMax; }
+   double   GetMean() const { return fCount ? (double) fSum / fCount : 0; }
+   uint64_t GetPercentile(double p) const;
+};
+
+/*------------------------------------------------------------------*/
+
+class DAQTimer {
+   LatencyHistogram fStage[kNumberOfStages];
+   uint64_t         fPending[kNumberOfStages];
+   bool             fTouched[kNumberOfStages];
+   uint64_t         fRunStart;
+   uint64_t         fRunStartWall;
+   uint64_t         fRunStop;
+   uint64_t         fLast;
+   uint64_t         fLive;
+   uint64_t         fEvents;
+   uint64_t         fIntervalStart;
+   uint64_t         fIntervalLive;
+   uint64_t         fIntervalEvents;
+
+public:
+   DAQTimer() { StartRun(); }
+
+   static const char *GetStageName(int stage);
+
+   void     StartRun();
+   void     StopRun();
+   uint64_t Mark(DAQStage stage);
+   void     EndEvent();
+
+   uint64_t GetEvents() const { return fEvents; }
+   uint64_t GetRunStart() const { return fRunStart; }
+   uint64_t GetRunStartWall() const { return fRunStartWall; }
+   uint64_t GetWallTime(uint64_t ns) const { return fRunStartWall + (ns - fRunStart); }
+   uint64_t GetRunTime() const;
+   uint64_t GetLiveTime() const { return fLive; }
+   double   GetDeadTimeFraction() const;
+   void     GetInterval(double *rate, double *deadTime);
+   const LatencyHistogram &GetStage(int stage) const { return fStage[stage]; }
+
+   void     PrintSummary(FILE *f) const;
+   int      WriteSummary(const char *filename) const;
+};
+
+#endif // DAQTIMER_H
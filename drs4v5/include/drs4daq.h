@@ -0,0 +1,67 @@
+/********************************************************************\
+
+  Name:         drs4daq.h
+
+  Contents:     Plain C interface to the live acquisition of a DRS4
+                evaluation board, for use from Python (drs4daq.py) or
+                other languages through libdrs4daq.so
+
+                Waveforms are written into caller owned float arrays
+                of [4][1024] per event (CH1..CH4, mV and ns), e.g. the
+                data of NumPy arrays. Functions return 0 or a positive
+                count on success and a negative value on error, see
+                drs4_error().
+
+\********************************************************************/
+
+#ifndef DRS4DAQ_H
+#define DRS4DAQ_H
+
+#define DRS4DAQ_INPUTS 4
+#define DRS4DAQ_BINS   1024
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct DRS4_DAQ DRS4_DAQ;      /* one board, one thread at a time, except
+                                          drs4_live_event() and drs4_abort() */
+
+DRS4_DAQ   *drs4_open(int board_index, double freq_ghz);
+void        drs4_close(DRS4_DAQ *d);
+const char *drs4_error(DRS4_DAQ *d);
+int         drs4_serial_number(DRS4_DAQ *d);
+
+/* trigger_source as DRSBoard::SetTriggerSource(), level in mV on all inputs */
+int         drs4_configure(DRS4_DAQ *d, double range_v, int trigger_source, double trigger_level_mv,
+                           int negative_edge, double delay_ns);
+int         drs4_load_pedestal(DRS4_DAQ *d, const char *filename);
+int         drs4_set_spike_removal(DRS4_DAQ *d, int flag);
+
+/* single steps, wait returns 1 on trigger and 0 on timeout */
+int         drs4_arm(DRS4_DAQ *d);
+int         drs4_wait(DRS4_DAQ *d, int timeout_ms);
+int         drs4_transfer(DRS4_DAQ *d);
+int         drs4_decode(DRS4_DAQ *d, int input_mask, float *wave, float *time);
+int         drs4_trigger_cell(DRS4_DAQ *d);
+unsigned long long drs4_trigger_time_ns(DRS4_DAQ *d);
+
+/* n events into wave[n][4][1024], time[n][4][1024] and timestamp_ns[n]
+   (each may be NULL), returns the number of events taken */
+int         drs4_acquire(DRS4_DAQ *d, int n, int input_mask, float *wave, float *time,
+                         unsigned long long *timestamp_ns, int timeout_ms);
+void        drs4_abort(DRS4_DAQ *d);
+
+/* latest decoded event for a display thread while another thread runs
+   drs4_acquire(); wave and time point to [4][1024] floats which stay
+   unchanged until the next call, only inputs decoded are filled.
+   Returns 1 for a new event, 0 if none came since the last call */
+int         drs4_set_live(DRS4_DAQ *d, int flag);
+int         drs4_live_event(DRS4_DAQ *d, const float **wave, const float **time, unsigned int *serial,
+                            unsigned long long *trigger_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DRS4DAQ_H
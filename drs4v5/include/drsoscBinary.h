@@ -52,6 +52,28 @@ typedef struct {
    unsigned short range;
 } EHEADER;
 
+/* muonDet events.dat: event_header[3] holds flags, "muT" + 0 in old files;
+   year is years since 1900 and month 0-11 as in struct tm, millisecond 0.
+   The trigger wall time in ns is run_start_wall_ns + trigger_ns -
+   run_start_mono_ns of the XHEADER */
+#define EHEADER_FLAG_XHEADER 0x01   // XHEADER follows EHEADER
+#define EHEADER_FLAG_TRAILER 0x02   // ETRAILER follows the waveforms, see evjournal.h
+
+typedef struct {
+   char               tag[4];              // "XHDR"
+   unsigned int       size;                // sizeof(XHEADER)
+   unsigned long long trigger_ns;          // CLOCK_MONOTONIC at trigger acknowledge
+   unsigned long long run_start_mono_ns;   // CLOCK_MONOTONIC at run start
+   unsigned long long run_start_wall_ns;   // CLOCK_REALTIME at run start, ns since epoch
+} XHEADER;
+
+typedef struct {
+   char               tag[4];              // "ETRL"
+   unsigned int       length;              // bytes of the event record including this trailer
+   unsigned int       sequence;            // record number in the file, from 0
+   unsigned int       crc;                 // CRC-32C of the record up to and including sequence
+} ETRAILER;
+
 typedef struct {
    char           tc[2];
    unsigned short trigger_cell;
@@ -0,0 +1,103 @@
+/********************************************************************\
+
+  Name:         evjournal.h
+
+  Contents:     Crash safe writing and recovery scan of muonDet
+                events.dat files, each event record closed by a
+                trailer with its length, sequence number and CRC-32C
+
+\********************************************************************/
+
+#ifndef EVJOURNAL_H
+#define EVJOURNAL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+
+#include "drsoscBinary.h"
+
+#define EVJ_MAX_CHANNELS 64
+#define EVJ_BINS         1024
+
+/* index written by evrecover, one EVJ_INDEX per valid record */
+typedef struct {
+   char               tag[4];         // "EIDX"
+   unsigned int       version;
+   unsigned int       size;           // sizeof(EVJ_INDEX)
+   unsigned int       records;
+} EVJ_INDEX_HEADER;
+
+typedef struct {
+   unsigned long long offset;         // of the EHEADER in the event file
+   unsigned long long trigger_ns;     // from the XHEADER, 0 if none
+   unsigned int       serial;         // event_serial_number
+   unsigned int       sequence;
+} EVJ_INDEX;
+
+#define EVJ_INDEX_VERSION 1
+
+typedef struct {
+   unsigned long long records;        // valid records
+   unsigned long long valid_bytes;    // end of the last valid record
+   unsigned long long file_bytes;
+   unsigned long long skipped_bytes;  // bad regions passed over when salvaging
+   unsigned long long bad_regions;
+   unsigned long long first_bad;      // offset of the first invalid record, file_bytes if none
+   unsigned int       next_sequence;
+   double             seconds;
+} EVJ_SCAN;
+
+typedef struct {
+   unsigned long long file_bytes;
+   unsigned long long record_bytes;   // size of every record, from the first one
+   unsigned long long records;        // valid records before the first bad one
+   unsigned long long checked_bytes;  // read and checksummed by all threads
+   long long          first_bad;      // record number, -1 if the file is good
+   unsigned int       last_serial;    // event serial number of the last valid record
+   char               error[64];      // why first_bad is bad
+   int                threads;
+   double             seconds;
+} EVJ_VERIFY;
+
+/*------------------------------------------------------------------*/
+
+class EventJournal {
+protected:
+   int                fFd;
+   unsigned char     *fBuffer;          // one record, written with a single append
+   size_t             fBufferSize;
+   unsigned int       fSequence;
+   unsigned long long fBytes;
+   unsigned long long fFlushed;         // start of the range not yet handed to writeback
+   unsigned long long fFlushBytes;
+   unsigned long long fRecovered;       // torn tail bytes removed by Open()
+
+private:
+   EventJournal(const EventJournal &c);              // not implemented
+   EventJournal &operator=(const EventJournal &rhs); // not implemented
+
+public:
+   EventJournal();
+   ~EventJournal();
+
+   int                Open(const char *filename);
+   void               Close(bool sync = false);
+   bool               IsOpen() const { return fFd >= 0; }
+   void               SetFlushBytes(unsigned long long n) { fFlushBytes = n; }
+
+   int                Append(const EHEADER *eh, const XHEADER *xh, int channels,
+                             float *const *time, float *const *wave);
+
+   unsigned int       GetSequence() const { return fSequence; }
+   unsigned long long GetBytes() const { return fBytes; }
+   unsigned long long GetRecovered() const { return fRecovered; }
+
+   static size_t      RecordSize(const EHEADER *eh, int channels);
+   static int         Scan(const char *filename, EVJ_SCAN *result, bool salvage = false,
+                           std::vector<EVJ_INDEX> *index = NULL);
+   static int         Verify(const char *filename, int nThreads, EVJ_VERIFY *result);
+   static int         WriteIndex(const char *filename, const std::vector<EVJ_INDEX> &index);
+};
+
+#endif // EVJOURNAL_H
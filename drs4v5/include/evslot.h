@@ -0,0 +1,68 @@
+/********************************************************************\
+
+  Name:         evslot.h
+
+  Contents:     Triple buffered hand-off of the latest event from the
+                acquisition thread to a display thread, neither side
+                copies under a lock or waits for the other
+
+\********************************************************************/
+
+#ifndef EVSLOT_H
+#define EVSLOT_H
+
+#include <atomic>
+#include <vector>
+
+typedef struct {
+   unsigned int       serial;         // counted by Publish(), from 1
+   unsigned long long trigger_ns;
+   int                trigger_cell;
+   unsigned int       valid;          // one bit per board * channels + channel
+   float             *wave;           // [boards][channels][bins]
+   float             *time;
+} EVSLOT_EVENT;
+
+class EventSlot {
+protected:
+   int                fBoards;
+   int                fChannels;
+   int                fBins;
+   std::vector<float> fData;
+   EVSLOT_EVENT       fEvent[3];
+
+   std::atomic<unsigned int> fMiddle;  // buffer index, EVSLOT_NEW if not taken yet
+   int                fBack;            // owned by the writer
+   int                fFront;           // owned by the reader
+   unsigned int       fPublished;
+   unsigned int       fTaken;
+   bool               fHaveFront;
+
+private:
+   EventSlot(const EventSlot &c);              // not implemented
+   EventSlot &operator=(const EventSlot &rhs); // not implemented
+
+public:
+   EventSlot(int boards = 1, int channels = 4, int bins = 1024);
+
+   int                GetNumberOfBoards() const { return fBoards; }
+   int                GetNumberOfChannels() const { return fChannels; }
+   int                GetNumberOfBins() const { return fBins; }
+
+   /* writer: fill the event returned by BeginWrite(), then Publish() it */
+   EVSLOT_EVENT      *BeginWrite();
+   void               Publish();
+   unsigned int       GetPublished() const { return fPublished; }
+
+   /* reader: latest published event, NULL before the first one; it
+      stays valid and unchanged until the next GetLatest() */
+   const EVSLOT_EVENT *GetLatest(bool *updated = 0);
+   unsigned int       GetTaken() const { return fTaken; }
+
+   float             *GetWave(const EVSLOT_EVENT *e, int board, int channel) const
+                      { return e->wave + (board * fChannels + channel) * fBins; }
+   float             *GetTime(const EVSLOT_EVENT *e, int board, int channel) const
+                      { return e->time + (board * fChannels + channel) * fBins; }
+};
+
+#endif // EVSLOT_H
@@ -0,0 +1,195 @@
+/********************************************************************\
+
+  Name:         multiboard.h
+
+  Contents:     Synchronized acquisition of several DRS4 boards with
+                one readout thread per board and an event builder
+
+\********************************************************************/
+
+#ifndef MULTIBOARD_H
+#define MULTIBOARD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "DRS.h"
+
+/* raw TransferWaves buffer of one evaluation board: 9 channels plus trailer */
+#define DRS_FRAGMENT_SIZE (9 * 2 * kNumberOfBins + 4)
+
+/*---- bounded single producer / single consumer queue -------------*/
+
+template <class T> class DRSRing {
+   std::vector<T>          fSlot;
+   size_t                  fHead;    // next slot to write
+   size_t                  fTail;    // next slot to read
+   size_t                  fMaxDepth;
+   bool                    fStop;
+   std::mutex              fMutex;
+   std::condition_variable fNotEmpty;
+   std::condition_variable fNotFull;
+
+public:
+   DRSRing(size_t capacity) : fSlot(capacity), fHead(0), fTail(0), fMaxDepth(0), fStop(false) {}
+
+   /* returns NULL if the queue was stopped */
+   T *BeginWrite()
+   {
+      std::unique_lock<std::mutex> lock(fMutex);
+      while (!fStop && fHead - fTail == fSlot.size())
+         fNotFull.wait(lock);
+      return fStop ? NULL : &fSlot[fHead % fSlot.size()];
+   }
+
+   void EndWrite()
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fHead++;
+      if (fHead - fTail > fMaxDepth)
+         fMaxDepth = fHead - fTail;
+      fNotEmpty.notify_one();
+   }
+
+   /* returns NULL on timeout or if the queue was stopped and is empty */
+   T *BeginRead(int timeoutMs)
+   {
+      std::unique_lock<std::mutex> lock(fMutex);
+      if (!fNotEmpty.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                              [this] { return fStop || fHead != fTail; }))
+         return NULL;
+      return fHead != fTail ? &fSlot[fTail % fSlot.size()] : NULL;
+   }
+
+   void EndRead()
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fTail++;
+      fNotFull.notify_one();
+   }
+
+   bool IsFull()
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fHead - fTail == fSlot.size();
+   }
+
+   void Stop()
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop = true;
+      fNotEmpty.notify_all();
+      fNotFull.notify_all();
+   }
+
+   void Reset()
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fHead = fTail = fMaxDepth = 0;
+      fStop = false;
+   }
+
+   size_t GetDepth()
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fHead - fTail;
+   }
+
+   size_t GetMaxDepth()
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      return fMaxDepth;
+   }
+
+   size_t GetCapacity() const { return fSlot.size(); }
+};
+
+/*---- one board's part of an event --------------------------------*/
+
+class DRSFragment {
+public:
+   int            fBoard;           // index in DRS::GetBoard()
+   int            fSerial;          // board serial number
+   unsigned int   fNumber;          // local trigger number since Start(), matched by the builder
+   uint64_t       fTimestamp;       // daq_time_ns() when trigger was seen, diagnostic only
+   unsigned short fTriggerCell;
+   unsigned short fTriggerBus;
+   unsigned char  fData[DRS_FRAGMENT_SIZE];
+};
+
+/*---- event built from one fragment per board ---------------------*/
+
+class DRSMultiEvent {
+public:
+   unsigned int             fNumber;         // event number, equal on all boards
+   std::vector<DRSFragment> fFragment;       // one per board, in board order
+};
+
+/*---- per-board backlog metrics -----------------------------------*/
+
+typedef struct {
+   unsigned long long fragments;  // fragments read out
+   unsigned long long stalls;     // readout had to wait for a free queue slot
+   unsigned long long discarded;  // dropped by the event builder
+   unsigned int       depth;      // current queue depth
+   unsigned int       maxDepth;   // maximum queue depth
+   unsigned int       capacity;
+} DRSBacklogStats;
+
+/*------------------------------------------------------------------*/
+
+class DRSMultiBoard {
+protected:
+   DRS                     *fDRS;
+   int                      fNumberOfBoards;
+   std::vector<DRSBoard *>  fBoard;
+   std::vector<DRSRing<DRSFragment> *> fQueue;
+   DRSRing<DRSMultiEvent>  *fEvents;
+   std::vector<std::thread> fThread;
+   std::atomic<bool>        fRunning;
+   std::atomic<uint64_t>   *fArmed;       // per board, number of StartDomino() calls
+   std::atomic<unsigned long long> *fStalls;
+   std::atomic<unsigned long long> *fFragments;
+   std::atomic<unsigned long long> *fDiscarded;
+   std::atomic<unsigned long long> fBuilt;
+   std::atomic<unsigned long long> fBusMismatch;  // events rejected
+   std::atomic<unsigned long long> fTimeMismatch; // events built with timestamps beyond fTolerance
+   uint64_t                 fTolerance;   // ns
+   bool                     fReadTriggerBus;
+
+   void ReadoutLoop(int board);
+   void BuilderLoop();
+
+private:
+   DRSMultiBoard(const DRSMultiBoard &c);              // not implemented
+   DRSMultiBoard &operator=(const DRSMultiBoard &rhs); // not implemented
+
+public:
+   DRSMultiBoard(DRS *drs, int queueDepth = 64);
+   ~DRSMultiBoard();
+
+   int              GetNumberOfBoards() const { return fNumberOfBoards; }
+   DRSBoard        *GetBoard(int i) { return fBoard[i]; }
+   int              ConfigureDaisyChain(int masterTriggerSource);
+   void             SetTimeTolerance(double us) { fTolerance = (uint64_t) (us * 1000); }
+   void             SetReadTriggerBus(bool flag) { fReadTriggerBus = flag; }
+
+   int              Start();
+   void             Stop();
+   bool             IsRunning() const { return fRunning; }
+
+   DRSMultiEvent   *GetEvent(int timeoutMs);
+   void             ReleaseEvent();
+
+   unsigned long long GetNumberOfEvents() const { return fBuilt; }
+   void             GetBacklogStats(int board, DRSBacklogStats *stats);
+   void             PrintBacklogStats(FILE *f);
+};
+
+#endif // MULTIBOARD_H
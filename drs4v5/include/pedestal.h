@@ -0,0 +1,93 @@
+/********************************************************************\
+
+  Name:         pedestal.h
+
+  Contents:     Pedestal (offset) calibration of the waveforms, per
+                physical DRS cell and channel, from any number of
+                pedestal events
+
+                File layout: one PEDESTAL_HEADER followed by
+                n_channels PEDESTAL_CHANNEL blocks, all little endian,
+                no padding. Values in mV.
+
+\********************************************************************/
+
+#ifndef PEDESTAL_H
+#define PEDESTAL_H
+
+#include <stdio.h>
+
+#define PEDESTAL_VERSION  1
+#define PEDESTAL_CELLS    1024
+#define PEDESTAL_CHANNELS 4           // CH1..CH4
+
+typedef struct {
+   char               tag[4];         // "PEDC"
+   unsigned int       version;
+   unsigned int       n_channels;
+   unsigned int       n_cells;
+   unsigned long long created_wall_ns; // CLOCK_REALTIME, ns since epoch
+   unsigned short     board_serial_number;
+   unsigned short     range;          // input range center [mV], as in EHEADER
+   unsigned int       reserved;
+} PEDESTAL_HEADER;
+
+typedef struct {
+   int                channel;        // 0 = CH1
+   unsigned int       n_events;
+   float              cell_mean[PEDESTAL_CELLS];    // by physical cell
+   float              cell_sigma[PEDESTAL_CELLS];   // noise by physical cell
+   unsigned int       cell_count[PEDESTAL_CELLS];
+   float              sample_mean[PEDESTAL_CELLS];  // by sample after the trigger cell
+   float              sample_sigma[PEDESTAL_CELLS];
+} PEDESTAL_CHANNEL;
+
+/*------------------------------------------------------------------*/
+
+class PedestalCalibration {
+protected:
+   const char        *fFile[PEDESTAL_CHANNELS];
+   int                fMaxEvents;
+   int                fStatus[PEDESTAL_CHANNELS];
+   unsigned short     fSerial[PEDESTAL_CHANNELS];   // from the file of each channel
+   unsigned short     fRange[PEDESTAL_CHANNELS];
+   PEDESTAL_HEADER    fHeader;
+   PEDESTAL_CHANNEL   fChannel[PEDESTAL_CHANNELS];
+   double             fCellMean[PEDESTAL_CHANNELS][PEDESTAL_CELLS];   // copied to PEDESTAL_CHANNEL at the end
+   double             fCellM2[PEDESTAL_CHANNELS][PEDESTAL_CELLS];
+   double             fSampleMean[PEDESTAL_CHANNELS][PEDESTAL_CELLS];
+   double             fSampleM2[PEDESTAL_CHANNELS][PEDESTAL_CELLS];
+
+   void               ProcessFile(int channel);
+
+public:
+   PedestalCalibration();
+
+   void               SetFile(int channel, const char *filename) { fFile[channel] = filename; }
+   void               SetMaxEvents(int n) { fMaxEvents = n; }
+   int                Run();
+   int                Write(const char *filename) const;
+   int                WriteText(const char *filename) const;
+   int                WriteLegacy(const char *filename) const;
+   const PEDESTAL_CHANNEL *GetChannel(int channel) const { return &fChannel[channel]; }
+};
+
+/*------------------------------------------------------------------*/
+
+class PedestalTable {
+protected:
+   bool               fValid[PEDESTAL_CHANNELS];
+   float              fMean[PEDESTAL_CHANNELS][PEDESTAL_CELLS];
+   float              fSigma[PEDESTAL_CHANNELS][PEDESTAL_CELLS];
+
+public:
+   PedestalTable();
+
+   int                Load(const char *filename);
+   bool               IsValid(int channel) const { return fValid[channel]; }
+   const float       *GetMean(int channel) const { return fMean[channel]; }
+   const float       *GetSigma(int channel) const { return fSigma[channel]; }
+   void               Subtract(int channel, float *wave, int triggerCell) const;
+};
+
+#endif // PEDESTAL_H
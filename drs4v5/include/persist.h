@@ -0,0 +1,77 @@
+/********************************************************************\
+
+  Name:         persist.h
+
+  Contents:     Persistence (time x voltage density) map of many
+                waveforms, filled by several threads without locks
+                and readable while the filling goes on
+
+\********************************************************************/
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define PERSIST_MAX_THREADS 64
+#define PERSIST_MERGE       64        // waveforms per thread before merging by default
+
+/* counts of one filling thread, merged into the shared map */
+typedef struct {
+   std::vector<unsigned int> map;     // fNx * fNy bins plus one overflow bin
+   unsigned long long waveforms;
+   unsigned int       generation;     // of the shared map when filling started
+   char               pad[64];        // keep the partials of two threads apart
+} PERSIST_PARTIAL;
+
+class PersistenceMap {
+protected:
+   int                fNx;              // time bins
+   int                fNy;              // voltage bins
+   double             fTMin, fTMax;     // ns
+   double             fVMin, fVMax;     // mV
+   float              fTScale, fVScale; // bins per ns and per mV
+   int                fMergeWaveforms;
+   int                fThreads;
+   PERSIST_PARTIAL   *fPartial[PERSIST_MAX_THREADS];
+
+   std::atomic<unsigned int>       *fMap;
+   std::atomic<unsigned long long>  fWaveforms;
+   std::atomic<unsigned long long>  fOverflow;
+   std::atomic<unsigned int>        fGeneration;  // odd while a Clear() runs
+   std::atomic<int>                 fMerging;     // merges adding to the map
+   std::mutex                       fClearMutex;  // between clearing threads only
+
+private:
+   PersistenceMap(const PersistenceMap &c);              // not implemented
+   PersistenceMap &operator=(const PersistenceMap &rhs); // not implemented
+
+public:
+   PersistenceMap(int nx, double tMin, double tMax, int ny, double vMin, double vMax, int nThreads = 1);
+   ~PersistenceMap();
+
+   /* thread is 0 ... nThreads-1, each index used by one thread only;
+      time NULL stands for the sample number */
+   void               Fill(int thread, const float *time, const float *wave, int n);
+   void               Merge(int thread);
+   void               SetMergeWaveforms(int n) { fMergeWaveforms = n > 0 ? n : 1; }
+
+   /* any thread, also while others fill */
+   unsigned long long Snapshot(unsigned int *map, unsigned int *maximum = NULL) const;
+   void               Clear();       // waits for merges in progress
+   int                SaveImage(const char *filename) const;
+
+   int                GetNx() const { return fNx; }
+   int                GetNy() const { return fNy; }
+   double             GetTMin() const { return fTMin; }
+   double             GetTMax() const { return fTMax; }
+   double             GetVMin() const { return fVMin; }
+   double             GetVMax() const { return fVMax; }
+   unsigned long long GetWaveforms() const { return fWaveforms.load(std::memory_order_acquire); }
+   unsigned long long GetOverflow() const { return fOverflow.load(std::memory_order_relaxed); }
+};
+
+#endif // PERSIST_H
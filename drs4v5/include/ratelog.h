@@ -0,0 +1,82 @@
+/********************************************************************\
+
+  Name:         ratelog.h
+
+  Contents:     Binary time series of singles and coincidence counts
+                with an estimate of the accidental coincidences
+
+                File layout: one RLOG_HEADER followed by RLOG_RECORD
+                entries, all little endian, no padding.
+
+\********************************************************************/
+
+#ifndef RATELOG_H
+#define RATELOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "counter.h"
+
+#define RLOG_VERSION 1
+#define RLOG_SINGLES (kNumberOfScalers - 1)   // CH1..CH4, EXT
+
+typedef struct {
+   char               tag[4];            // "RLOG"
+   unsigned int       version;
+   unsigned int       fold;              // number of channels in the coincidence
+   unsigned int       channel_mask;      // Bit0=CH1 .. Bit3=CH4
+   double             resolving_time;    // [s]
+   unsigned long long start_wall_ns;     // CLOCK_REALTIME at start, ns since epoch
+   unsigned int       interval_ms;       // nominal record interval
+   unsigned int       reserved;
+} RLOG_HEADER;
+
+typedef struct {
+   double             t;                 // end of interval, s since start
+   float              dt;                // interval length [s]
+   float              singles[RLOG_SINGLES];   // counts in interval
+   float              coincidences;      // trigger counts in interval
+   float              accidental;        // expected accidental counts in interval
+} RLOG_RECORD;
+
+/*------------------------------------------------------------------*/
+
+class RateLogger {
+protected:
+   FILE              *fFile;
+   RLOG_HEADER        fHeader;
+   double             fInterval;         // [s]
+   double             fT;                // time of last Add()
+   double             fDt;               // time accumulated for the next record
+   double             fCount[kNumberOfScalers];
+   double             fTotalTime;
+   double             fTotalCoincidences;
+   double             fTotalAccidental;
+   double             fLastFlush;
+   unsigned long long fRecords;
+
+   void WriteRecord();
+
+private:
+   RateLogger(const RateLogger &c);              // not implemented
+   RateLogger &operator=(const RateLogger &rhs); // not implemented
+
+public:
+   RateLogger();
+   ~RateLogger();
+
+   static double AccidentalRate(const double *rate, int channelMask, double resolvingTime);
+
+   int      Open(const char *filename, int channelMask, double resolvingTimeNs, int intervalMs,
+                 uint64_t startWallNs);
+   void     Add(double t, double dt, const double *counts);
+   void     Close();
+   bool     IsOpen() const { return fFile != NULL; }
+
+   unsigned long long GetRecords() const { return fRecords; }
+   double   GetCoincidenceRate() const { return fTotalTime > 0 ? fTotalCoincidences / fTotalTime : 0; }
+   double   GetAccidentalRate() const { return fTotalTime > 0 ? fTotalAccidental / fTotalTime : 0; }
+};
+
+#endif // RATELOG_H
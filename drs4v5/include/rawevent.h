@@ -0,0 +1,71 @@
+/********************************************************************\
+
+  Name:         rawevent.h
+
+  Contents:     One event of an evaluation board held as the raw
+                TransferWaves buffer, channels are decoded, calibrated
+                and given a time axis only when first asked for
+
+\********************************************************************/
+
+#ifndef RAWEVENT_H
+#define RAWEVENT_H
+
+#include "DRS.h"
+
+/* DRS channels in the TransferWaves(0, 8) buffer of an evaluation board */
+#define DRS_RAW_EVENT_CHANNELS 9
+#define DRS_RAW_EVENT_SIZE (DRS_RAW_EVENT_CHANNELS * 2 * kNumberOfBins + 4)
+#define DRS_RAW_EVENT_INPUTS   4      // CH1..CH4 = DRS channels 0, 2, 4, 6
+
+class SpikeRemover;
+
+class DRSRawEvent {
+protected:
+   DRSBoard          *fBoard;
+   unsigned char     *fData;            // raw buffer, own or attached
+   unsigned char     *fOwnData;
+   int                fTriggerCell;
+   unsigned int       fADCValid;        // one bit per DRS channel
+   unsigned int       fWaveValid;
+   unsigned int       fTimeValid;
+   unsigned short     fADC[DRS_RAW_EVENT_CHANNELS][kNumberOfBins];
+   float              fWave[DRS_RAW_EVENT_CHANNELS][kNumberOfBins];
+   float              fTime[DRS_RAW_EVENT_CHANNELS][kNumberOfBins];
+   SpikeRemover      *fSpikeRemover;    // optional, applied to all inputs at once
+   short              fSpikeWave[DRS_RAW_EVENT_INPUTS][kNumberOfBins];  // cell #0 at bin 0
+
+   unsigned long long fDecoded;         // channels decoded since construction
+   unsigned long long fCalibrated;
+   unsigned long long fTimed;
+
+   void            CalibrateInputs();
+
+private:
+   DRSRawEvent(const DRSRawEvent &c);              // not implemented
+   DRSRawEvent &operator=(const DRSRawEvent &rhs); // not implemented
+
+public:
+   DRSRawEvent(DRSBoard *board);
+   ~DRSRawEvent();
+
+   int             Transfer();
+   void            Attach(unsigned char *buffer, int triggerCell);
+   void            SetSpikeRemover(SpikeRemover *s) { fSpikeRemover = s; fWaveValid = 0; }
+
+   DRSBoard       *GetBoard() const { return fBoard; }
+   unsigned char  *GetBuffer() const { return fData; }
+   int             GetTriggerCell() const { return fTriggerCell; }
+
+   /* channel is the DRS channel, input CHn of the evaluation board is 2*(n-1) */
+   const unsigned short *GetADC(int channel);
+   float          *GetWave(int channel);
+   float          *GetTime(int channel);
+   bool            IsDecoded(int channel) const { return (fADCValid & (1 << channel)) != 0; }
+
+   unsigned long long GetDecoded() const { return fDecoded; }
+   unsigned long long GetCalibrated() const { return fCalibrated; }
+   unsigned long long GetTimed() const { return fTimed; }
+};
+
+#endif // RAWEVENT_H
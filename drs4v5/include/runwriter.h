@@ -0,0 +1,97 @@
+/********************************************************************\
+
+  Name:         runwriter.h
+
+  Contents:     Run directories of the muonDet ADC mode with rollover
+                to a new run by event count, file size or wall time
+                while the acquisition keeps running
+
+\********************************************************************/
+
+#ifndef RUNWRITER_H
+#define RUNWRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "daqtimer.h"
+
+class RunWriter {
+protected:
+   std::string        fBase;            // data/<run name>, first run directory
+   std::string        fDir;             // directory of the current run
+   std::string        fNextDir;         // prepared by the worker thread
+   std::string        fRemarks;         // remarks of the first run, copied into every run
+   int                fRun;             // 0 for the first run, then _001, _002, ...
+   int                fNextRun;         // index of fNextDir, existing directories are skipped
+   int                fRuns;            // run directories written
+   bool               fNextReady;
+   bool               fPreparing;       // worker is creating fNextDir
+   bool               fFailed;          // no next directory, the current run goes on
+
+   unsigned long long fMaxEvents;       // rollover limits, 0 = no limit
+   unsigned long long fMaxBytes;
+   double             fMaxSeconds;
+
+   unsigned long long fEvents;          // of the current run
+   unsigned long long fBytes;
+   uint64_t           fRunStart;
+   uint64_t           fRunStartWall;
+   LatencyHistogram   fSwitch;          // main thread time of each rollover
+
+   std::deque<std::function<void()> > fJobs;
+   std::thread        fThread;
+   std::mutex         fMutex;
+   std::condition_variable fWake;       // new job, or next directory ready
+   bool               fStop;
+
+   std::string        RunDir(int run) const;
+   int                Prepare(const std::string &dir);
+   int                PrepareFree(int run, int *created);
+   void               Finish(const std::string &dir, const std::string &footer);
+   void               Queue(const std::function<void()> &job);
+   void               QueuePrepare(int run);
+   void               Worker();
+
+private:
+   RunWriter(const RunWriter &c);              // not implemented
+   RunWriter &operator=(const RunWriter &rhs); // not implemented
+
+public:
+   RunWriter();
+   ~RunWriter();
+
+   int                LoadConfig(const char *filename);
+   void               SetRollover(unsigned long long events, double megabytes, double minutes);
+   bool               IsRolloverEnabled() const { return fMaxEvents || fMaxBytes || fMaxSeconds > 0; }
+
+   int                Open(const char *baseDir, const char *runName);
+   std::string        GetPath(const char *name) const { return fDir + "/" + name; }
+   const std::string &GetDir() const { return fDir; }
+   int                GetRun() const { return fRun; }
+   void               Start();
+
+   void               AddEvent(unsigned long long bytes) { fEvents++; fBytes += bytes; }
+   unsigned long long GetEvents() const { return fEvents; }
+   unsigned long long GetBytes() const { return fBytes; }
+   uint64_t           GetRunStartWall() const { return fRunStartWall; }
+   bool               IsRolloverDue() const;
+
+   /* Rollover() only after PrepareRollover() succeeded, it then cannot fail */
+   int                PrepareRollover();
+   int                Rollover(const std::string &footer, const std::function<void()> &close,
+                               const std::function<void()> &open);
+   void               Close(const std::string &footer, const std::function<void()> &close);
+
+   const LatencyHistogram &GetSwitchLatency() const { return fSwitch; }
+   void               PrintConfig(FILE *f) const;
+   void               PrintSummary(FILE *f) const;
+};
+
+#endif // RUNWRITER_H
@@ -0,0 +1,66 @@
+/********************************************************************\
+
+  Name:         sigavg.h
+
+  Contents:     Averaging of calibrated waveforms over many triggers,
+                keeping only the mean and RMS waveform of each channel
+
+\********************************************************************/
+
+#ifndef SIGAVG_H
+#define SIGAVG_H
+
+#include <stdio.h>
+#include <vector>
+
+#define SIGAVG_BINS         1024      // kNumberOfBins, trigger cell at bin 0
+#define SIGAVG_MAX_CHANNELS 8
+#define SIGAVG_MAX_POINTS   8192      // of a resampling grid
+#define SIGAVG_BLOCK        256       // events summed in float before going to double
+
+class SignalAverager {
+protected:
+   int                fChannels;
+   int                fPoints;          // SIGAVG_BINS or the grid points
+   bool               fResample;
+   double             fGridStart;       // ns after the trigger cell
+   double             fGridStep;
+   unsigned long long fEvents;
+   int                fBlockEvents;     // events in the float sums
+
+   /* per channel and point, all sums relative to the first event */
+   std::vector<float>  fRef;
+   std::vector<float>  fRefTime;
+   std::vector<float>  fBlockSum;
+   std::vector<float>  fBlockSum2;
+   std::vector<float>  fBlockTime;
+   std::vector<double> fSum;
+   std::vector<double> fSum2;
+   std::vector<double> fTimeSum;
+   std::vector<float>  fSample;         // one resampled waveform
+
+   void               Flush();
+   void               Resample(const float *time, const float *wave, float *out) const;
+
+public:
+   SignalAverager(int channels = 4);
+
+   /* points > 0 resamples every event to start + i * step, else bins stay as they are */
+   int                SetGrid(double start, double step, int points);
+   bool               IsResampling() const { return fResample; }
+   int                GetNumberOfChannels() const { return fChannels; }
+   int                GetNumberOfPoints() const { return fPoints; }
+   void               Reset();
+
+   /* wave[channel] and time[channel] as from DRSRawEvent::GetWave()/GetTime() */
+   void               Add(float *const *time, float *const *wave);
+
+   unsigned long long GetEvents() const { return fEvents; }
+   void               GetTime(int channel, double *t);
+   void               GetMean(int channel, double *mean);
+   void               GetRMS(int channel, double *rms);
+
+   int                Save(const char *filename, const char *comment = NULL);
+};
+
+#endif // SIGAVG_H
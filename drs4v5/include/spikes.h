@@ -0,0 +1,41 @@
+/********************************************************************\
+
+  Name:         spikes.h
+
+  Contents:     Removal of the symmetric DRS4 spikes on all channels
+                of a chip, for single events or batches of events in
+                one contiguous buffer
+
+\********************************************************************/
+
+#ifndef SPIKES_H
+#define SPIKES_H
+
+#define SPIKE_BINS 1024               // kNumberOfBins, cell #0 at bin 0
+
+class SpikeRemover {
+protected:
+   short              fDiffThreshold;
+   int                fSpikeWidth;
+   short              fMaxPeakToPeak;
+   short              fSpikeVoltage;
+   int                fNTimeRegionThreshold;
+   unsigned long long fEvents;
+   unsigned long long fRemoved;
+
+public:
+   SpikeRemover(short diffThreshold = 20, int spikeWidth = 2, short maxPeakToPeak = 1000,
+                short spikeVoltage = 0, int nTimeRegionThreshold = 3);
+
+   static bool        Remove(short **wf, int nwf, short diffThreshold, int spikeWidth,
+                             short maxPeakToPeak, short spikeVoltage, int nTimeRegionThreshold);
+
+   /* wf[nEvents][nwf][SPIKE_BINS], returns the number of events with spikes removed */
+   int                Process(short *wf, int nwf, int nEvents = 1);
+   bool               Process(short **wf, int nwf);
+
+   unsigned long long GetEvents() const { return fEvents; }
+   unsigned long long GetRemoved() const { return fRemoved; }
+};
+
+#endif // SPIKES_H
@@ -0,0 +1,67 @@
+/********************************************************************\
+
+  Name:         swtrigger.h
+
+  Contents:     Software coincidence / veto filter on raw ADC samples,
+                applied before waveform calibration
+
+\********************************************************************/
+
+#ifndef SWTRIGGER_H
+#define SWTRIGGER_H
+
+#include <stdio.h>
+
+#include "DRS.h"
+#include "rawevent.h"
+
+#define SWTRIGGER_CHANNELS 4          // inputs CH1..CH4
+#define SWTRIGGER_BASELINE_BINS 16    // bins at the start of the region used for the baseline
+#define SWTRIGGER_COUNTS_PER_MV 65.536  // 16 bit ADC over 1 V input range
+
+class SoftwareTrigger {
+protected:
+   bool               fEnabled;
+   double             fThresholdMV[SWTRIGGER_CHANNELS];   // relative to baseline, sign gives polarity
+   int                fThreshold[SWTRIGGER_CHANNELS];     // ADC counts, always positive
+   int                fMask;          // channels taking part in the coincidence, Bit0=CH1
+   int                fMinFired;      // N out of the channels in fMask
+   int                fVeto;          // channels rejecting the event if they fire
+   double             fWindowNs;      // all fired channels within this time window
+   double             fFrequency;     // sampling frequency [GHz]
+   int                fWindowBins;
+   int                fFirstBin;
+   int                fLastBin;
+   int                fCrossing[SWTRIGGER_CHANNELS];      // first bin above threshold, -1 if none
+
+   unsigned long long fEvents;
+   unsigned long long fPassed;
+   unsigned long long fRejectedMultiplicity;
+   unsigned long long fRejectedWindow;
+   unsigned long long fRejectedVeto;
+
+   int FindCrossing(const unsigned short *adc, int channel);
+
+public:
+   SoftwareTrigger();
+
+   int      LoadConfig(const char *filename);
+   void     SetFrequency(double ghz);
+   void     SetThreshold(int channel, double mV);
+   void     SetPattern(int mask, int minFired, int veto, double windowNs);
+   void     SetRegion(int firstBin, int lastBin);
+   void     SetEnabled(bool flag) { fEnabled = flag; }
+   bool     IsEnabled() const { return fEnabled; }
+
+   bool     Accept(DRSRawEvent &event);
+   int      GetCrossing(int channel) const { return fCrossing[channel]; }
+
+   void     ResetStatistics();
+   unsigned long long GetEvents() const { return fEvents; }
+   unsigned long long GetPassed() const { return fPassed; }
+   unsigned long long GetRejected() const { return fEvents - fPassed; }
+   void     PrintConfig(FILE *f) const;
+   void     PrintStatistics(FILE *f) const;
+};
+
+#endif // SWTRIGGER_H
@@ -0,0 +1,85 @@
+/********************************************************************\
+
+  Name:         tempmon.h
+
+  Contents:     Temperature monitor selecting the voltage calibration
+                of a board from a set of calibrations taken at
+                different temperatures
+
+\********************************************************************/
+
+#ifndef TEMPMON_H
+#define TEMPMON_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "DRS.h"
+
+#define TEMPMON_VERSION 1
+
+/* calibration file, followed by one DRSVoltageCalibration */
+typedef struct {
+   char               tag[4];         // "DRST"
+   unsigned int       version;
+   int                board_serial_number;
+   unsigned int       size;           // sizeof(DRSVoltageCalibration)
+} TEMPMON_HEADER;
+
+/*------------------------------------------------------------------*/
+
+class TemperatureMonitor {
+protected:
+   DRSBoard          *fBoard;
+   double             fIntervalS;       // sensor sampling cadence
+   double             fThreshold;       // minimum change [deg. C] before switching
+   std::vector<DRSVoltageCalibration *> fSet;   // sorted by temperature
+   DRSVoltageCalibration *fNext;        // prepared by the monitor, applied by Apply()
+   std::atomic<bool>  fPending;
+   std::atomic<double> fTemperature;    // last sensor reading
+   std::atomic<double> fApplied;        // temperature of the calibration in use
+   std::atomic<unsigned long long> fSamples;
+   unsigned long long fSwitches;
+   uint64_t           fLastSample;
+   std::thread        fThread;
+   std::mutex         fMutex;
+   std::condition_variable fWake;
+   bool               fRunning;
+   bool               fStop;
+
+   void               Sample();
+   void               Worker();
+
+private:
+   TemperatureMonitor(const TemperatureMonitor &c);              // not implemented
+   TemperatureMonitor &operator=(const TemperatureMonitor &rhs); // not implemented
+
+public:
+   TemperatureMonitor(DRSBoard *board, double intervalS = 10, double threshold = 0.5);
+   ~TemperatureMonitor();
+
+   int                AddCalibration(const DRSVoltageCalibration *c);
+   int                AddBoardCalibration(const char *dir = NULL);
+   int                LoadCalibrations(const char *dir);
+   int                SaveCalibration(const char *dir, const DRSVoltageCalibration *c) const;
+   void               Interpolate(double temperature, DRSVoltageCalibration *c) const;
+
+   void               Start();
+   void               Stop();
+   bool               Apply();
+
+   int                GetNumberOfCalibrations() const { return (int) fSet.size(); }
+   double             GetTemperature() const { return fTemperature; }
+   double             GetCalibrationTemperature() const { return fApplied; }
+   unsigned long long GetSamples() const { return fSamples; }
+   unsigned long long GetSwitches() const { return fSwitches; }
+
+   void               PrintSummary(FILE *f) const;
+};
+
+#endif // TEMPMON_H
@@ -11,9 +11,15 @@
 
 #define NEW_TIMING_CALIBRATION
 
+#include <vector>
+#include <mutex>
+#include <map>
+#include <memory>
 #ifdef USE_DRS_MUTEX 
-#include "wx/wx.h"    // must be before <windows.h>
+#include <thread>
+#include <condition_variable>
 #endif
+#include <chrono>
 
 #include <stdio.h>
 #include <math.h>
@@ -26,6 +32,8 @@
 #include <fcntl.h>
 #include "strlcpy.h"
 #include "DRS.h"
+#include "calibcache.h"
+#include "spikes.h"
 
 #ifdef _MSC_VER
 #pragma warning(disable:4996)
@@ -84,6 +92,26 @@ const int REQUIRED_FIRMWARE_VERSION_DRS4 = 15147;
 #define VCALIB_METHOD  2
 #define TCALIB_METHOD  2 // correct for sampling frequency, calibrate every channel
 
+/* WriteEEPROM() counts a calibration generation in the page 0 header
+   up on every write, so page 0 alone tells whether any calibration
+   page changed; returns the bytes of page 0 to check and the index
+   of the 16-bit generation word, 0 for boards without one */
+static int drs_calib_header(int boardType, int *generation)
+{
+   if (boardType == 9) {
+      *generation = 12;              // after temperature/range and page flag
+      return 4096;
+   } else if (boardType == 5 || boardType == 7 || boardType == 8) {
+      *generation = 8;               // odd words hold the timing calibration
+      return 4096;
+   } else if (boardType == 6) {
+      *generation = 7;
+      return 16;
+   }
+   *generation = -1;
+   return 0;
+}
+
 /*---- VME addresses -----------------------------------------------*/
 #ifdef HAVE_VME
 /* assuming following DIP Switch settings:
@@ -147,13 +175,65 @@ using namespace std;
 
 #ifdef HAVE_USB
 #define USB2_BUFFER_SIZE (1024*1024+10)
-unsigned char static *usb2_buffer = NULL;
 #endif
 
 /*------------------------------------------------------------------*/
 
-#ifdef USE_DRS_MUTEX
-static wxMutex *s_drsMutex = NULL; // used for wxWidgets multi-threaded programs
+/* one lock per USB or VME interface, so that boards on different
+   interfaces can be accessed concurrently from different threads;
+   only taken with USE_DRS_MUTEX, but always there so that DRSBoard
+   has the same layout in every translation unit */
+static std::mutex s_drsMutexMapLock;
+static std::map<void *, std::unique_ptr<std::mutex> > s_drsMutexMap;
+
+static std::mutex *drs_interface_mutex(void *iface)
+{
+   std::lock_guard<std::mutex> lock(s_drsMutexMapLock);
+   std::unique_ptr<std::mutex> &m = s_drsMutexMap[iface];
+   if (!m)
+      m.reset(new std::mutex());
+   return m.get();
+}
+
+/* called once no board uses the interface any more */
+static void drs_release_interface_mutex(void *iface)
+{
+   std::lock_guard<std::mutex> lock(s_drsMutexMapLock);
+   s_drsMutexMap.erase(iface);
+}
+
+/*------------------------------------------------------------------*/
+
+static double drs_elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+   return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*------------------------------------------------------------------*/
+
+#ifdef HAVE_USB
+static void drs_construct_usb_board(MUSB_INTERFACE *usb_interface, int usb_slot, DRSBoard **board, double *t)
+{
+   unsigned char buffer[512];
+   int i;
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   if (usb_interface->usb_type == 2) {
+      /* drain any data from Cy7C68013 FIFO if FPGA startup caused erratic write */
+      do {
+         i = musb_read(usb_interface, 8, buffer, sizeof(buffer), 100);
+         if (i > 0)
+            printf("%d bytes stuck in buffer\n", i);
+      } while (i > 0);
+   }
+   t[DRS::kStartupDrain] = drs_elapsed_ms(start);
+
+   /* serial number, firmware and calibration */
+   start = std::chrono::steady_clock::now();
+   *board = new DRSBoard(usb_interface, usb_slot);
+   t[DRS::kStartupConstruct] = drs_elapsed_ms(start);
+}
 #endif
 
 /*------------------------------------------------------------------*/
@@ -173,6 +253,9 @@ DRS::DRS()
 #endif
 
    memset(fError, 0, sizeof(fError));
+   memset(fStartupTime, 0, sizeof(fStartupTime));
+   memset(fBoardStartupTime, 0, sizeof(fBoardStartupTime));
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
 #ifdef HAVE_VME
    unsigned short type, fw, magic, serial, temperature;
@@ -296,15 +379,22 @@ DRS::DRS()
       }
    } else
       printf("Cannot access VME crate, check driver, power and connection\n");
+
+   /* VME boards share one interface and are constructed during the scan */
+   fStartupTime[kStartupScan] = drs_elapsed_ms(start);
+   start = std::chrono::steady_clock::now();
 #endif                          // HAVE_VME
 
 #ifdef HAVE_USB
    unsigned char buffer[512];
-   int found, one_found, usb_slot;
+   int found, one_found, usb_slot, first;
+   MUSB_INTERFACE *usb_found[kMaxNumberOfBoards];
 
+   /* first only find the interfaces, FIFO draining and board construction
+      (serial number, firmware check, calibration) are done per board below */
    one_found = 0;
    usb_slot = 0;
-   for (index = 0; index < 127; index++) {
+   for (index = 0; index < 127 && usb_slot < kMaxNumberOfBoards - fNumberOfBoards; index++) {
       found = 0;
 
       /* check for USB-Mezzanine test board */
@@ -320,40 +410,23 @@ DRS::DRS()
             musb_close(usb_interface);
          } else {
             usb_interface->usb_type = 1;        // USB 1.1
-            fBoard[fNumberOfBoards] = new DRSBoard(usb_interface, usb_slot++);
-            if (!fBoard[fNumberOfBoards]->HasCorrectFirmware())
-               sprintf(fError, "Wrong firmware version: board has %d, required is %d. Board may not work correctly.\n",
-                       fBoard[fNumberOfBoards]->GetFirmwareVersion(),
-                       fBoard[fNumberOfBoards]->GetRequiredFirmwareVersion());
-            fNumberOfBoards++;
+            usb_found[usb_slot++] = usb_interface;
             found = 1;
             one_found = 1;
          }
       }
 
       /* check for DRS4 evaluation board */
-      if (musb_open(&usb_interface, 0x04B4, 0x1175, index, 1, 0) == MUSB_SUCCESS) {
+      if (usb_slot < kMaxNumberOfBoards - fNumberOfBoards &&
+          musb_open(&usb_interface, 0x04B4, 0x1175, index, 1, 0) == MUSB_SUCCESS) {
 
          /* check ID */
          if (musb_get_device(usb_interface) != 1) {
             /* no DRS evaluation board found */
             musb_close(usb_interface);
          } else {
-
-            /* drain any data from Cy7C68013 FIFO if FPGA startup caused erratic write */
-            do {
-               i = musb_read(usb_interface, 8, buffer, sizeof(buffer), 100);
-               if (i > 0)
-                  printf("%d bytes stuck in buffer\n", i);
-            } while (i > 0);
-
             usb_interface->usb_type = 2;        // USB 2.0
-            fBoard[fNumberOfBoards] = new DRSBoard(usb_interface, usb_slot++);
-            if (!fBoard[fNumberOfBoards]->HasCorrectFirmware())
-               sprintf(fError, "Wrong firmware version: board has %d, required is %d. Board may not work correctly.\n",
-                      fBoard[fNumberOfBoards]->GetFirmwareVersion(),
-                      fBoard[fNumberOfBoards]->GetRequiredFirmwareVersion());
-            fNumberOfBoards++;
+            usb_found[usb_slot++] = usb_interface;
             found = 1;
             one_found = 1;
          }
@@ -365,6 +438,33 @@ DRS::DRS()
          break;
       }
    }
+   fStartupTime[kStartupScan] += drs_elapsed_ms(start);
+
+   /* each board sits on its own interface, so they can be set up concurrently */
+   start = std::chrono::steady_clock::now();
+   first = fNumberOfBoards;
+#ifdef USE_DRS_MUTEX
+   if (usb_slot > 1) {
+      std::vector<std::thread> workers;
+      for (i = 0; i < usb_slot; i++)
+         workers.push_back(std::thread(drs_construct_usb_board, usb_found[i], i, &fBoard[first + i],
+                                       fBoardStartupTime[first + i]));
+      for (i = 0; i < usb_slot; i++)
+         workers[i].join();
+   } else
+#endif
+      for (i = 0; i < usb_slot; i++)
+         drs_construct_usb_board(usb_found[i], i, &fBoard[first + i], fBoardStartupTime[first + i]);
+
+   for (i = 0; i < usb_slot; i++) {
+      fStartupTime[kStartupDrain] = std::max(fStartupTime[kStartupDrain], fBoardStartupTime[first + i][kStartupDrain]);
+      if (!fBoard[fNumberOfBoards]->HasCorrectFirmware())
+         sprintf(fError, "Wrong firmware version: board has %d, required is %d. Board may not work correctly.\n",
+                fBoard[fNumberOfBoards]->GetFirmwareVersion(),
+                fBoard[fNumberOfBoards]->GetRequiredFirmwareVersion());
+      fNumberOfBoards++;
+   }
+   fStartupTime[kStartupConstruct] = drs_elapsed_ms(start) - fStartupTime[kStartupDrain];
 #endif                          // HAVE_USB
 
    return;
@@ -378,16 +478,11 @@ DRS::~DRS()
    for (i = 0; i < fNumberOfBoards; i++) {
       delete fBoard[i];
    }
-
-#ifdef HAVE_USB
-   if (usb2_buffer) {
-      free(usb2_buffer);
-      usb2_buffer = NULL;
-   }
-#endif
+   DRSCalibCache::Flush();
 
 #ifdef HAVE_VME
    mvme_close(fVmeInterface);
+   drs_release_interface_mutex(fVmeInterface);
 #endif
 }
 
@@ -402,6 +497,8 @@ void DRS::SortBoards()
             DRSBoard* b = fBoard[i];
             fBoard[i] = fBoard[j];
             fBoard[j] = b;
+            for (int k=0 ; k<kNumberOfStartupPhases ; k++)
+               std::swap(fBoardStartupTime[i][k], fBoardStartupTime[j][k]);
          }
       }
    }
@@ -409,6 +506,87 @@ void DRS::SortBoards()
 
 /*------------------------------------------------------------------*/
 
+static void drs_init_board(DRSBoard *b, double freq, int *status, double *t)
+{
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   int s = b->Init();
+   t[DRS::kStartupInit] = drs_elapsed_ms(start);
+
+   start = std::chrono::steady_clock::now();
+   if (!b->SetFrequency(freq, true))
+      s = 0;
+   t[DRS::kStartupFrequency] = drs_elapsed_ms(start);
+
+   *status = s;
+}
+
+/*------------------------------------------------------------------*/
+
+int DRS::InitBoards(double freq)
+{
+   /* Init() and SetFrequency(freq, true) on all boards, boards on
+      different interfaces concurrently. Returns the number of boards
+      which failed. */
+   int status[kMaxNumberOfBoards];
+   int i, failed;
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#ifdef USE_DRS_MUTEX
+   if (fNumberOfBoards > 1) {
+      std::vector<std::thread> workers;
+      for (i = 0; i < fNumberOfBoards; i++)
+         workers.push_back(std::thread(drs_init_board, fBoard[i], freq, &status[i], fBoardStartupTime[i]));
+      for (i = 0; i < fNumberOfBoards; i++)
+         workers[i].join();
+   } else
+#endif
+      for (i = 0; i < fNumberOfBoards; i++)
+         drs_init_board(fBoard[i], freq, &status[i], fBoardStartupTime[i]);
+
+   fStartupTime[kStartupInit] = 0;
+   for (i = 0, failed = 0; i < fNumberOfBoards; i++) {
+      fStartupTime[kStartupInit] = std::max(fStartupTime[kStartupInit], fBoardStartupTime[i][kStartupInit]);
+      if (!status[i]) {
+         sprintf(fError, "Initialization of board #%d failed.\n", fBoard[i]->GetBoardSerialNumber());
+         failed++;
+      }
+   }
+   fStartupTime[kStartupFrequency] = drs_elapsed_ms(start) - fStartupTime[kStartupInit];
+
+   return failed;
+}
+
+/*------------------------------------------------------------------*/
+
+void DRS::PrintStartupReport(FILE *f) const
+{
+   static const char *phase[kNumberOfStartupPhases] = { "Scan", "Drain", "Construct", "Init", "Frequency" };
+   double total;
+   int i, j;
+
+   /* phases run concurrently on all boards, so the wall time of a phase
+      is close to the slowest board and not the sum over the boards */
+   fprintf(f, "Startup time [ms]:\n");
+   fprintf(f, "  %-10s %10s", "Phase", "Wall");
+   for (i = 0; i < fNumberOfBoards; i++)
+      fprintf(f, "   #%-6d", fBoard[i]->GetBoardSerialNumber());
+   fprintf(f, "\n");
+
+   for (j = 0, total = 0; j < kNumberOfStartupPhases; j++) {
+      fprintf(f, "  %-10s %10.1lf", phase[j], fStartupTime[j]);
+      for (i = 0; i < fNumberOfBoards; i++)
+         if (j == kStartupScan)
+            fprintf(f, " %10s", "-");
+         else
+            fprintf(f, " %10.1lf", fBoardStartupTime[i][j]);
+      fprintf(f, "\n");
+      total += fStartupTime[j];
+   }
+   fprintf(f, "  %-10s %10.1lf\n", "Total", total);
+}
+
+/*------------------------------------------------------------------*/
+
 void DRS::SetBoard(int i, DRSBoard *b)
 {
    fBoard[i] = b;
@@ -456,6 +634,7 @@ DRSBoard::DRSBoard(MUSB_INTERFACE * musb_interface, int usb_slot)
     , fADCClkInvert(0)
     , fExternalClockFrequency(0)
     , fUsbInterface(musb_interface)
+    , fUsb2Buffer(0)
 #ifdef HAVE_VME
     , fVmeInterface(0)
     , fBaseAddress(0)
@@ -507,6 +686,7 @@ DRSBoard::DRSBoard(MUSB_INTERFACE * musb_interface, int usb_slot)
    memset(fStopCell, 0, sizeof(fStopCell));
    memset(fStopWSR, 0, sizeof(fStopWSR));
    fTriggerBus = 0;
+   fBusMutex = drs_interface_mutex(musb_interface);
    ConstructBoard();
 }
 
@@ -546,6 +726,7 @@ DRSBoard::DRSBoard(MVME_INTERFACE * mvme_interface, mvme_addr_t base_address, in
 , fExternalClockFrequency(0)
 #ifdef HAVE_USB
 , fUsbInterface(0)
+, fUsb2Buffer(0)
 #endif
 #ifdef HAVE_VME
 , fVmeInterface(mvme_interface)
@@ -589,6 +770,7 @@ DRSBoard::DRSBoard(MVME_INTERFACE * mvme_interface, mvme_addr_t base_address, in
 , fDebug(0)
 , fTriggerStartBin(0)
 {
+   fBusMutex = drs_interface_mutex(mvme_interface);
    ConstructBoard();
 }
 
@@ -596,19 +778,119 @@ DRSBoard::DRSBoard(MVME_INTERFACE * mvme_interface, mvme_addr_t base_address, in
 
 /*------------------------------------------------------------------*/
 
+DRSBoard::DRSBoard(int boardType, int serialNumber)
+:  fDAC_COFSA(0)
+    , fDAC_COFSB(0)
+    , fDAC_DRA(0)
+    , fDAC_DSA(0)
+    , fDAC_TLEVEL(0)
+    , fDAC_ACALIB(0)
+    , fDAC_DSB(0)
+    , fDAC_DRB(0)
+    , fDAC_COFS(0)
+    , fDAC_ADCOFS(0)
+    , fDAC_CLKOFS(0)
+    , fDAC_ROFS_1(0)
+    , fDAC_ROFS_2(0)
+    , fDAC_INOFS(0)
+    , fDAC_BIAS(0)
+    , fDRSType(4)
+    , fBoardType(boardType)
+    , fNumberOfChips(1)
+    , fNumberOfChannels(9)
+    , fRequiredFirmwareVersion(REQUIRED_FIRMWARE_VERSION_DRS4)
+    , fFirmwareVersion(0)
+    , fBoardSerialNumber(serialNumber)
+    , fHasMultiBuffer(0)
+    , fTransport(TR_USB2)
+    , fCtrlBits(0)
+    , fNumberOfReadoutChannels(9)
+    , fReadoutChannelConfig(0)
+    , fADCClkPhase(0)
+    , fADCClkInvert(0)
+    , fExternalClockFrequency(1000. / 30.)
+#ifdef HAVE_USB
+    , fUsbInterface(0)
+    , fUsb2Buffer(0)
+#endif
+#ifdef HAVE_VME
+    , fVmeInterface(0)
+    , fBaseAddress(0)
+#endif
+    , fSlotNumber(0)
+    , fNominalFrequency(1)
+    , fRefClock(60)
+    , fMultiBuffer(0)
+    , fDominoMode(1)
+    , fDominoActive(1)
+    , fChannelConfig(0)
+    , fChannelCascading(1)
+    , fChannelDepth(1024)
+    , fWSRLoop(1)
+    , fReadoutMode(0)
+    , fReadPointer(0)
+    , fNMultiBuffer(0)
+    , fTriggerEnable1(0)
+    , fTriggerEnable2(0)
+    , fTriggerSource(0)
+    , fTriggerDelay(0)
+    , fTriggerDelayNs(0)
+    , fSyncDelay(0)
+    , fDelayedStart(0)
+    , fTranspMode(0)
+    , fDecimation(0)
+    , fRange(0)
+    , fCommonMode(0.8)
+    , fAcalMode(0)
+    , fAcalVolt(0)
+    , fTcalFreq(0)
+    , fTcalLevel(0)
+    , fTcalPhase(0)
+    , fTcalSource(0)
+    , fRefclk(0)
+    , fMaxChips(0)
+    , fResponseCalibration(0)
+    , fVoltageCalibrationValid(false)
+    , fCellCalibratedRange(0)
+    , fCellCalibratedTemperature(0)
+    , fTimingCalibratedFrequency(0)
+    , fTimeData(0)
+    , fNumberOfTimeData(0)
+    , fDebug(0)
+    , fTriggerStartBin(0)
+{
+   /* board without hardware access for decoding and calibrating
+      recorded or synthetic buffers, boardType must be one of the
+      DRS4 USB evaluation boards (5, 7, 8 or 9) */
+   assert(boardType == 5 || boardType == 7 || boardType == 8 || boardType == 9);
+
+   strcpy(fCalibDirectory, ".");
+   memset(fStopCell, 0, sizeof(fStopCell));
+   memset(fStopWSR, 0, sizeof(fStopWSR));
+   fTriggerBus = 0;
+   memset(fWaveforms, 0, sizeof(fWaveforms));
+   memset(fCellOffset, 0, sizeof(fCellOffset));
+   memset(fCellOffset2, 0, sizeof(fCellOffset2));
+   memset(fCellGain, 0, sizeof(fCellGain));
+   memset(fUserPedestalMode, 0, sizeof(fUserPedestalMode));
+   memset(fCellDT, 0, sizeof(fCellDT));
+   fBusMutex = drs_interface_mutex(this);
+}
+
+/*------------------------------------------------------------------*/
+
 DRSBoard::~DRSBoard()
 {
    int i;
 #ifdef HAVE_USB
-   if (fTransport == TR_USB || fTransport == TR_USB2)
+   if ((fTransport == TR_USB || fTransport == TR_USB2) && fUsbInterface) {
       musb_close(fUsbInterface);
+      drs_release_interface_mutex(fUsbInterface);
+   }
+   if (fUsb2Buffer)
+      free(fUsb2Buffer);
 #endif
-
-#ifdef USE_DRS_MUTEX
-   if (s_drsMutex)
-      delete s_drsMutex;
-   s_drsMutex = NULL;
-#endif
+   drs_release_interface_mutex(this);
 
    // Response Calibration
    delete fResponseCalibration;
@@ -630,6 +912,7 @@ void DRSBoard::ConstructBoard()
    fDebug = 0;
    fWSRLoop = 1;
    fCtrlBits = 0;
+   memset(fUserPedestalMode, 0, sizeof(fUserPedestalMode));
 
    fExternalClockFrequency = 1000. / 30.;
    strcpy(fCalibDirectory, ".");
@@ -836,8 +1119,74 @@ void DRSBoard::ReadSerialNumber()
 
 void DRSBoard::ReadCalibration(void)
 {
+   /* The page 0 header selects a cached copy of the decoded tables.
+      It holds the calibration generation counted up by WriteEEPROM(),
+      so a board calibrated from another host is noticed without
+      reading the large calibration pages. Only if there is no cached
+      copy all pages are read and decoded and the tables cached.
+      Nothing is cached if an EEPROM page could not be read. */
+   unsigned short header[1024*16];
+   const unsigned short *page[DRS_CALIB_PAGES];
+   DRS_CALIB_KEY key;
+   int i, size, generation;
+
+   size = drs_calib_header(fBoardType, &generation);
+   if (size == 0) {
+      ReadCalibrationEEPROM(NULL);
+      return;
+   }
+   memset(header, 0, sizeof(header));
+   if (ReadEEPROM(0, header, size) != size) {
+      printf("Cannot read calibration from EEPROM page 0 of board #%d\n", fBoardSerialNumber);
+      ReadCalibrationEEPROM(NULL);
+      return;
+   }
+   for (i = 0; i < DRS_CALIB_PAGES; i++)
+      page[i] = NULL;
+   page[0] = header;
+
+   DRS_CALIB_SECTION section[] = {
+      { &fVoltageCalibrationValid,    sizeof(fVoltageCalibrationValid) },
+      { &fCellCalibratedRange,        sizeof(fCellCalibratedRange) },
+      { &fCellCalibratedTemperature,  sizeof(fCellCalibratedTemperature) },
+      { &fTimingCalibratedFrequency,  sizeof(fTimingCalibratedFrequency) },
+      { fCellOffset,                  sizeof(fCellOffset) },
+      { fCellOffset2,                 sizeof(fCellOffset2) },
+      { fCellGain,                    sizeof(fCellGain) },
+      { fCellDT,                      sizeof(fCellDT) }
+   };
+   int nSection = sizeof(section) / sizeof(section[0]);
+
+   memset(&key, 0, sizeof(key));
+   key.serial = fBoardSerialNumber;
+   key.firmware = fFirmwareVersion;
+   key.board_type = fBoardType;
+   key.generation = header[generation];
+   key.eeprom_checksum = DRSCalibCache::Checksum(header, size);
+   key.nominal_frequency = fNominalFrequency;
+
+   if (DRSCalibCache::Load(&key, section, nSection))
+      return;
+
+   if (ReadCalibrationEEPROM(page))
+      DRSCalibCache::Store(&key, section, nSection);
+}
+
+/*------------------------------------------------------------------*/
+
+bool DRSBoard::ReadCalibrationEEPROM(const unsigned short *const *page)
+{
+   /* page[n] as already read by ReadCalibration(), else from the EEPROM;
+      returns false if a page could not be read */
    unsigned short buf[1024*16]; // 32 kB
    int i, j, chip;
+   bool ok = true;
+   auto ReadPage = [&](unsigned short p, unsigned short *b, int size) {
+      if (page && p < DRS_CALIB_PAGES && page[p])
+         memcpy(b, page[p], size);
+      else if (ReadEEPROM(p, b, size) != size)
+         ok = false;
+   };
 
    fVoltageCalibrationValid = false;
    fTimingCalibratedFrequency = 0;
@@ -850,7 +1199,7 @@ void DRSBoard::ReadCalibration(void)
    /* read offsets and gain from eeprom */
    if (fBoardType == 9) {
       memset(buf, 0, sizeof(buf));
-      ReadEEPROM(0, buf, 4096);
+      ReadPage(0, buf, 4096);
       
       /* check voltage calibration method */
       if ((buf[2] & 0xFF) == VCALIB_METHOD)
@@ -858,7 +1207,7 @@ void DRSBoard::ReadCalibration(void)
       else {
          fCellCalibratedRange = 0;
          fCellCalibratedTemperature = -100;
-         return;
+         return ok;
       }
       
       /* check timing calibration method */
@@ -872,28 +1221,28 @@ void DRSBoard::ReadCalibration(void)
       fCellCalibratedRange = ((int) (buf[10] & 0xFF)) / 100.0; // -50 ... +50 => -0.5 V ... +0.5 V
       fCellCalibratedTemperature = (buf[10] >> 8) / 2.0;
       
-      ReadEEPROM(1, buf, 1024*32);
+      ReadPage(1, buf, 1024*32);
       for (i=0 ; i<8 ; i++)
          for (j=0 ; j<1024; j++) {
             fCellOffset[i][j] = buf[(i*1024+j)*2];
             fCellGain[i][j]   = buf[(i*1024+j)*2 + 1]/65535.0*0.4+0.7;
          }
       
-      ReadEEPROM(2, buf, 1024*32);
+      ReadPage(2, buf, 1024*32);
       for (i=0 ; i<8 ; i++)
          for (j=0 ; j<1024; j++)
             fCellOffset2[i][j]   = buf[(i*1024+j)*2];
       
    } else if (fBoardType == 5 || fBoardType == 7 || fBoardType == 8) {
       memset(buf, 0, sizeof(buf));
-      ReadEEPROM(0, buf, 32);
+      ReadPage(0, buf, 32);
 
       /* check voltage calibration method */
       if ((buf[2] & 0xFF) == VCALIB_METHOD_V4) // board < 9 has "1", board 9 has "2"
          fVoltageCalibrationValid = true;
       else {
          fCellCalibratedRange = 0;
-         return;
+         return ok;
       }
       fCellCalibratedTemperature = -100;
 
@@ -904,14 +1253,14 @@ void DRSBoard::ReadCalibration(void)
          fTimingCalibratedFrequency = -1;
 
       fCellCalibratedRange = ((int) (buf[2] >> 8)) / 100.0; // -50 ... +50 => -0.5 V ... +0.5 V
-      ReadEEPROM(1, buf, 1024*32);
+      ReadPage(1, buf, 1024*32);
       for (i=0 ; i<8 ; i++)
          for (j=0 ; j<1024; j++) {
             fCellOffset[i][j] = buf[(i*1024+j)*2];
             fCellGain[i][j]   = buf[(i*1024+j)*2 + 1]/65535.0*0.4+0.7;
          }
 
-      ReadEEPROM(2, buf, 1024*5*4);
+      ReadPage(2, buf, 1024*5*4);
       for (i=0 ; i<1 ; i++)
          for (j=0 ; j<1024; j++) {
             fCellOffset[i+8][j] = buf[(i*1024+j)*2];
@@ -925,14 +1274,14 @@ void DRSBoard::ReadCalibration(void)
          }
 
    } else if (fBoardType == 6) {
-      ReadEEPROM(0, buf, 16);
+      ReadPage(0, buf, 16);
 
       /* check voltage calibration method */
       if ((buf[2] & 0xFF) == VCALIB_METHOD)
          fVoltageCalibrationValid = true;
       else {
          fCellCalibratedRange = 0;
-         return;
+         return ok;
       }
 
       /* check timing calibration method */
@@ -944,7 +1293,7 @@ void DRSBoard::ReadCalibration(void)
       fCellCalibratedRange = ((int) (buf[2] >> 8)) / 100.0; // -50 ... +50 => -0.5 V ... +0.5 V
 
       for (chip=0 ; chip<4 ; chip++) {
-         ReadEEPROM(1+chip, buf, 1024*32);
+         ReadPage(1+chip, buf, 1024*32);
          for (i=0 ; i<8 ; i++)
             for (j=0 ; j<1024; j++) {
                fCellOffset[i+chip*9][j] = buf[(i*1024+j)*2];
@@ -952,14 +1301,14 @@ void DRSBoard::ReadCalibration(void)
             }
       }
 
-      ReadEEPROM(5, buf, 1024*4*4);
+      ReadPage(5, buf, 1024*4*4);
       for (chip=0 ; chip<4 ; chip++)
          for (j=0 ; j<1024; j++) {
             fCellOffset[8+chip*9][j] = buf[j*2+chip*0x0800];
             fCellGain[8+chip*9][j]   = buf[j*2+1+chip*0x0800]/65535.0*0.4+0.7;
          }
 
-      ReadEEPROM(7, buf, 1024*32);
+      ReadPage(7, buf, 1024*32);
       for (i=0 ; i<8 ; i++) {
          for (j=0 ; j<1024; j++) {
             fCellOffset2[i][j]   = buf[i*0x800 + j*2];
@@ -967,7 +1316,7 @@ void DRSBoard::ReadCalibration(void)
          }
       }
 
-      ReadEEPROM(8, buf, 1024*32);
+      ReadPage(8, buf, 1024*32);
       for (i=0 ; i<8 ; i++) {
          for (j=0 ; j<1024; j++) {
             fCellOffset2[i+18][j] = buf[i*0x800 + j*2];
@@ -976,7 +1325,7 @@ void DRSBoard::ReadCalibration(void)
       }
 
    } else
-      return;
+      return true;
 
    /* read timing calibration from eeprom */
    if (fBoardType == 9) {
@@ -986,7 +1335,7 @@ void DRSBoard::ReadCalibration(void)
                fCellDT[0][i][j] = 1/fNominalFrequency;
             }
       } else {
-         ReadEEPROM(2, buf, 1024*32);
+         ReadPage(2, buf, 1024*32);
          for (i=0 ; i<8 ; i++)
             for (j=0 ; j<1024; j++) {
                fCellDT[0][i][j]   = (buf[(i*1024+j)*2+1] - 1000) / 10000.0;
@@ -997,7 +1346,7 @@ void DRSBoard::ReadCalibration(void)
          for (i=0 ; i<1024 ; i++)
             fCellDT[0][0][i] = 1/fNominalFrequency;
       } else {
-         ReadEEPROM(0, buf, 1024*sizeof(short)*2);
+         ReadPage(0, buf, 1024*sizeof(short)*2);
          for (i=0 ; i<8 ; i++) {
             for (j=0 ; j<1024; j++) {
                // use calibration for all channels
@@ -1011,7 +1360,7 @@ void DRSBoard::ReadCalibration(void)
             for (j=0 ; j<4 ; j++)
                fCellDT[0][j][i] = 1/fNominalFrequency;
       } else {
-         ReadEEPROM(6, buf, 1024*sizeof(short)*4);
+         ReadPage(6, buf, 1024*sizeof(short)*4);
          for (i=0 ; i<1024; i++) {
             fCellDT[0][0][i] = buf[i*2]/10000.0;
             fCellDT[1][0][i] = buf[i*2+1]/10000.0;
@@ -1057,7 +1406,8 @@ void DRSBoard::ReadCalibration(void)
    fTimingCalibratedFrequency = buf[6] / 1000.0;
    WriteEEPROM(0, buf, sizeof(buf));
 #endif
-   
+
+   return ok;
 }
 
 /*------------------------------------------------------------------*/
@@ -1105,12 +1455,14 @@ int DRSBoard::InitFPGA(void)
 
 int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
 {
+#ifdef HAVE_USB
+   /* offline board */
+   if ((fTransport == TR_USB || fTransport == TR_USB2) && fUsbInterface == NULL)
+      return -1;
+#endif
+
 #ifdef USE_DRS_MUTEX
-   if (!s_drsMutex) {
-      s_drsMutex = new wxMutex();
-      assert(s_drsMutex);
-   }
-   s_drsMutex->Lock();
+   std::lock_guard<std::mutex> lock(*fBusMutex);
 #endif
 
    if (fTransport == TR_VME) {
@@ -1144,9 +1496,6 @@ int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
          mvme_write(fVmeInterface, base_addr + addr, static_cast < mvme_locaddr_t * >(data), size);
       }
 
-#ifdef USE_DRS_MUTEX
-      s_drsMutex->Unlock();
-#endif
       return size;
 #endif                          // HAVE_VME
 
@@ -1200,9 +1549,6 @@ int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
             }
 
             if (ack == 1) {
-#ifdef USE_DRS_MUTEX
-               s_drsMutex->Unlock();
-#endif
                return size;
             }
 
@@ -1239,9 +1585,6 @@ int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
             }
          }
 
-#ifdef USE_DRS_MUTEX
-         s_drsMutex->Unlock();
-#endif
          return size;
       }
 #endif                          // HAVE_USB
@@ -1250,9 +1593,9 @@ int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
       unsigned int base_addr;
       int i;
 
-      if (usb2_buffer == NULL)
-         usb2_buffer = (unsigned char *) malloc(USB2_BUFFER_SIZE);
-      assert(usb2_buffer);
+      if (fUsb2Buffer == NULL)
+         fUsb2Buffer = (unsigned char *) malloc(USB2_BUFFER_SIZE);
+      assert(fUsb2Buffer);
 
       /* only accept even address and number of bytes */
       assert(addr % 2 == 0);
@@ -1282,36 +1625,30 @@ int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
 
       addr += base_addr;
 
-      usb2_buffer[0] = USB2_CMD_WRITE;
-      usb2_buffer[1] = 0;
+      fUsb2Buffer[0] = USB2_CMD_WRITE;
+      fUsb2Buffer[1] = 0;
 
-      usb2_buffer[2] = (addr >> 0) & 0xFF;
-      usb2_buffer[3] = (addr >> 8) & 0xFF;
-      usb2_buffer[4] = (addr >> 16) & 0xFF;
-      usb2_buffer[5] = (addr >> 24) & 0xFF;
+      fUsb2Buffer[2] = (addr >> 0) & 0xFF;
+      fUsb2Buffer[3] = (addr >> 8) & 0xFF;
+      fUsb2Buffer[4] = (addr >> 16) & 0xFF;
+      fUsb2Buffer[5] = (addr >> 24) & 0xFF;
 
-      usb2_buffer[6] = (size >> 0) & 0xFF;
-      usb2_buffer[7] = (size >> 8) & 0xFF;
-      usb2_buffer[8] = (size >> 16) & 0xFF;
-      usb2_buffer[9] = (size >> 24) & 0xFF;
+      fUsb2Buffer[6] = (size >> 0) & 0xFF;
+      fUsb2Buffer[7] = (size >> 8) & 0xFF;
+      fUsb2Buffer[8] = (size >> 16) & 0xFF;
+      fUsb2Buffer[9] = (size >> 24) & 0xFF;
 
       for (i = 0; i < size; i++)
-         usb2_buffer[10 + i] = *((unsigned char *) data + i);
+         fUsb2Buffer[10 + i] = *((unsigned char *) data + i);
 
-      i = musb_write(fUsbInterface, 4, usb2_buffer, 10 + size, USB_TIMEOUT);
+      i = musb_write(fUsbInterface, 4, fUsb2Buffer, 10 + size, USB_TIMEOUT);
       if (i != 10 + size)
          printf("musb_write error: %d\n", i);
 
-#ifdef USE_DRS_MUTEX
-      s_drsMutex->Unlock();
-#endif
       return i;
 #endif                          // HAVE_USB
    }
 
-#ifdef USE_DRS_MUTEX
-   s_drsMutex->Unlock();
-#endif
    return 0;
 }
 
@@ -1321,12 +1658,16 @@ int DRSBoard::Write(int type, unsigned int addr, void *data, int size)
 
 int DRSBoard::Read(int type, void *data, unsigned int addr, int size)
 {
-#ifdef USE_DRS_MUTEX
-   if (!s_drsMutex) {
-      s_drsMutex = new wxMutex();
-      assert(s_drsMutex);
+#ifdef HAVE_USB
+   /* offline board */
+   if ((fTransport == TR_USB || fTransport == TR_USB2) && fUsbInterface == NULL) {
+      memset(data, 0, size);
+      return -1;
    }
-   s_drsMutex->Lock();
+#endif
+
+#ifdef USE_DRS_MUTEX
+   std::lock_guard<std::mutex> lock(*fBusMutex);
 #endif
 
    memset(data, 0, size);
@@ -1381,9 +1722,6 @@ int DRSBoard::Read(int type, void *data, unsigned int addr, int size)
          //   mvme_read(fVmeInterface, (mvme_locaddr_t *)((char *)data+i), base_addr + addr+i, 4);
       }
 
-#ifdef USE_DRS_MUTEX
-      s_drsMutex->Unlock();
-#endif
 
       return n;
 
@@ -1422,9 +1760,6 @@ int DRSBoard::Read(int type, void *data, unsigned int addr, int size)
          musb_write(fUsbInterface, 2, buffer, 2 + size, USB_TIMEOUT);
          i = musb_read(fUsbInterface, 1, data, size, USB_TIMEOUT);
 
-#ifdef USE_DRS_MUTEX
-         s_drsMutex->Unlock();
-#endif
          if (i != size)
             return 0;
 
@@ -1453,9 +1788,6 @@ int DRSBoard::Read(int type, void *data, unsigned int addr, int size)
                /* try again */
                ret = musb_read(fUsbInterface, 1, buffer, n, USB_TIMEOUT);
                if (ret != n) {
-#ifdef USE_DRS_MUTEX
-                  s_drsMutex->Unlock();
-#endif
                   return 0;
                }
             }
@@ -1464,9 +1796,6 @@ int DRSBoard::Read(int type, void *data, unsigned int addr, int size)
                *((unsigned char *) data + j + i * 60) = buffer[j];
          }
 
-#ifdef USE_DRS_MUTEX
-         s_drsMutex->Unlock();
-#endif
          return size;
       }
 #endif                          // HAVE_USB
@@ -1522,16 +1851,10 @@ int DRSBoard::Read(int type, void *data, unsigned int addr, int size)
          printf("musb_read error %d\n", i);
 
       i = musb_read(fUsbInterface, 8, data, size, USB_TIMEOUT);
-#ifdef USE_DRS_MUTEX
-      s_drsMutex->Unlock();
-#endif
       return i;
 #endif                          // HAVE_USB
    }
 
-#ifdef USE_DRS_MUTEX
-   s_drsMutex->Unlock();
-#endif
    return 0;
 }
 
@@ -3717,6 +4040,16 @@ int DRSBoard::CalibrateWaveform(unsigned int chipIndex, unsigned char channel, u
    int j, n_bins, skip;
    double value;
    short left, right;
+   const float *userPedestal;
+   bool userByCell;
+
+   // user pedestal is keyed by the channel as requested by the caller
+   userPedestal = NULL;
+   userByCell = false;
+   if (chipIndex < kNumberOfChipsMax && channel < 9 && fUserPedestalMode[channel+chipIndex*9] != kUserPedestalNone) {
+      userPedestal = fUserPedestal[channel+chipIndex*9];
+      userByCell = fUserPedestalMode[channel+chipIndex*9] == kUserPedestalByCell;
+   }
 
    // calibrate waveform
    if (responseCalib && fVoltageCalibrationValid) {
@@ -3749,6 +4082,10 @@ int DRSBoard::CalibrateWaveform(unsigned int chipIndex, unsigned char channel, u
                   value = (fRange * 1000 - 500) * 10;
             }
 
+            /* user pedestal, in the same pass */
+            if (userPedestal)
+               value -= userPedestal[userByCell ? (j*skip + triggerCell) % kNumberOfBins : j];
+
             if (adjustToClock)          
                waveform[(j + triggerCell) % kNumberOfBins] = (short) (value + 0.5);
             else
@@ -3792,6 +4129,10 @@ int DRSBoard::CalibrateWaveform(unsigned int chipIndex, unsigned char channel, u
             /* correct for range */
             value += fRange * 1000 * 10;
 
+            /* user pedestal, also without voltage calibration */
+            if (userPedestal)
+               value -= userPedestal[userByCell ? (j + triggerCell) % kNumberOfBins : j];
+
             if (adjustToClock)          
                waveform[(j + triggerCell) % kNumberOfBins] = (short) (value + 0.5);
             else
@@ -3827,6 +4168,60 @@ int DRSBoard::CalibrateWaveform(unsigned int chipIndex, unsigned char channel, u
 
 /*------------------------------------------------------------------*/
 
+int DRSBoard::SetUserPedestal(unsigned int chipIndex, unsigned char channel, const float *pedestal, int mode)
+{
+   /* pedestal in mV, subtracted from DRS4 waveforms inside
+      CalibrateWaveform with or without voltage calibration; mode kUserPedestalByCell indexes it by physical
+      cell, kUserPedestalBySample by sample after the trigger cell as
+      delivered with adjustToClock == false. NULL or kUserPedestalNone
+      removes it */
+   int i;
+
+   if (chipIndex >= kNumberOfChipsMax || channel >= 9)
+      return kWrongChannelOrChip;
+
+   if (pedestal == NULL || mode == kUserPedestalNone) {
+      fUserPedestalMode[channel+chipIndex*9] = kUserPedestalNone;
+      return kSuccess;
+   }
+
+   if (mode != kUserPedestalByCell && mode != kUserPedestalBySample)
+      return kWrongChannelOrChip;
+
+   /* store in units of 0.1 mV like CalibrateWaveform */
+   for (i = 0; i < kNumberOfBins; i++)
+      fUserPedestal[channel+chipIndex*9][i] = pedestal[i] * 10;
+   fUserPedestalMode[channel+chipIndex*9] = (unsigned char) mode;
+
+   return kSuccess;
+}
+
+/*------------------------------------------------------------------*/
+
+int DRSBoard::SetUserPedestal(unsigned int chipIndex, unsigned char channel, const double *pedestal, int mode)
+{
+   float p[kNumberOfBins];
+   int i;
+
+   if (pedestal == NULL)
+      return SetUserPedestal(chipIndex, channel, (const float *) NULL, mode);
+
+   for (i = 0; i < kNumberOfBins; i++)
+      p[i] = (float) pedestal[i];
+   return SetUserPedestal(chipIndex, channel, p, mode);
+}
+
+/*------------------------------------------------------------------*/
+
+int DRSBoard::GetUserPedestalMode(unsigned int chipIndex, unsigned char channel) const
+{
+   if (chipIndex >= kNumberOfChipsMax || channel >= 9)
+      return kUserPedestalNone;
+   return fUserPedestalMode[channel+chipIndex*9];
+}
+
+/*------------------------------------------------------------------*/
+
 int DRSBoard::GetStretchedTime(float *time, float *measurement, int numberOfMeasurements, float period)
 {
    int j;
@@ -4351,6 +4746,35 @@ double DRSBoard::GetTemperature()
 
 /*------------------------------------------------------------------*/
 
+bool DRSBoard::GetVoltageCalibration(DRSVoltageCalibration *c) const
+{
+   if (!fVoltageCalibrationValid)
+      return false;
+
+   c->temperature = fCellCalibratedTemperature;
+   c->range = fCellCalibratedRange;
+   memcpy(c->offset, fCellOffset, sizeof(c->offset));
+   memcpy(c->offset2, fCellOffset2, sizeof(c->offset2));
+   memcpy(c->gain, fCellGain, sizeof(c->gain));
+   return true;
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSBoard::SetVoltageCalibration(const DRSVoltageCalibration *c)
+{
+   /* not synchronized with CalibrateWaveform(), so call this between
+      events from the thread decoding the waveforms */
+   memcpy(fCellOffset, c->offset, sizeof(fCellOffset));
+   memcpy(fCellOffset2, c->offset2, sizeof(fCellOffset2));
+   memcpy(fCellGain, c->gain, sizeof(fCellGain));
+   fCellCalibratedTemperature = c->temperature;
+   fCellCalibratedRange = c->range;
+   fVoltageCalibrationValid = true;
+}
+
+/*------------------------------------------------------------------*/
+
 int DRSBoard::Is2048ModeCapable()
 {
    unsigned int status;
@@ -4498,15 +4922,27 @@ int DRSBoard::ReadEEPROM(unsigned short page, void *buffer, int size)
 
 int DRSBoard::WriteEEPROM(unsigned short page, void *buffer, int size)
 {
-   int i;
+   int i, header, generation;
    unsigned long status;
    unsigned char buf[32768];
 
+   // cached calibration tables are no longer valid
+   DRSCalibCache::Remove(fBoardSerialNumber);
+
    // read previous page
    ReadEEPROM(page, buf, sizeof(buf));
    
    // combine with new page
    memcpy(buf, buffer, size);
+
+   // count the calibration generation up, see ReadCalibration()
+   header = drs_calib_header(fBoardType, &generation);
+   if (page == 0 && header > 0 && size >= (generation + 1) * 2) {
+      unsigned short g;
+      memcpy(&g, buf + generation * 2, 2);
+      g++;
+      memcpy(buf + generation * 2, &g, 2);
+   }
    
    // write eeprom page number
    if (fBoardType == 5 || fBoardType == 7 || fBoardType == 8 || fBoardType == 9)
@@ -4532,6 +4968,15 @@ int DRSBoard::WriteEEPROM(unsigned short page, void *buffer, int size)
       Sleep(10);
    }
 
+   // any other page changes the generation in page 0
+   if (page != 0 && header > 0) {
+      if (ReadEEPROM(0, buf, header) != header) {
+         printf("Cannot update calibration generation in EEPROM page 0 of board #%d\n", fBoardSerialNumber);
+         return 1;
+      }
+      WriteEEPROM(0, buf, header);
+   }
+
    return 1;
 }
 
@@ -4808,44 +5253,190 @@ void DRSBoard::ReadSingleWaveform(int nChip, int nChan,
       for (j=0 ; j<nChan ; j++) {
          GetRawWave(i, j, wf[i][j], rotated);
          if (!rotated) {
-            for (k=0 ; k<kNumberOfBins ; k++) {
-               /* do primary offset calibration */
-               wf[i][j][k] = wf[i][j][k] - fCellOffset[j+i*9][(k + tc) % kNumberOfBins] + 32768;
-            }
+            /* do primary offset calibration, split at the wrap around
+               of the cell index so that both loops vectorize */
+            unsigned short *w = wf[i][j];
+            const unsigned short *ofs = fCellOffset[j+i*9];
+            for (k=0 ; k<kNumberOfBins-tc ; k++)
+               w[k] = w[k] - ofs[k + tc] + 32768;
+            for ( ; k<kNumberOfBins ; k++)
+               w[k] = w[k] - ofs[k + tc - kNumberOfBins] + 32768;
          }
       }
    }
 }
-      
-static unsigned short swf[kNumberOfChipsMax][kNumberOfChannelsMax][kNumberOfBins];
-static float          center[kNumberOfChipsMax][kNumberOfChannelsMax][kNumberOfBins];
+
+/*------------------------------------------------------------------*/
+
+typedef unsigned short DRSSingleWaveform[kNumberOfChipsMax][kNumberOfChannelsMax][kNumberOfBins];
+
+/* Reads n events with ReadSingleWaveform() one event ahead of the
+   caller: a reader thread fills one of two buffers while the caller
+   works on the other one. Without USE_DRS_MUTEX events are read in
+   Next(). All buffers belong to the pipeline, so several boards can be
+   calibrated at the same time. */
+class WaveformPipeline {
+protected:
+   DRSBoard          *fBoard;
+   int                fNChip;
+   int                fNChan;
+   int                fN;
+   bool               fRotated;
+   DRSSingleWaveform *fBuffer;
+   int                fRead;          // events filled by the reader
+   int                fConsumed;      // events released by the caller
+#ifdef USE_DRS_MUTEX
+   bool                    fAbort;
+   std::mutex              fMutex;
+   std::condition_variable fCond;
+   std::thread             fThread;
+
+   void Reader();
+#endif
+
+public:
+   WaveformPipeline(DRSBoard *board, int nChip, int nChan, int n, bool rotated);
+   ~WaveformPipeline();
+
+   DRSSingleWaveform &Next();
+   void               Release();
+};
+
+/*------------------------------------------------------------------*/
+
+WaveformPipeline::WaveformPipeline(DRSBoard *board, int nChip, int nChan, int n, bool rotated)
+:  fBoard(board)
+    , fNChip(nChip)
+    , fNChan(nChan)
+    , fN(n)
+    , fRotated(rotated)
+    , fRead(0)
+    , fConsumed(0)
+#ifdef USE_DRS_MUTEX
+    , fAbort(false)
+#endif
+{
+   fBuffer = new DRSSingleWaveform[2];
+#ifdef USE_DRS_MUTEX
+   fThread = std::thread(&WaveformPipeline::Reader, this);
+#endif
+}
+
+/*------------------------------------------------------------------*/
+
+WaveformPipeline::~WaveformPipeline()
+{
+#ifdef USE_DRS_MUTEX
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fAbort = true;
+   }
+   fCond.notify_all();
+   fThread.join();
+#endif
+   delete[] fBuffer;
+}
+
+/*------------------------------------------------------------------*/
+
+#ifdef USE_DRS_MUTEX
+void WaveformPipeline::Reader()
+{
+   for (int i=0 ; i<fN ; i++) {
+      {
+         /* wait until the buffer of event i-2 is released */
+         std::unique_lock<std::mutex> lock(fMutex);
+         fCond.wait(lock, [&] { return fAbort || i - fConsumed < 2; });
+         if (fAbort)
+            return;
+      }
+
+      fBoard->ReadSingleWaveform(fNChip, fNChan, fBuffer[i % 2], fRotated);
+
+      {
+         std::lock_guard<std::mutex> lock(fMutex);
+         fRead = i + 1;
+      }
+      fCond.notify_all();
+   }
+}
+#endif
+
+/*------------------------------------------------------------------*/
+
+DRSSingleWaveform &WaveformPipeline::Next()
+{
+#ifdef USE_DRS_MUTEX
+   std::unique_lock<std::mutex> lock(fMutex);
+   fCond.wait(lock, [&] { return fRead > fConsumed; });
+#else
+   fBoard->ReadSingleWaveform(fNChip, fNChan, fBuffer[fConsumed % 2], fRotated);
+   fRead = fConsumed + 1;
+#endif
+   return fBuffer[fConsumed % 2];
+}
+
+/*------------------------------------------------------------------*/
+
+void WaveformPipeline::Release()
+{
+#ifdef USE_DRS_MUTEX
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fConsumed++;
+   }
+   fCond.notify_all();
+#else
+   fConsumed++;
+#endif
+}
+
+/*------------------------------------------------------------------*/
+
+static inline unsigned int drs_accumulate(const unsigned short * __restrict wf, unsigned int * __restrict sum)
+{
+   /* add one waveform to the sums and return the sum over its bins,
+      integer only so that the compiler vectorizes the loop */
+   unsigned int s = 0;
+
+   for (int l=0 ; l<kNumberOfBins ; l++) {
+      s += wf[l];
+      sum[l] += wf[l];
+   }
+   return s;
+}
+
+/*------------------------------------------------------------------*/
 
 int DRSBoard::AverageWaveforms(DRSCallback *pcb, int nChip, int nChan, 
                                int prog1, int prog2, unsigned short *awf, int n, bool rotated)
 {
-   int i, j, k, l, prog, old_prog = 0;
-   float cm;
+   int i, j, k, prog, old_prog = 0;
+   unsigned int *sum;
+   double *cm;
 
    if (pcb != NULL)
       pcb->Progress(prog1);
 
-   memset(center, 0, sizeof(center));
+   /* sum of the samples per cell and of the common mode per channel,
+      the common mode subtracted average is (sum - cm)/(n-6) */
+   sum = new unsigned int[nChip*nChan*kNumberOfBins];
+   cm  = new double[nChip*nChan];
+   memset(sum, 0, sizeof(unsigned int)*nChip*nChan*kNumberOfBins);
+   memset(cm, 0, sizeof(double)*nChip*nChan);
+
+   WaveformPipeline pipe(this, nChip, nChan, n, rotated);
 
    for (i=0 ; i<n; i++) {
-      ReadSingleWaveform(nChip, nChan, swf, rotated);
-
-      for (j=0 ; j<nChip ; j++) {
-         for (k=0 ; k<nChan ; k++) {
-            if (i > 5) {
-               /* calculate and subtract common mode */
-               for (l=0,cm=0 ; l<kNumberOfBins ; l++)
-                  cm += swf[j][k][l] - 32768;
-               cm /= kNumberOfBins;
-               for (l=0 ; l<kNumberOfBins ; l++)
-                  center[j][k][l] += swf[j][k][l]- cm;
-            }
-         }
+      DRSSingleWaveform &swf = pipe.Next();
+
+      if (i > 5) {
+         for (j=0 ; j<nChip ; j++)
+            for (k=0 ; k<nChan ; k++)
+               cm[j*nChan+k] += (double) drs_accumulate(swf[j][k], sum + (j*nChan+k)*kNumberOfBins) / kNumberOfBins
+                                - 32768;
       }
+      pipe.Release();
 
       prog = (int)(((double)i/n)*(prog2-prog1)+prog1);
       if (prog > old_prog) {
@@ -4858,7 +5449,10 @@ int DRSBoard::AverageWaveforms(DRSCallback *pcb, int nChip, int nChan,
    for (i=0 ; i<nChip ; i++)
       for (j=0 ; j<nChan ; j++)
          for (k=0 ; k<kNumberOfBins ; k++)
-            awf[(i*nChan+j)*kNumberOfBins+k] = (unsigned short)(center[i][j][k]/(n-6) + 0.5);
+            awf[(i*nChan+j)*kNumberOfBins+k] = (unsigned short)((sum[(i*nChan+j)*kNumberOfBins+k] - cm[i*nChan+j])/(n-6) + 0.5);
+
+   delete[] sum;
+   delete[] cm;
    
    return 1;
 }
@@ -4871,15 +5465,18 @@ int DRSBoard::RobustAverageWaveforms(DRSCallback *pcb, int nChip, int nChan,
    if (pcb != NULL)
       pcb->Progress(prog1);
 
-   Averager *ave = new Averager(nChip, nChan, kNumberOfBins, 200);
+   /* 128 bins of 2 counts around the median, robust average uses +-100 counts */
+   Averager *ave = new Averager(nChip, nChan, kNumberOfBins, 128, 2.0f);
                                 
-   /* fill histograms */
+   /* fill histograms while the next event is read */
+   WaveformPipeline pipe(this, nChip, nChan, n, rotated);
    for (i=0 ; i<n ; i++) {
-      ReadSingleWaveform(nChip, nChan, swf, rotated);
+      DRSSingleWaveform &swf = pipe.Next();
       for (j=0 ; j<nChip ; j++)
          for (k=0 ; k<nChan ; k++)
             for (l=0 ; l<kNumberOfBins ; l++)
                ave->Add(j, k, l, swf[j][k][l]);
+      pipe.Release();
                
       /* update progress bar */
       prog = (int)(((double)(i+10)/(n+10))*(prog2-prog1)+prog1);
@@ -4939,17 +5536,21 @@ int idx[4][10] = {
 #define F1(x) ((int) (84.0/24 * (x)))
 #define F2(x) ((int) (92.0/8 * (x)))
 
-static unsigned short wft[kNumberOfChipsMax*kNumberOfChannelsMax*kNumberOfChipsMax][1024], 
-                      wf1[kNumberOfChipsMax*kNumberOfChannelsMax*kNumberOfChipsMax][1024], 
-                      wf2[kNumberOfChipsMax*kNumberOfChannelsMax*kNumberOfChipsMax][1024],
-                      wf3[kNumberOfChipsMax*kNumberOfChannelsMax*kNumberOfChipsMax][1024];
+#define N_CALIB_WF (kNumberOfChipsMax*kNumberOfChannelsMax*kNumberOfChipsMax)
 
 int DRSBoard::CalibrateVolt(DRSCallback *pcb)
 {
 int    i, j, nChan, timingChan, chip, config, p, clkon, refclk, trg1, trg2, n_stuck, readchn, casc;
 double f, r;
 unsigned short buf[1024*16]; // 32 kB
+unsigned short (*wft)[1024], (*wf1)[1024], (*wf2)[1024], (*wf3)[1024];
    
+   /* per call, so that boards can be calibrated concurrently */
+   wft = new unsigned short[4*N_CALIB_WF][1024];
+   wf1 = wft + N_CALIB_WF;
+   wf2 = wft + 2*N_CALIB_WF;
+   wf3 = wft + 3*N_CALIB_WF;
+
    f       = fNominalFrequency;
    r       = fRange;
    clkon   = (GetCtrlReg() & BIT_TCAL_EN) > 0;
@@ -5016,9 +5617,9 @@ unsigned short buf[1024*16]; // 32 kB
       if (fTransport == TR_USB2) {
          nChan = 36;
          timingChan = 8;
-         memset(wf1, 0, sizeof(wf1));
-         memset(wf2, 0, sizeof(wf2));
-         memset(wf3, 0, sizeof(wf3));
+         memset(wf1, 0, sizeof(wf1[0])*N_CALIB_WF);
+         memset(wf2, 0, sizeof(wf2[0])*N_CALIB_WF);
+         memset(wf3, 0, sizeof(wf3[0])*N_CALIB_WF);
          for (config=p=0 ; config<4 ; config++) {
             SetChannelConfig(config, 8, 8);
 
@@ -5293,6 +5894,8 @@ unsigned short buf[1024*16]; // 32 kB
    EnableTcal(clkon, 0);
    EnableTrigger(trg1, trg2);
 
+   delete[] wft;
+
    return 1;
 }
 
@@ -5500,6 +6103,141 @@ double damping, zeroLevel, tPeriod, corr, dv, dv_limit, corr_limit;
 
 /*------------------------------------------------------------------*/
 
+#ifdef USE_DRS_MUTEX
+/* Worker pool for the timing calibration of the evaluation board V5:
+   one thread per calibrated channel runs AnalyzeSlope/AnalyzePeriod on
+   an event while the caller acquires the next one. Each channel only
+   touches its own cellDV, cellDT and Averager cells and sees the events
+   in order, so the result does not depend on the thread scheduling. */
+class TimingAnalysisPool {
+public:
+   enum {
+      kChannels = 4     // CH1..CH4 = DRS channels 0, 2, 4, 6
+   };
+
+protected:
+   DRSBoard               *fBoard;
+   Averager               *fAve;
+   int                     fNIterSlope;
+   int                     fNIterPeriod;
+   double                 *fCellDV[kChannels];
+   double                 *fCellDT[kChannels];
+
+   float                   fWf[kChannels][kNumberOfBins];
+   int                     fTCell;
+   int                     fIndex;
+   int                     fStatus[kChannels];
+   int                     fGeneration;
+   int                     fDone;
+   bool                    fQuit;
+   std::mutex              fMutex;
+   std::condition_variable fCond;
+   std::thread             fThread[kChannels];
+
+   void Worker(int k);
+
+public:
+   TimingAnalysisPool(DRSBoard *board, Averager *ave, int nIterSlope, int nIterPeriod,
+                      double *cellDV[kChannels], double *cellDT[kChannels]);
+   ~TimingAnalysisPool();
+
+   void Submit(int index, float wf[kChannels][kNumberOfBins], int tCell);
+   void Wait(int status[kChannels]);
+};
+
+/*------------------------------------------------------------------*/
+
+TimingAnalysisPool::TimingAnalysisPool(DRSBoard *board, Averager *ave, int nIterSlope, int nIterPeriod,
+                                       double *cellDV[kChannels], double *cellDT[kChannels])
+:  fBoard(board)
+    , fAve(ave)
+    , fNIterSlope(nIterSlope)
+    , fNIterPeriod(nIterPeriod)
+    , fTCell(0)
+    , fIndex(0)
+    , fGeneration(0)
+    , fDone(kChannels)
+    , fQuit(false)
+{
+   for (int k=0 ; k<kChannels ; k++) {
+      fCellDV[k] = cellDV[k];
+      fCellDT[k] = cellDT[k];
+      fStatus[k] = 1;
+   }
+   for (int k=0 ; k<kChannels ; k++)
+      fThread[k] = std::thread(&TimingAnalysisPool::Worker, this, k);
+}
+
+/*------------------------------------------------------------------*/
+
+TimingAnalysisPool::~TimingAnalysisPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fQuit = true;
+   }
+   fCond.notify_all();
+   for (int k=0 ; k<kChannels ; k++)
+      fThread[k].join();
+}
+
+/*------------------------------------------------------------------*/
+
+void TimingAnalysisPool::Worker(int k)
+{
+   int seen = 0, status;
+
+   for (;;) {
+      {
+         std::unique_lock<std::mutex> lock(fMutex);
+         fCond.wait(lock, [&] { return fQuit || fGeneration > seen; });
+         if (fQuit)
+            return;
+         seen = fGeneration;
+      }
+
+      /* the event buffer is not touched by Submit() before all workers are done */
+      if (fIndex < fNIterSlope)
+         status = fBoard->AnalyzeSlope(fAve, fIndex, fNIterSlope, 2*k, fWf[k], fTCell, fCellDV[k], fCellDT[k]);
+      else
+         status = fBoard->AnalyzePeriod(fAve, fIndex, fNIterPeriod, 2*k, fWf[k], fTCell, fCellDV[k], fCellDT[k]);
+
+      {
+         std::lock_guard<std::mutex> lock(fMutex);
+         fStatus[k] = status;
+         fDone++;
+      }
+      fCond.notify_all();
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void TimingAnalysisPool::Submit(int index, float wf[kChannels][kNumberOfBins], int tCell)
+{
+   std::unique_lock<std::mutex> lock(fMutex);
+   fCond.wait(lock, [&] { return fDone == kChannels; });
+
+   memcpy(fWf, wf, sizeof(fWf));
+   fTCell = tCell;
+   fIndex = index;
+   fDone = 0;
+   fGeneration++;
+   lock.unlock();
+   fCond.notify_all();
+}
+
+/*------------------------------------------------------------------*/
+
+void TimingAnalysisPool::Wait(int status[kChannels])
+{
+   std::unique_lock<std::mutex> lock(fMutex);
+   fCond.wait(lock, [&] { return fDone == kChannels; });
+   memcpy(status, fStatus, sizeof(fStatus));
+}
+#endif
+
+/*------------------------------------------------------------------*/
 
 int DRSBoard::CalibrateTiming(DRSCallback *pcb)
 {
@@ -5508,6 +6246,11 @@ int DRSBoard::CalibrateTiming(DRSCallback *pcb)
    unsigned short buf[1024*16]; // 32 kB
    float  wf[1024];
    Averager *ave = NULL;
+#ifdef USE_DRS_MUTEX
+   TimingAnalysisPool *pool = NULL;
+   float  wfc[TimingAnalysisPool::kChannels][kNumberOfBins];
+   int    poolStatus[TimingAnalysisPool::kChannels];
+#endif
    
    nIterPeriod = 5000;
    nIterSlope  = 5000;
@@ -5543,12 +6286,12 @@ int DRSBoard::CalibrateTiming(DRSCallback *pcb)
       nIterPeriod = 1500;
       EnableTcal(1, 0, 0);
       SelectClockSource(1); // 2nd quartz
-      ave = new Averager(1, 1, 1024, 500); // one chip, 1 channel @ 1024 bins
+      ave = new Averager(1, 1, 1024, 128, 0.25f); // one chip, 1 channel @ 1024 bins, +-16 mV in 0.25 mV bins
    } else if (fBoardType == 9) {
       EnableTcal(1);
       nIterSlope  = 500;
       nIterPeriod = 500;
-      ave = new Averager(1, 9, 1024, 500); // one chip, 9 channels @ 1024 bins
+      ave = new Averager(1, 9, 1024, 128, 0.25f); // one chip, 9 channels @ 1024 bins, +-16 mV in 0.25 mV bins
    }
    StartDomino();
 
@@ -5560,6 +6303,17 @@ int DRSBoard::CalibrateTiming(DRSCallback *pcb)
          }
 
    error = 0;
+
+#ifdef USE_DRS_MUTEX
+   if (fBoardType == 9 && fTransport != TR_VME) {
+      double *dv[TimingAnalysisPool::kChannels], *dt[TimingAnalysisPool::kChannels];
+      for (c = 0 ; c < TimingAnalysisPool::kChannels ; c++) {
+         dv[c] = cellDV[2*c];
+         dt[c] = fCellDT[0][2*c];
+      }
+      pool = new TimingAnalysisPool(this, ave, nIterSlope, nIterPeriod, dv, dt);
+   }
+#endif
    
    for (index = 0 ; index < nIterSlope+nIterPeriod ; index++) {
       if (index % 10 == 0)
@@ -5615,6 +6369,37 @@ int DRSBoard::CalibrateTiming(DRSCallback *pcb)
                error = 1;
                break;
             }
+#ifdef USE_DRS_MUTEX
+         } else if (fBoardType == 9 && pool) { // DRS4 Evaluation board V5, analysis overlapped with acquisition
+            SoftTrigger();
+            while (IsBusy());
+            
+            StartDomino();
+            TransferWaves();
+            
+            tCell = GetStopCell(0);
+            for (channel = 0 ; channel < 8 ; channel+=2)
+               GetWave(0, channel, wfc[channel/2], true, tCell, 0, true);
+
+            // result of the previous event decides whether to go on, like in the serial loop below
+            if (index > 0) {
+               pool->Wait(poolStatus);
+               for (c = 0 ; c < 4 ; c++) {
+                  status = poolStatus[c];
+                  if (!status)
+                     n_error++;
+                  if (n_error > nIterPeriod / 2) {
+                     error = 1;
+                     break;
+                  }
+               }
+               if (!status)
+                  break;
+            }
+
+            pool->Submit(index, wfc, tCell);
+#endif
+
          } else if (fBoardType == 9) { // DRS4 Evaluation board V5: all channels from one chip
             SoftTrigger();
             while (IsBusy());
@@ -5676,6 +6461,24 @@ int DRSBoard::CalibrateTiming(DRSCallback *pcb)
       }
    }
 
+#ifdef USE_DRS_MUTEX
+   if (pool) {
+      /* last event, its result only counts for the error flag */
+      if (index == nIterSlope+nIterPeriod) {
+         pool->Wait(poolStatus);
+         for (c = 0 ; c < 4 ; c++) {
+            if (!poolStatus[c])
+               n_error++;
+            if (n_error > nIterPeriod / 2) {
+               error = 1;
+               break;
+            }
+         }
+      }
+      delete pool;
+   }
+#endif
+
    if (pcb)
       pcb->Progress(100);
    
@@ -5797,202 +6600,10 @@ void DRSBoard::RemoveSymmetricSpikes(short **wf, int nwf,
                                      short maxPeakToPeak, short spikeVoltage,
                                      int nTimeRegionThreshold)
 {
-   // Remove a specific kind of spike on DRS4.
-   // This spike has some features,
-   //  - Common on all the channels on a chip
-   //  - Constant heigh and width
-   //  - Two spikes per channel
-   //  - Symmetric to cell #0.
-   //
-   // This is not general purpose spike-removing function.
-   // 
-   // wf                   : Waveform data. cell#0 must be at bin0,
-   //                        and number of bins must be kNumberOfBins.
-   // nwf                  : Number of channels which "wf" holds.
-   // diffThreshold        : Amplitude threshold to find peak
-   // spikeWidth           : Width of spike
-   // maxPeakToPeak        : When peak-to-peak is larger than this, the channel
-   //                        is not used to find spikes.
-   // spikeVoltage         : Amplitude of spikes. When it is 0, it is calculated in this function
-   //                        from voltage difference from neighboring bins.
-   // nTimeRegionThreshold : Requirement of number of time regions having spike at common position.
-   //                        Total number of time regions is 2*"nwf".
-
-   if (!wf || !nwf || !diffThreshold || !spikeWidth) {
-      return;
-   }
-
-   int          ibin, jbin, kbin;
-   double       v;
-   int          nbin;
-   int          iwf;
-   short        maximum, minimum;
-   int          spikeCount[kNumberOfBins / 2];
-   int          spikeCountSum[kNumberOfBins / 2] = {0};
-   bool         largePulse[kNumberOfChannelsMax * 2] = {0};
-   const short  diffThreshold2 = diffThreshold + diffThreshold;
-
-   const short  maxShort = 0xFFFF>>1;
-   const short  minShort = -maxShort - 1;
-
-   // search spike
-   for (iwf = 0; iwf < nwf; iwf++) {
-      // first half
-      memset(spikeCount, 0, sizeof(spikeCount));
-      maximum = minShort;
-      minimum = maxShort;
-      for (ibin = 0; ibin < kNumberOfBins / 2; ibin++) {
-         jbin = ibin;
-         maximum = max(maximum, wf[iwf][jbin]);
-         minimum = min(minimum, wf[iwf][jbin]);
-         if (jbin - 1 >= 0 && jbin + spikeWidth < kNumberOfBins) {
-            v = 0;
-            nbin = 0;
-            for (kbin = 0; kbin < spikeWidth; kbin++) {
-               v += wf[iwf][jbin + kbin];
-               nbin++;
-            }
-            if ((nbin == 2 && v - (wf[iwf][jbin - 1] + wf[iwf][jbin + spikeWidth]) > diffThreshold2) ||
-                (nbin != 2 && nbin && v / nbin - (wf[iwf][jbin - 1] + wf[iwf][jbin + spikeWidth]) / 2 > diffThreshold)) {
-               spikeCount[ibin]++;
-            }
-         }
-      }
-      if (maximum != minShort && minimum != maxShort &&
-          (!maxPeakToPeak || maximum - minimum < maxPeakToPeak)) {
-         for (ibin = 0; ibin < kNumberOfBins / 2; ibin++) {
-            spikeCountSum[ibin] += spikeCount[ibin];
-         }
-         largePulse[iwf] = false;
-#if 0 /* this part can be enabled to skip checking other channels */
-         if (maximum != minShort && minimum != maxShort &&
-             maximum - minimum < diffThreshold) {
-            return;
-         }
-#endif
-      } else {
-         largePulse[iwf] = true;
-      }
-
-      // second half
-      memset(spikeCount, 0, sizeof(spikeCount));
-      maximum = minShort;
-      minimum = maxShort;
-      for (ibin = 0; ibin < kNumberOfBins / 2; ibin++) {
-         jbin = kNumberOfBins - 1 - ibin;
-         maximum = max(maximum, wf[iwf][jbin]);
-         minimum = min(minimum, wf[iwf][jbin]);
-         if (jbin + 1 < kNumberOfBins && jbin - spikeWidth >= 0) {
-            v = 0;
-            nbin = 0;
-            for (kbin = 0; kbin < spikeWidth; kbin++) {
-               v += wf[iwf][jbin - kbin];
-               nbin++;
-            }
-            if ((nbin == 2 && v - (wf[iwf][jbin + 1] + wf[iwf][jbin - spikeWidth]) > diffThreshold2) ||
-                (nbin != 2 && nbin && v / nbin - (wf[iwf][jbin + 1] + wf[iwf][jbin - spikeWidth]) / 2 > diffThreshold)) {
-               spikeCount[ibin]++;
-            }
-         }
-      }
-      if (maximum != minShort && minimum != maxShort &&
-          maximum - minimum < maxPeakToPeak) {
-         for (ibin = 0; ibin < kNumberOfBins / 2; ibin++) {
-            spikeCountSum[ibin] += spikeCount[ibin];
-         }
-         largePulse[iwf + nwf] = false;
-#if 0 /* this part can be enabled to skip checking other channels */
-         if (maximum != minShort && minimum != maxShort &&
-             maximum - minimum < diffThreshold) {
-            return;
-         }
-#endif
-      } else {
-         largePulse[iwf + nwf] = true;
-      }
-   }
-
-   // Find common spike
-   int commonSpikeBin = -1;
-   int commonSpikeMax = -1;
-   for (ibin = 0; ibin < kNumberOfBins / 2; ibin++) {
-      if (commonSpikeMax < spikeCountSum[ibin]) {
-         commonSpikeMax = spikeCountSum[ibin];
-         commonSpikeBin = ibin;
-      }
-   } 
-
-   if (spikeCountSum[commonSpikeBin] >= nTimeRegionThreshold) {
-      if (spikeVoltage == 0) {
-         // Estimate spike amplitude
-         double  baseline      = 0;
-         int    nBaseline      = 0;
-         double  peakAmplitude = 0;
-         int    nPeakAmplitude = 0;
-         for (iwf = 0; iwf < nwf; iwf++) {
-            // first half
-            if (!largePulse[iwf]) {
-               // baseline
-               if ((jbin = commonSpikeBin - 1) >= 0 && jbin < kNumberOfBins) {
-                  baseline += wf[iwf][jbin];
-                  nBaseline++;
-               }
-               if ((jbin = commonSpikeBin + spikeWidth + 1) >= 0 && jbin < kNumberOfBins) {
-                  baseline += wf[iwf][jbin];
-                  nBaseline++;
-               }
-               // spike
-               for (ibin = 0; ibin < spikeWidth; ibin++) {
-                  if ((jbin = commonSpikeBin + ibin) >= 0 && jbin < kNumberOfBins) {
-                     peakAmplitude += wf[iwf][jbin];
-                     nPeakAmplitude++;
-                  }
-               }
-            }
-
-            // second half
-            if (!largePulse[iwf + nwf]) {
-               // baseline
-               if ((jbin = kNumberOfBins - 1 - commonSpikeBin + 1) >= 0 && jbin < kNumberOfBins) {
-                  baseline += wf[iwf][jbin];
-                  nBaseline++;
-               }
-               if ((jbin = kNumberOfBins - 1 - commonSpikeBin - spikeWidth - 1) >= 0 && jbin < kNumberOfBins) {
-                  baseline += wf[iwf][jbin];
-                  nBaseline++;
-               }
-               // spike
-               for (ibin = 0; ibin < spikeWidth; ibin++) {
-                  if ((jbin = kNumberOfBins - 1 - commonSpikeBin - ibin) >= 0 && jbin < kNumberOfBins) {
-                     peakAmplitude += wf[iwf][jbin];
-                     nPeakAmplitude++;
-                  }
-               }
-            }
-         }
-         if (nBaseline && nPeakAmplitude) {
-            baseline /= nBaseline;
-            peakAmplitude /= nPeakAmplitude;
-            spikeVoltage = static_cast<short>(peakAmplitude - baseline);
-         } else {
-            spikeVoltage = 0;
-         }
-      }
-
-      // Remove spike
-      if (spikeVoltage > 0) {
-         for (iwf = 0; iwf < nwf; iwf++) {
-            for (ibin = 0; ibin < spikeWidth; ibin++) {
-               if ((jbin = commonSpikeBin + ibin) >= 0 && jbin < kNumberOfBins) {
-                  wf[iwf][jbin] -= spikeVoltage; 
-               }
-               if ((jbin = kNumberOfBins - 1 - commonSpikeBin - ibin) >= 0 && jbin < kNumberOfBins) {
-                  wf[iwf][jbin] -= spikeVoltage; 
-               }
-            }
-         }
-      }
-   }
+   // Remove the spikes common to all channels of a chip and symmetric
+   // to cell #0, see SpikeRemover::Remove()
+   SpikeRemover::Remove(wf, nwf, diffThreshold, spikeWidth, maxPeakToPeak, spikeVoltage,
+                        nTimeRegionThreshold);
 }
 
 /*------------------------------------------------------------------*/
@@ -1,6 +1,6 @@
 #include <DRS4v5_lib.h>
 
-int do_offset_caliberation(string ofile,string configfile)
+int do_offset_caliberation(string ofile,string configfile,int max_events)
 {
 	fstream ifile;
 	string l="";
@@ -37,96 +37,89 @@ int do_offset_caliberation(string ofile,string configfile)
 		fprintf(stderr,"all caliberations files not found !!%d /%d \n",int(ocalib_files.size()),NUMBER_OF_CHANNELS);
 	}
 	
-	vector<vector<double>> chanel_calib;
-	double* waveform;
-	waveform= new double [4*1024*2*EVENTS_IN_A_FRAME];
-	
-	cout<<"[4*1024*2*EVENTS_IN_A_FRAME]  = "<<4*1024*2*EVENTS_IN_A_FRAME<<"  "<<EVENTS_IN_A_FRAME<<endl;
-	int fstatus=0;
-	int start=0;
-	int wpos=0;
-	int eventCOUNT=0;
-	vector<double> calib;
-	for(int j=0;j<1024;j++)
-			calib.push_back(0.0);
-	for(unsigned int i=0;i<ocalib_files.size();i++)
+	// all events of all files, one thread per channel file
+	PedestalCalibration pedestal;
+	for(unsigned int i=0;i<ocalib_files.size() && i<PEDESTAL_CHANNELS;i++)
+		pedestal.SetFile(i,ocalib_files[i].c_str());
+	pedestal.SetMaxEvents(max_events);
+	if(pedestal.Run()<=0)
 	{
-		start=0;
-		eventCOUNT=0;
-		fstatus=0;
-
-		for(int j=0;j<1024;j++)
-			calib[j]=0.0;
-		for(int j=0;j<EVENTS_IN_A_FRAME;j++)
-			for(int k=0;k<1024*2;k++)
-				waveform[wpos]=-1;
-		cout<<"Starting "<<ocalib_files[i]<<"\n";
-		while(fstatus==0)
-		{	
-			if(start > 40) break;
-			cout<<"\t\t for event ids  "<<start<<" to "<<start+EVENTS_IN_A_FRAME-1<<"\n";
-			fstatus=get_events(ocalib_files[i].c_str(),waveform,start,start+EVENTS_IN_A_FRAME-1);
- 			for(int j=0;j<EVENTS_IN_A_FRAME;j++)
-			{	
-				wpos=j*(1024*2*4)+i*(1024*2);
-				/*for(int k=0;k<1024;k++)
-					cout<<" i "<<i<<" , j = "<<j<<" , k = "<<k<<" , wf = "<<waveform[wpos++]<<"->"<<waveform[wpos++]<<endl;	
-				continue;*/
-				if(waveform[wpos]==0 and waveform[wpos+1]==0 and waveform[wpos+2]==0 and waveform[wpos+3]==0)
-				{
-				//	cout<<"\n breaking the loop since -1\n";
-					fstatus=-1;
-					break;
-				}
-				double to=0;
-				for(int k=0;k<1024;k++)
-						{
-						//	cout<<" i "<<i<<" , j = "<<j<<" , k = "<<k<<" , wf = "<<waveform[wpos+1]<<endl;	
-							calib[k]+=waveform[wpos+1]; //i^th channel
-							waveform[wpos++]=0;
-							waveform[wpos++]=0;
-							to+=calib[k];
-						}
-				//cout<<"\n for event j = "<<j<<" calb = "<<to<<endl;
-				eventCOUNT+=1;
-			}
-			
-			start+=EVENTS_IN_A_FRAME;
-		}
-		cout<<ocalib_files[i]<<" done at "<<eventCOUNT<<endl;
-		for(int j=0;j<1024;j++)
-			calib[j]/=eventCOUNT;
-		chanel_calib.push_back(calib);
+		fprintf(stderr,"pedestal caliberation failed !!\n");
+		return 1;
 	}
-	for(unsigned int i=0;i<chanel_calib.size();i++)
-		{
-			cout<<"for  channnel  i = "<<i<<" \n\n";
-			for(int j=0;j<1024;j++)
-				cout<<chanel_calib[i][j]<<",";
-		cout<<"\n\n\n";
-		}
-	
-	fstream ofile_bin,ofile_txt;
-	ofile_bin.open("calib/toffset_calib.dat",ios::out | ios::binary);
-	ofile_txt.open("calib/toffset_calib.txt",ios::out );
-	
-	double val;
-	for(unsigned int i=0;i<chanel_calib.size();i++)
+	for(int i=0;i<PEDESTAL_CHANNELS;i++)
 	{
-		ofile_txt<<"ch id : "<<to_string(i)<<"\n";
-		ofile_bin.write((char *)(&i),sizeof(i));
-		for(int j=0;j<1024;j++)
-		{
-			ofile_txt<<j<<","<<chanel_calib[i][j]<<"\n";
-			val=chanel_calib[i][j];
-			ofile_bin.write((char *)(&val),sizeof(val));
-		}
+		const PEDESTAL_CHANNEL *p=pedestal.GetChannel(i);
+		if(p->n_events==0) continue;
+		double noise=0;
+		for(int j=0;j<PEDESTAL_CELLS;j++)
+			noise+=p->cell_sigma[j];
+		cout<<"CH"<<i+1<<" : "<<p->n_events<<" events, mean cell noise "<<noise/PEDESTAL_CELLS<<" mV\n";
 	}
-	ofile_bin.close();
-	ofile_txt.close();
+	
+	if(!pedestal.Write(ofile.c_str()))
+		return 1;
+	pedestal.WriteText((ofile+".txt").c_str());
+	// old layout, by sample after the trigger cell in V
+	pedestal.WriteLegacy("calib/toffset_calib.dat");
+	cout<<"pedestal caliberation written to "<<ofile<<"\n";
 	return 0;
 }
 
+// DRS4 spike removal for get_events(), off by default
+static SpikeRemover lib_spike_remover;
+static bool lib_remove_spikes=false;
+
+void set_spike_removal(bool flag)
+{
+	lib_remove_spikes=flag;
+}
+
+static void remove_event_spikes(double waveform[4][1024],int trigger_cell)
+{
+	// all channels of the event in cell order, in units of 0.1 mV
+	short wf[4][1024],orig[4][1024];
+	int chn,i;
+	for(chn=0;chn<4;chn++)
+		for(i=0;i<1024;i++)
+			wf[chn][(i+trigger_cell)%1024]=(short)floor(waveform[chn][i]*10000+0.5);
+	memcpy(orig,wf,sizeof(wf));
+	if(!lib_spike_remover.Process(wf[0],4))
+		return;
+	for(chn=0;chn<4;chn++)
+		for(i=0;i<1024;i++)
+			waveform[chn][i]+=(wf[chn][(i+trigger_cell)%1024]-orig[chn][(i+trigger_cell)%1024])/10000.0;
+}
+
+// size of one events.dat record, multi-board runs write 4 channels per board
+static long event_record_size(const EHEADER &eh,int channels)
+{
+	long size=sizeof(EHEADER)+sizeof(int)+(long)channels*2*1024*sizeof(float);
+	if(eh.event_header[3] & EHEADER_FLAG_XHEADER)
+		size+=sizeof(XHEADER);
+	if(eh.event_header[3] & EHEADER_FLAG_TRAILER)
+		size+=sizeof(ETRAILER);
+	return size;
+}
+
+// channel count of the first event in an events.dat file, -1 on error
+int get_event_channels(const char * fname)
+{
+	EHEADER eh;
+	int channels=-1;
+	fstream ifile;
+	ifile.open(fname,ios::in | ios::binary);
+	if(!ifile.is_open())
+		return -1;
+	ifile.read((char *)(&eh),sizeof(eh));
+	if(eh.event_header[3] & EHEADER_FLAG_XHEADER)
+		ifile.seekg(sizeof(XHEADER),ios_base::cur);
+	ifile.read((char *)(&channels),sizeof(channels));
+	if(!ifile)
+		channels=-1;
+	ifile.close();
+	return channels;
+}
 
 int get_event_adcSave(const char * fname,double * waveformOUT,int start_eventID,int end_evetID)
 {
@@ -145,16 +138,37 @@ int get_event_adcSave(const char * fname,double * waveformOUT,int start_eventID,
 	}
 	int id=start_eventID;
 	int waveform_id=0;
+	// all events of a file have the same layout, take the record size from the first one
+	ifile.read((char *)(&anevent.eheader),sizeof(anevent.eheader));
+	if(anevent.eheader.event_header[3] & EHEADER_FLAG_XHEADER)
+		ifile.seekg(sizeof(XHEADER),ios_base::cur);
+	ifile.read((char *)(&channels),sizeof(channels));
+	if(!ifile or channels<1 or channels>4*16)
+	{
+		fprintf(stderr,"\n ERROR HAPPEND !! NO VALID EVENT IN FILE !! \n");
+		ifile.close();
+		return -1;
+	}
+	int file_channels=channels;
+	long event_size=event_record_size(anevent.eheader,channels);
 	ifile.seekg(0,ios_base::end);
-	int y=ifile.tellg();
-	if(start_eventID*EVENT_SIZE_BYTES_4channelADC >= y)
+	long y=ifile.tellg();
+	if(start_eventID*event_size >= y)
 		return -2;
-	ifile.seekg(start_eventID*EVENT_SIZE_BYTES_4channelADC,ios_base::beg);
+	// a torn last event after a crash is not read, see evrecover
+	long last_eventID=end_evetID;
+	if(last_eventID>y/event_size)
+		last_eventID=y/event_size;
+	ifile.seekg(start_eventID*event_size,ios_base::beg);
 	ifile.read((char *)(&anevent.eheader),sizeof(anevent.eheader));
-	while(!ifile.eof() and id<end_evetID)
+	while(!ifile.eof() and id<last_eventID)
 	{
 		id++;
+		if(anevent.eheader.event_header[3] & EHEADER_FLAG_XHEADER)
+			ifile.read((char *)(&anevent.xheader),sizeof(anevent.xheader));
 		ifile.read((char *)(&channels),sizeof(channels));
+		if(channels!=file_channels)
+			break;
 		anevent.waveform.clear();
 		anevent.time.clear();
 		for( int i=0;i<channels;i++)
@@ -171,6 +185,8 @@ int get_event_adcSave(const char * fname,double * waveformOUT,int start_eventID,
 				waveformOUT[waveform_id++]=db_buffr_w[j];
 			}
 		}
+		if(anevent.eheader.event_header[3] & EHEADER_FLAG_TRAILER)
+			ifile.seekg(sizeof(ETRAILER),ios_base::cur);
 		ifile.read((char *)(&anevent.eheader),sizeof(anevent.eheader));
 	}
 	ifile.close();
@@ -347,6 +363,9 @@ int get_events(const char * fname,double * waveformOUT,int start_eventID,int end
          
          
          
+         if(lib_remove_spikes)
+            remove_event_spikes(waveform[b],tch.trigger_cell);
+
          // align cell #0 of all channels
          t1 = time[b][0][(1024-tch.trigger_cell) % 1024];
          for (chn=0 ; chn<4 ; chn++) 
@@ -375,23 +394,94 @@ int get_events(const char * fname,double * waveformOUT,int start_eventID,int end
    return 0 ;
 }
 
+void set_event_time(DRS_EVENT * anevent,unsigned long long trigger_ns,unsigned long long run_start_mono_ns,unsigned long long run_start_wall_ns)
+{
+	// wall clock of the trigger from the monotonic timestamp, no clock call per event
+	unsigned long long wall_ns=run_start_wall_ns+(trigger_ns-run_start_mono_ns);
+	time_t wall_s=(time_t)(wall_ns/1000000000ULL);
+	struct tm local_t;
+	localtime_r(&wall_s,&local_t);
+	
+	// date fields as muonDet always wrote them (years since 1900, month 0-11, no ms),
+	// the exact trigger time is in XHEADER only
+	anevent->eheader.year=local_t.tm_year;
+	anevent->eheader.month=local_t.tm_mon;
+	anevent->eheader.day=local_t.tm_mday;
+	anevent->eheader.hour=local_t.tm_hour;
+	anevent->eheader.minute=local_t.tm_min;
+	anevent->eheader.second=local_t.tm_sec;
+	anevent->eheader.millisecond=0;
+	anevent->eheader.event_header[3]|=EHEADER_FLAG_XHEADER;
+	
+	memcpy(anevent->xheader.tag,"XHDR",4);
+	anevent->xheader.size=sizeof(XHEADER);
+	anevent->xheader.trigger_ns=trigger_ns;
+	anevent->xheader.run_start_mono_ns=run_start_mono_ns;
+	anevent->xheader.run_start_wall_ns=run_start_wall_ns;
+}
+
+// per event CRC-32C trailer in save_event_binary(), off by default
+static bool lib_event_checksum=false;
+
+void set_event_checksum(bool flag)
+{
+	lib_event_checksum=flag;
+}
+
 int save_event_binary(const char * fname,DRS_EVENT anevent[],int num_events)
 {
 	fstream ofile;
+	EHEADER eheader;
+	ETRAILER trailer;
+	unsigned int crc=0;
 	ofile.open(fname,ios::out | ios::binary |ios::app );
+	ofile.seekp(0,ios::end);
 	for(int j=0;j<num_events;j++)
 	{
 		int channels=anevent[j].waveform.size();
-		ofile.write((char *)(&anevent[j].eheader),sizeof(anevent[j].eheader));
+		eheader=anevent[j].eheader;
+		if(lib_event_checksum)
+		{
+			// same record as EventJournal, all records of a file have the same size
+			eheader.event_header[3]|=EHEADER_FLAG_TRAILER;
+			memcpy(trailer.tag,"ETRL",4);
+			trailer.length=sizeof(EHEADER)+sizeof(int)+channels*2*1024*sizeof(float)+sizeof(ETRAILER);
+			if(eheader.event_header[3] & EHEADER_FLAG_XHEADER)
+				trailer.length+=sizeof(XHEADER);
+			trailer.sequence=(unsigned int)(ofile.tellp()/trailer.length);
+			crc=crc32c(0,&eheader,sizeof(eheader));
+		}
+		else
+			eheader.event_header[3]&=~EHEADER_FLAG_TRAILER;
+		ofile.write((char *)(&eheader),sizeof(eheader));
+		if(eheader.event_header[3] & EHEADER_FLAG_XHEADER)
+		{
+			ofile.write((char *)(&anevent[j].xheader),sizeof(anevent[j].xheader));
+			if(lib_event_checksum)
+				crc=crc32c(crc,&anevent[j].xheader,sizeof(anevent[j].xheader));
+		}
 		ofile.write((char *)(&channels),sizeof(channels));
+		if(lib_event_checksum)
+			crc=crc32c(crc,&channels,sizeof(channels));
 		//cout<<" chn = "<<channels<<"\n";
 		for( int i=0;i<channels;i++)
 		{
 			ofile.write((char *)(anevent[j].time[i]),1024*sizeof(anevent[j].time[i][0]));
 			ofile.write((char *)(anevent[j].waveform[i]),1024*sizeof(anevent[j].waveform[i][0]));
+			if(lib_event_checksum)
+			{
+				crc=crc32c(crc,anevent[j].time[i],1024*sizeof(anevent[j].time[i][0]));
+				crc=crc32c(crc,anevent[j].waveform[i],1024*sizeof(anevent[j].waveform[i][0]));
+			}
+		}
+		if(lib_event_checksum)
+		{
+			trailer.crc=crc32c(crc,&trailer,sizeof(trailer)-sizeof(trailer.crc));
+			ofile.write((char *)(&trailer),sizeof(trailer));
 		}
 	}
 	ofile.close();
+	return 0;
 }
 
 vector<DRS_EVENT> read_event_binary(const char * fname)
@@ -417,6 +507,8 @@ vector<DRS_EVENT> read_event_binary(const char * fname)
 		id++;
 		cout<<"at loop count = "<<id<<"\n";
 		//if(id>10) break;
+		if(anevent.eheader.event_header[3] & EHEADER_FLAG_XHEADER)
+			ifile.read((char *)(&anevent.xheader),sizeof(anevent.xheader));
 		ifile.read((char *)(&channels),sizeof(channels));
 		cout<<"EVENT ID  = "<<anevent.eheader.event_serial_number<<"\n";
 		cout<<"yr = "<<anevent.eheader.year<<"\n";
@@ -438,6 +530,8 @@ vector<DRS_EVENT> read_event_binary(const char * fname)
 			ifile.read((char *)(db_buffr),1024*sizeof(float));
 			anevent.waveform.push_back(db_buffr);
 		}
+		if(anevent.eheader.event_header[3] & EHEADER_FLAG_TRAILER)
+			ifile.seekg(sizeof(ETRAILER),ios_base::cur);
 		eventList.push_back(anevent);
 		ifile.read((char *)(&anevent.eheader),sizeof(anevent.eheader));
 	}
@@ -476,7 +570,7 @@ int get_channel_offsets(string fname,vector<double *> *calib_data,int channels[]
 
 
 
-double get_energy(float waveform[8][1024],float time[8][1024],int channel, double trigger_level,
+double get_channel_energy(const float * waveform,const float * time, double trigger_level,
 												double neg_offset,double integrate_window,double freq, bool falling_edge )
 {
 	float trig_sign=1;
@@ -488,7 +582,7 @@ double get_energy(float waveform[8][1024],float time[8][1024],int channel, doubl
 	double dt=0,window=0;
 	for(i=0;i<1024;i++)
 	{
-		if(trig_sign*waveform[channel][i]<trig_sign*trigger_level)
+		if(trig_sign*waveform[i]<trig_sign*trigger_level)
 			{
 				start=i;
 				break;
@@ -500,7 +594,7 @@ double get_energy(float waveform[8][1024],float time[8][1024],int channel, doubl
 	}
 	while(i>0)
 	{
-		if(time[channel][start]-time[channel][i] > neg_offset)
+		if(time[start]-time[i] > neg_offset)
 			{
 				start=i;
 				break;
@@ -514,11 +608,17 @@ double get_energy(float waveform[8][1024],float time[8][1024],int channel, doubl
 	window=0;
 	while(i<1024 and window<integrate_window)
 	{
-		dt=time[channel][i]-time[channel][i-1];
+		dt=time[i]-time[i-1];
 		window+=dt;
-		integral+=waveform[channel][i]*dt;
+		integral+=waveform[i]*dt;
 		i++;
 	}
 	return -1*integral/TERMINAL_RESISTANCE;
 }
 
+double get_energy(float waveform[8][1024],float time[8][1024],int channel, double trigger_level,
+												double neg_offset,double integrate_window,double freq, bool falling_edge )
+{
+	return get_channel_energy(waveform[channel],time[channel],trigger_level,neg_offset,integrate_window,freq,falling_edge);
+}
+
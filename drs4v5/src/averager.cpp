@@ -14,6 +14,7 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <algorithm>
 
 #include "averager.h"
 
@@ -25,6 +26,7 @@ Averager::Averager(int nx, int ny, int nz, int dim)
    fNy = ny;
    fNz = nz;
    fDim = dim;
+   fStreaming = false;
    
    int size = sizeof(float)*nx*ny*nz * dim;
    fArray = (float *)malloc(size);
@@ -34,16 +36,64 @@ Averager::Averager(int nx, int ny, int nz, int dim)
    fN = (unsigned short *)malloc(size);
    assert(fN);
    memset(fN, 0, size);
+
+   fBinWidth = 0;
+   fHist = NULL;
+   fSeed = fCenter = fMin = fMax = NULL;
+   fCount = fUnder = fOver = NULL;
+   fMean = fM2 = NULL;
+}
+
+/*----------------------------------------------------------------*/
+
+/* Streaming averager: memory does not depend on the number of samples.
+   The first kNumberOfSeeds samples of a cell are kept, their median
+   centers a histogram of nBins bins of binWidth, all further samples go
+   only into the histogram. Median and RobustAverage are taken from the
+   histogram (to a fraction of binWidth), Average and Sigma are exact. */
+
+Averager::Averager(int nx, int ny, int nz, int nBins, float binWidth)
+{
+   fNx = nx;
+   fNy = ny;
+   fNz = nz;
+   fDim = nBins;
+   fStreaming = true;
+   fBinWidth = binWidth;
+   fArray = NULL;
+   fN = NULL;
+
+   int n = nx*ny*nz;
+   fHist = (unsigned short *)malloc(sizeof(unsigned short)*n*nBins);
+   fSeed = (float *)malloc(sizeof(float)*n*kNumberOfSeeds);
+   fCenter = (float *)malloc(sizeof(float)*n);
+   fMin = (float *)malloc(sizeof(float)*n);
+   fMax = (float *)malloc(sizeof(float)*n);
+   fCount = (unsigned int *)malloc(sizeof(unsigned int)*n);
+   fUnder = (unsigned int *)malloc(sizeof(unsigned int)*n);
+   fOver = (unsigned int *)malloc(sizeof(unsigned int)*n);
+   fMean = (double *)malloc(sizeof(double)*n);
+   fM2 = (double *)malloc(sizeof(double)*n);
+   assert(fHist && fSeed && fCenter && fMin && fMax && fCount && fUnder && fOver && fMean && fM2);
+   Reset();
 }
 
 /*----------------------------------------------------------------*/
 
 Averager::~Averager()
 {
-   if (fN)
-      free(fN);
-   if (fArray)
-      free(fArray);
+   free(fN);
+   free(fArray);
+   free(fHist);
+   free(fSeed);
+   free(fCenter);
+   free(fMin);
+   free(fMax);
+   free(fCount);
+   free(fUnder);
+   free(fOver);
+   free(fMean);
+   free(fM2);
    fN = NULL;
    fArray = NULL;
 }
@@ -56,37 +106,82 @@ void Averager::Add(int x, int y, int z, float value)
    assert(y < fNy);
    assert(z < fNz);
    
-   int nIndex = (x*fNy + y)*fNz + z;
+   int nIndex = Cell(x, y, z);
+
+   if (fStreaming) {
+      unsigned int n = ++fCount[nIndex];
+
+      /* Welford */
+      double d = value - fMean[nIndex];
+      fMean[nIndex] += d / n;
+      fM2[nIndex] += d * (value - fMean[nIndex]);
+      if (n == 1 || value < fMin[nIndex])
+         fMin[nIndex] = value;
+      if (n == 1 || value > fMax[nIndex])
+         fMax[nIndex] = value;
+
+      if (n < kNumberOfSeeds)
+         fSeed[nIndex*kNumberOfSeeds + n - 1] = value;
+      else if (n == kNumberOfSeeds) {
+         fSeed[nIndex*kNumberOfSeeds + n - 1] = value;
+         fCenter[nIndex] = (float)SeedMedian(nIndex);
+         for (int i=0 ; i<kNumberOfSeeds ; i++)
+            Fill(nIndex, fSeed[nIndex*kNumberOfSeeds + i]);
+      } else
+         Fill(nIndex, value);
+      return;
+   }
+
    if (fN[nIndex] == fDim - 1) // check if array full
       return;
    
-   int aIndex = ((x*fNy + y)*fNz + z) * fDim + fN[nIndex];
+   int aIndex = nIndex * fDim + fN[nIndex];
    fN[nIndex]++;
    fArray[aIndex] = value;
 }
 
 /*----------------------------------------------------------------*/
 
+void Averager::Fill(int cell, float value)
+{
+   int bin = (int)floor((value - fCenter[cell]) / fBinWidth) + fDim/2;
+
+   if (bin < 0)
+      fUnder[cell]++;
+   else if (bin >= fDim)
+      fOver[cell]++;
+   else if (fHist[cell*fDim + bin] < 0xFFFF)
+      fHist[cell*fDim + bin]++;
+}
+
+/*----------------------------------------------------------------*/
+
 void Averager::Reset()
 {
-   int size = sizeof(float)*fNx*fNy*fNz * fDim;
+   int n = fNx*fNy*fNz;
+
+   if (fStreaming) {
+      memset(fHist, 0, sizeof(unsigned short)*n*fDim);
+      memset(fSeed, 0, sizeof(float)*n*kNumberOfSeeds);
+      memset(fCenter, 0, sizeof(float)*n);
+      memset(fMin, 0, sizeof(float)*n);
+      memset(fMax, 0, sizeof(float)*n);
+      memset(fCount, 0, sizeof(unsigned int)*n);
+      memset(fUnder, 0, sizeof(unsigned int)*n);
+      memset(fOver, 0, sizeof(unsigned int)*n);
+      memset(fMean, 0, sizeof(double)*n);
+      memset(fM2, 0, sizeof(double)*n);
+      return;
+   }
+
+   int size = sizeof(float)*n * fDim;
    memset(fArray, 0, size);
-   size = sizeof(float)*fNx*fNy*fNz;
+   size = sizeof(float)*n;
    memset(fN, 0, size);
 }
 
 /*----------------------------------------------------------------*/
 
-int compar(const void *a, const void *b);
-
-int compar(const void *a, const void *b)
-{
-   if (*((float *)a) == *((float *)b))
-      return 0;
-   
-   return (*((float *)a) < *((float *)b)) ? -1 : 1;
-}
-           
 double Averager::Average(int x, int y, int z)
 {
    assert(x < fNx);
@@ -95,8 +190,11 @@ double Averager::Average(int x, int y, int z)
 
    double a = 0;
    
-   int nIndex = (x*fNy + y)*fNz + z;
-   int aIndex = ((x*fNy + y)*fNz + z) * fDim;
+   int nIndex = Cell(x, y, z);
+   if (fStreaming)
+      return fMean[nIndex];
+
+   int aIndex = nIndex * fDim;
 
    for (int i=0 ; i<fN[nIndex] ; i++)
       a += fArray[aIndex + i];
@@ -109,21 +207,85 @@ double Averager::Average(int x, int y, int z)
 
 /*----------------------------------------------------------------*/
 
+double Averager::Sigma(int x, int y, int z)
+{
+   assert(x < fNx);
+   assert(y < fNy);
+   assert(z < fNz);
+
+   int nIndex = Cell(x, y, z);
+   if (fStreaming)
+      return fCount[nIndex] > 1 ? sqrt(fM2[nIndex] / (fCount[nIndex] - 1)) : 0;
+
+   int n = fN[nIndex];
+   int aIndex = nIndex * fDim;
+   if (n < 2)
+      return 0;
+
+   double a = Average(x, y, z), s2 = 0;
+   for (int i=0 ; i<n ; i++)
+      s2 += (fArray[aIndex + i] - a) * (fArray[aIndex + i] - a);
+   return sqrt(s2 / (n - 1));
+}
+
+/*----------------------------------------------------------------*/
+
+double Averager::SeedMedian(int cell)
+{
+   /* exact median of the samples seen so far, fewer than kNumberOfSeeds */
+   float v[kNumberOfSeeds];
+   int n = std::min((int)fCount[cell], (int)kNumberOfSeeds);
+
+   if (n == 0)
+      return 0;
+   memcpy(v, &fSeed[cell*kNumberOfSeeds], sizeof(float)*n);
+   std::nth_element(v, v + n/2, v + n);
+   return v[n/2];
+}
+
+/*----------------------------------------------------------------*/
+
+double Averager::HistogramMedian(int cell) const
+{
+   /* sample number n/2 in sorted order like the exact median, linear
+      interpolation inside the bin. Falls back to the mean if the median
+      is outside of the histogram. */
+   const unsigned short *h = &fHist[cell*fDim];
+   double target = fCount[cell] / 2;
+   double cum = fUnder[cell];
+
+   if (target < cum)
+      return fMean[cell];
+
+   for (int b=0 ; b<fDim ; b++) {
+      if (cum + h[b] > target)
+         return fCenter[cell] + (b - fDim/2 + (target - cum + 0.5) / h[b]) * fBinWidth;
+      cum += h[b];
+   }
+
+   return fMean[cell];
+}
+
+/*----------------------------------------------------------------*/
+
 double Averager::Median(int x, int y, int z)
 {
    assert(x < fNx);
    assert(y < fNy);
    assert(z < fNz);
    
-   double m = 0;
-   
-   int nIndex = (x*fNy + y)*fNz + z;
-   int aIndex = ((x*fNy + y)*fNz + z) * fDim;
-   
-   qsort(&fArray[aIndex], fN[nIndex], sizeof(float), compar);
-   m = fArray[aIndex + fN[nIndex]/2];
-   
-   return m;
+   int nIndex = Cell(x, y, z);
+
+   if (fStreaming)
+      return fCount[nIndex] < kNumberOfSeeds ? SeedMedian(nIndex) : HistogramMedian(nIndex);
+
+   int aIndex = nIndex * fDim;
+   int n = fN[nIndex];
+
+   /* only the element in the middle has to be in place, no full sort */
+   if (n > 0)
+      std::nth_element(&fArray[aIndex], &fArray[aIndex + n/2], &fArray[aIndex + n]);
+   return fArray[aIndex + n/2];
 }
 
 /*----------------------------------------------------------------*/
@@ -135,16 +297,44 @@ double Averager::RobustAverage(double range, int x, int y, int z)
    assert(z < fNz);
    
    double ra = 0;
-   int n = 0;
+   double n = 0;
    double m = Median(x, y, z);
    
-   int nIndex = (x*fNy + y)*fNz + z;
-   int aIndex = ((x*fNy + y)*fNz + z) * fDim;
+   int nIndex = Cell(x, y, z);
+
+   if (fStreaming && fCount[nIndex] >= kNumberOfSeeds) {
+      /* bins partially inside of the range count with the overlapping
+         fraction, assuming a flat distribution inside a bin */
+      const unsigned short *h = &fHist[nIndex*fDim];
+      for (int b=0 ; b<fDim ; b++) {
+         if (h[b] == 0)
+            continue;
+         double lo = fCenter[nIndex] + (b - fDim/2) * fBinWidth;
+         double hi = lo + fBinWidth;
+         lo = std::max(lo, m - range);
+         hi = std::min(hi, m + range);
+         if (hi > lo) {
+            double w = h[b] * (hi - lo) / fBinWidth;
+            ra += w * (lo + hi) / 2;
+            n += w;
+         }
+      }
+   } else if (fStreaming) {
+      for (unsigned int i=0 ; i<fCount[nIndex] ; i++) {
+         float v = fSeed[nIndex*kNumberOfSeeds + i];
+         if (v > m - range && v < m + range) {
+            ra += v;
+            n++;
+         }
+      }
+   } else {
+      int aIndex = nIndex * fDim;
    
-   for (int i=0 ; i<fN[nIndex] ; i++) {
-      if (fArray[aIndex + i] > m - range && fArray[aIndex + i] < m + range) {
-         ra += fArray[aIndex + i];
-         n++;
+      for (int i=0 ; i<fN[nIndex] ; i++) {
+         if (fArray[aIndex + i] > m - range && fArray[aIndex + i] < m + range) {
+            ra += fArray[aIndex + i];
+            n++;
+         }
       }
    }
    
@@ -172,8 +362,26 @@ int Averager::SaveNormalizedDistribution(const char *filename, int x, float rang
    for (int y=0 ; y<fNy ; y++)
       for (int z=0 ; z<fNz ; z++) {
          
-         int nIndex = (x*fNy + y)*fNz + z;
-         int aIndex = ((x*fNy + y)*fNz + z) * fDim;
+         int nIndex = Cell(x, y, z);
+         int aIndex = nIndex * fDim;
+
+         if (fStreaming) {
+            if (fCount[nIndex] > 1) {
+               double m = Median(x, y, z);
+               double min = std::min(fMin[nIndex] - m, 0.0);
+               double max = std::max(fMax[nIndex] - m, 0.0);
+
+               fprintf(f, "%d,%d, %d, ", x, y, z);
+               fprintf(f, "%3.1lf, %3.1lf, %3.1lf, %3.3lf, ", min, max, fMean[nIndex] - m, Sigma(x, y, z));
+
+               /* single samples are not kept, give the number outside of the histogram */
+               if (min < -range || max > range)
+                  fprintf(f, "%u,%u,", fUnder[nIndex], fOver[nIndex]);
+
+               fprintf(f, "\n");
+            }
+            continue;
+         }
          
          if (fN[nIndex] > 1) {
             fprintf(f, "%d,%d, %d, ", x, y, z);
@@ -0,0 +1,254 @@
+/********************************************************************\
+
+  Name:         calibcache.cpp
+
+  Contents:     On-disk cache of the calibration tables read from the
+                board EEPROM
+
+                One file per board, <dir>/drs4_<serial>.cal, holding
+                the decoded offset, gain and timing tables. A file is
+                only used if serial number, firmware version, board
+                type, nominal frequency, the calibration generation and
+                the checksum of the EEPROM page 0 header match, and the
+                payload checksum is correct. WriteEEPROM() counts the
+                generation up on every write, so only page 0 has to be
+                read to validate a file. Files are mapped with mmap()
+                and copied into the board.
+
+                New files are written by a background thread into a
+                temporary file which is then renamed, so a reader never
+                sees a partial file. Writing to the EEPROM of a board
+                removes its cache file.
+
+                The directory is $DRS_CALIB_CACHE or $HOME/.drs4, an
+                empty $DRS_CALIB_CACHE disables the cache.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+
+#include "calibcache.h"
+
+static char cache_dir[1000];
+static bool cache_dir_set = false;
+
+/*------------------------------------------------------------------*/
+
+static std::mutex &cache_mutex()
+{
+   static std::mutex m;
+   return m;
+}
+
+static std::vector<std::thread> &cache_writers()
+{
+   static std::vector<std::thread> v;
+   return v;
+}
+
+/*------------------------------------------------------------------*/
+
+unsigned int DRSCalibCache::Checksum(const void *buffer, unsigned int size, unsigned int seed)
+{
+   /* FNV-1a */
+   const unsigned char *p = (const unsigned char *) buffer;
+   unsigned int h = seed;
+
+   for (unsigned int i = 0; i < size; i++) {
+      h ^= p[i];
+      h *= 16777619U;
+   }
+   return h;
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSCalibCache::SetDirectory(const char *dir)
+{
+   std::lock_guard<std::mutex> lock(cache_mutex());
+   snprintf(cache_dir, sizeof(cache_dir), "%s", dir ? dir : "");
+   cache_dir_set = true;
+}
+
+/*------------------------------------------------------------------*/
+
+const char *DRSCalibCache::GetDirectory()
+{
+   std::lock_guard<std::mutex> lock(cache_mutex());
+
+   if (!cache_dir_set) {
+      const char *env = getenv("DRS_CALIB_CACHE");
+      const char *home = getenv("HOME");
+      if (env)
+         snprintf(cache_dir, sizeof(cache_dir), "%s", env);
+      else if (home)
+         snprintf(cache_dir, sizeof(cache_dir), "%s/.drs4", home);
+      else
+         cache_dir[0] = 0;
+      cache_dir_set = true;
+   }
+   return cache_dir;
+}
+
+/*------------------------------------------------------------------*/
+
+static bool cache_filename(int serial, char *filename, int size)
+{
+   const char *dir = DRSCalibCache::GetDirectory();
+
+   if (dir[0] == 0)
+      return false;
+   snprintf(filename, size, "%s/drs4_%d.cal", dir, serial);
+   return true;
+}
+
+/*------------------------------------------------------------------*/
+
+bool DRSCalibCache::Load(const DRS_CALIB_KEY *key, DRS_CALIB_SECTION *section, int n)
+{
+   char filename[1100];
+   struct stat st;
+   const DRS_CALIB_CACHE_HEADER *h;
+   const unsigned char *p;
+   unsigned int size;
+   bool valid;
+   int i, fh;
+
+   if (!cache_filename(key->serial, filename, sizeof(filename)))
+      return false;
+
+   fh = open(filename, O_RDONLY);
+   if (fh < 0)
+      return false;
+
+   for (i = 0, size = 0; i < n; i++)
+      size += section[i].size;
+
+   if (fstat(fh, &st) < 0 || st.st_size != (off_t) (sizeof(DRS_CALIB_CACHE_HEADER) + size)) {
+      close(fh);
+      return false;
+   }
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fh, 0);
+   close(fh);
+   if (map == MAP_FAILED)
+      return false;
+
+   h = (const DRS_CALIB_CACHE_HEADER *) map;
+   p = (const unsigned char *) map + sizeof(DRS_CALIB_CACHE_HEADER);
+   valid = memcmp(h->tag, "DRSC", 4) == 0 &&
+           h->version == DRS_CALIB_CACHE_VERSION &&
+           h->key.serial == key->serial &&
+           h->key.firmware == key->firmware &&
+           h->key.board_type == key->board_type &&
+           h->key.eeprom_checksum == key->eeprom_checksum &&
+           h->key.nominal_frequency == key->nominal_frequency &&
+           h->payload_size == size &&
+           h->payload_checksum == Checksum(p, size);
+
+   if (valid)
+      for (i = 0; i < n; i++) {
+         memcpy(section[i].data, p, section[i].size);
+         p += section[i].size;
+      }
+
+   munmap(map, st.st_size);
+   return valid;
+}
+
+/*------------------------------------------------------------------*/
+
+static void cache_write(std::vector<unsigned char> *buffer, std::string filename)
+{
+   char tmpname[1200];
+   FILE *f;
+   bool ok;
+
+   snprintf(tmpname, sizeof(tmpname), "%s.tmp%d", filename.c_str(), (int) getpid());
+   f = fopen(tmpname, "wb");
+   if (f == NULL) {
+      delete buffer;
+      return;
+   }
+   ok = fwrite(&(*buffer)[0], buffer->size(), 1, f) == 1;
+   ok = (fflush(f) == 0) && ok;
+   ok = (fsync(fileno(f)) == 0) && ok;
+   fclose(f);
+
+   if (!ok || rename(tmpname, filename.c_str()) < 0)
+      remove(tmpname);
+
+   delete buffer;
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSCalibCache::Store(const DRS_CALIB_KEY *key, const DRS_CALIB_SECTION *section, int n)
+{
+   char filename[1100];
+   DRS_CALIB_CACHE_HEADER h;
+   unsigned int size;
+   int i;
+
+   if (!cache_filename(key->serial, filename, sizeof(filename)))
+      return;
+   mkdir(GetDirectory(), 0755);
+
+   for (i = 0, size = 0; i < n; i++)
+      size += section[i].size;
+
+   /* snapshot of the tables, the board may change them while the file is written */
+   std::vector<unsigned char> *buffer = new std::vector<unsigned char>(sizeof(h) + size);
+   unsigned char *p = &(*buffer)[sizeof(h)];
+   for (i = 0; i < n; i++) {
+      memcpy(p, section[i].data, section[i].size);
+      p += section[i].size;
+   }
+
+   memset(&h, 0, sizeof(h));
+   memcpy(h.tag, "DRSC", 4);
+   h.version = DRS_CALIB_CACHE_VERSION;
+   h.key = *key;
+   h.payload_size = size;
+   h.payload_checksum = Checksum(&(*buffer)[sizeof(h)], size);
+   memcpy(&(*buffer)[0], &h, sizeof(h));
+
+   std::lock_guard<std::mutex> lock(cache_mutex());
+   cache_writers().push_back(std::thread(cache_write, buffer, std::string(filename)));
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSCalibCache::Remove(int serial)
+{
+   char filename[1100];
+
+   /* a pending writer must not bring the file back */
+   Flush();
+   if (cache_filename(serial, filename, sizeof(filename)))
+      remove(filename);
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSCalibCache::Flush()
+{
+   /* wait for all background writers */
+   std::vector<std::thread> writers;
+   {
+      std::lock_guard<std::mutex> lock(cache_mutex());
+      writers.swap(cache_writers());
+   }
+   for (size_t i = 0; i < writers.size(); i++)
+      writers[i].join();
+}
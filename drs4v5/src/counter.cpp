@@ -0,0 +1,185 @@
+/********************************************************************\
+
+  Name:         counter.cpp
+
+  Contents:     Trigger counter based on the hardware scalers of the
+                DRS4 evaluation board, with a software fallback
+
+                Boards of type 9 with firmware >= 21000 count the
+                discriminator outputs and the trigger logic in
+                hardware. Each scaler register holds the number of
+                hits in the last 100 ms, GetScaler() returns it as a
+                rate. The counter samples all scalers and the trigger
+                bus at a fixed cadence and integrates rate * dt, so
+                the count rate is limited by the board and not by
+                USB round trips.
+
+                Older boards fall back to StartDomino()/IsBusy() per
+                trigger. Counts are then taken in software, but the
+                display is still only updated once per interval.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "counter.h"
+#include "daqtimer.h"
+#include "ratelog.h"
+
+static const char *scaler_name[kNumberOfScalers] = {
+   "CH1",
+   "CH2",
+   "CH3",
+   "CH4",
+   "EXT",
+   "Trigger"
+};
+
+/*------------------------------------------------------------------*/
+
+ScalerCounter::ScalerCounter(DRSBoard *board, int intervalMs)
+:  fBoard(board)
+    , fHardware(HasScalers(board))
+    , fIntervalMs(intervalMs > 0 ? intervalMs : 100)
+    , fLogger(NULL)
+{
+   Start();
+}
+
+/*------------------------------------------------------------------*/
+
+bool ScalerCounter::HasScalers(DRSBoard *board)
+{
+   /* same condition as in DRSBoard::GetScaler() */
+   return board->GetBoardType() >= 9 && board->GetFirmwareVersion() >= 21000 &&
+          board->GetTransport() == TR_USB2;
+}
+
+/*------------------------------------------------------------------*/
+
+void ScalerCounter::Start()
+{
+   for (int i = 0; i < kNumberOfScalers; i++)
+      fRate[i] = fCount[i] = 0;
+   fSamples = 0;
+   fTriggerBus = 0;
+   fTriggerBusChanges = 0;
+   fStart = fLast = daq_time_ns();
+}
+
+/*------------------------------------------------------------------*/
+
+void ScalerCounter::Sample()
+{
+   unsigned short bus;
+   uint64_t now;
+   double dt, delta[kNumberOfScalers];
+   int i;
+
+   for (i = 0; i < kNumberOfScalers; i++)
+      fRate[i] = fBoard->GetScaler(i);
+   bus = (unsigned short) fBoard->GetTriggerBus();
+
+   now = daq_time_ns();
+   dt = (now - fLast) / 1E9;
+   for (i = 0; i < kNumberOfScalers; i++) {
+      delta[i] = fRate[i] * dt;
+      fCount[i] += delta[i];
+   }
+   if (fSamples > 0 && bus != fTriggerBus)
+      fTriggerBusChanges++;
+   fTriggerBus = bus;
+   fLast = now;
+   fSamples++;
+
+   if (fLogger)
+      fLogger->Add(GetElapsed(), dt, delta);
+}
+
+/*------------------------------------------------------------------*/
+
+void ScalerCounter::Run(volatile bool *stop, FILE *display)
+{
+   uint64_t interval = (uint64_t) fIntervalMs * 1000000ULL;
+   uint64_t next, now, lastCount;
+   double delta[kNumberOfScalers];
+   struct timespec ts;
+
+   Start();
+   next = fStart + interval;
+
+   if (fHardware) {
+      while (!*stop) {
+         /* absolute schedule, the cadence does not drift with the USB latency */
+         now = daq_time_ns();
+         if (next > now) {
+            ts.tv_sec = (next - now) / 1000000000ULL;
+            ts.tv_nsec = (next - now) % 1000000000ULL;
+            nanosleep(&ts, NULL);
+         }
+         next += interval;
+
+         Sample();
+         if (display)
+            Display(display);
+      }
+   } else {
+      lastCount = 0;
+      while (!*stop) {
+         fBoard->StartDomino();
+         while (fBoard->IsBusy() && !*stop);
+         if (*stop)
+            break;
+         fCount[kScalerTrigger]++;
+
+         now = daq_time_ns();
+         if (now >= next) {
+            fRate[kScalerTrigger] = (fCount[kScalerTrigger] - lastCount) * 1E9 / (now - fLast);
+            if (fLogger) {
+               memset(delta, 0, sizeof(delta));
+               delta[kScalerTrigger] = fCount[kScalerTrigger] - lastCount;
+               fLogger->Add((now - fStart) / 1E9, (now - fLast) / 1E9, delta);
+            }
+            lastCount = (uint64_t) fCount[kScalerTrigger];
+            fLast = now;
+            fSamples++;
+            next = now + interval;
+            if (display)
+               Display(display);
+         }
+      }
+      fLast = daq_time_ns();
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void ScalerCounter::Display(FILE *f)
+{
+   fprintf(f, "\r t = %8.1lf s  Count = %12.0lf  Rate = %9.1lf Hz", GetElapsed(),
+           fCount[kScalerTrigger], fRate[kScalerTrigger]);
+   if (fHardware)
+      for (int i = kScalerCH1; i <= kScalerCH4; i++)
+         fprintf(f, "  %s %8.1lf", scaler_name[i], fRate[i]);
+   fprintf(f, "   ");
+   fflush(f);
+}
+
+/*------------------------------------------------------------------*/
+
+void ScalerCounter::PrintSummary(FILE *f) const
+{
+   double t = GetElapsed();
+
+   fprintf(f, "Counting mode : %s, %llu samples in %1.1lf s\n",
+           fHardware ? "hardware scalers" : "software", fSamples, t);
+   for (int i = 0; i < kNumberOfScalers; i++) {
+      if (!fHardware && i != kScalerTrigger)
+         continue;
+      fprintf(f, "%-8s %14.0lf counts %12.3lf Hz\n", scaler_name[i], fCount[i], t > 0 ? fCount[i] / t : 0);
+   }
+   if (fHardware)
+      fprintf(f, "Trigger bus changes between samples : %llu\n", fTriggerBusChanges);
+}
@@ -0,0 +1,176 @@
+/********************************************************************\
+
+  Name:         crc32c.cpp
+
+  Contents:     CRC-32C (Castagnoli) of event records, with the SSE4.2
+                crc32 instruction where the CPU has it
+
+                The instruction is selected at run time, so one binary
+                runs on every x86 machine of the lab. It handles 8
+                bytes per instruction, several GB/s per core, enough
+                to checksum every event at the full readout rate and
+                to verify files at disk speed. Without it a table
+                driven slicing-by-8 loop is used, about 1 GB/s.
+
+\********************************************************************/
+
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_X86
+#include <nmmintrin.h>
+#endif
+
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+
+typedef unsigned int (*CRC32C_FUNC)(unsigned int crc, const void *data, size_t n);
+
+/*------------------------------------------------------------------*/
+
+/* reflected polynomial 0x82F63B78, slicing by 8 */
+static struct CRC32C_TABLE {
+   unsigned int t[8][256];
+
+   CRC32C_TABLE()
+   {
+      unsigned int i, j, c;
+
+      for (i = 0; i < 256; i++) {
+         c = i;
+         for (j = 0; j < 8; j++)
+            c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+         t[0][i] = c;
+      }
+      for (i = 0; i < 256; i++)
+         for (j = 1; j < 8; j++)
+            t[j][i] = (t[j - 1][i] >> 8) ^ t[0][t[j - 1][i] & 0xFF];
+   }
+} crc32c_table;
+
+static unsigned int crc32c_sw(unsigned int crc, const void *data, size_t n)
+{
+   const unsigned char *p = (const unsigned char *) data;
+   const unsigned int (*t)[256] = crc32c_table.t;
+   unsigned int lo, hi;
+
+   crc = ~crc;
+   while (n && ((size_t) p & 7)) {
+      crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+      n--;
+   }
+   while (n >= 8) {
+      memcpy(&lo, p, 4);
+      memcpy(&hi, p + 4, 4);
+      lo ^= crc;
+      crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+      p += 8;
+      n -= 8;
+   }
+   while (n--)
+      crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+
+   return ~crc;
+}
+
+/*------------------------------------------------------------------*/
+
+#ifdef CRC32C_X86
+
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(unsigned int crc, const void *data, size_t n)
+{
+   const unsigned char *p = (const unsigned char *) data;
+
+   crc = ~crc;
+   while (n && ((size_t) p & 7)) {
+      crc = _mm_crc32_u8(crc, *p++);
+      n--;
+   }
+#ifdef __x86_64__
+   unsigned long long c = crc, v;
+   while (n >= 8) {
+      memcpy(&v, p, 8);
+      c = _mm_crc32_u64(c, v);
+      p += 8;
+      n -= 8;
+   }
+   crc = (unsigned int) c;
+#endif
+   unsigned int w;
+   while (n >= 4) {
+      memcpy(&w, p, 4);
+      crc = _mm_crc32_u32(crc, w);
+      p += 4;
+      n -= 4;
+   }
+   while (n--)
+      crc = _mm_crc32_u8(crc, *p++);
+
+   return ~crc;
+}
+
+#endif
+
+/*------------------------------------------------------------------*/
+
+#ifdef __ARM_FEATURE_CRC32
+
+static unsigned int crc32c_arm(unsigned int crc, const void *data, size_t n)
+{
+   const unsigned char *p = (const unsigned char *) data;
+   unsigned long long v;
+
+   crc = ~crc;
+   while (n >= 8) {
+      memcpy(&v, p, 8);
+      crc = __crc32cd(crc, v);
+      p += 8;
+      n -= 8;
+   }
+   while (n--)
+      crc = __crc32cb(crc, *p++);
+
+   return ~crc;
+}
+
+#endif
+
+/*------------------------------------------------------------------*/
+
+static CRC32C_FUNC crc32c_select(const char **name)
+{
+#ifdef CRC32C_X86
+   if (__builtin_cpu_supports("sse4.2")) {
+      *name = "sse4.2";
+      return crc32c_sse42;
+   }
+#endif
+#ifdef __ARM_FEATURE_CRC32
+   *name = "armv8";
+   return crc32c_arm;
+#endif
+   *name = "table";
+   return crc32c_sw;
+}
+
+static const char *crc32c_name = "table";
+
+unsigned int crc32c(unsigned int crc, const void *data, size_t n)
+{
+   static CRC32C_FUNC f = crc32c_select(&crc32c_name);
+
+   return f(crc, data, n);
+}
+
+/*------------------------------------------------------------------*/
+
+const char *crc32c_implementation()
+{
+   crc32c(0, NULL, 0);
+   return crc32c_name;
+}
@@ -0,0 +1,247 @@
+/********************************************************************\
+
+  Name:         daqtimer.cpp
+
+  Contents:     Per-stage latency histograms and dead-time accounting
+                for the DAQ event loop
+
+                Each stage boundary costs one clock_gettime() call,
+                the time between two Mark() calls is booked to the
+                stage passed to the second call. Time spent in
+                kStageWaitTrigger is live time, everything else is
+                dead time.
+
+                The wall clock is read once in StartRun(), event
+                times are derived from the monotonic stage marks so
+                the event loop never calls CLOCK_REALTIME.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "daqtimer.h"
+
+static const char *stage_name[kNumberOfStages] = {
+   "StartDomino",
+   "WaitTrigger",
+   "Transfer",
+   "SwTrigger",
+   "Decode",
+   "GetTime",
+   "Analysis",
+   "Write",
+   "Monitor"
+};
+
+/*------------------------------------------------------------------*/
+
+void LatencyHistogram::Reset()
+{
+   memset(fBucket, 0, sizeof(fBucket));
+   fCount = 0;
+   fSum = 0;
+   fMax = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int LatencyHistogram::BucketIndex(uint64_t ns)
+{
+   if (ns < kSubBuckets)
+      return (int) ns;
+
+   int e = 63 - __builtin_clzll(ns);
+   return (e - kSubBits + 1) * kSubBuckets + (int) ((ns >> (e - kSubBits)) & (kSubBuckets - 1));
+}
+
+/*------------------------------------------------------------------*/
+
+uint64_t LatencyHistogram::BucketUpperEdge(int index)
+{
+   if (index < kSubBuckets)
+      return (uint64_t) index;
+
+   int e = index / kSubBuckets + kSubBits - 1;
+   uint64_t m = (uint64_t) (kSubBuckets + index % kSubBuckets);
+   uint64_t width = 1ULL << (e - kSubBits);
+
+   /* last bucket would overflow */
+   if (m + 1 == 2 * kSubBuckets && e == 63)
+      return ~0ULL;
+
+   return (m + 1) * width - 1;
+}
+
+/*------------------------------------------------------------------*/
+
+uint64_t LatencyHistogram::GetPercentile(double p) const
+{
+   if (fCount == 0)
+      return 0;
+
+   uint64_t target = (uint64_t) (p * fCount + 0.5);
+   if (target < 1)
+      target = 1;
+   if (target > fCount)
+      target = fCount;
+
+   uint64_t n = 0;
+   for (int i = 0; i < kNumberOfBuckets; i++) {
+      n += fBucket[i];
+      if (n >= target) {
+         uint64_t edge = BucketUpperEdge(i);
+         return edge < fMax ? edge : fMax;
+      }
+   }
+
+   return fMax;
+}
+
+/*------------------------------------------------------------------*/
+
+const char *DAQTimer::GetStageName(int stage)
+{
+   if (stage < 0 || stage >= kNumberOfStages)
+      return "?";
+   return stage_name[stage];
+}
+
+/*------------------------------------------------------------------*/
+
+void DAQTimer::StartRun()
+{
+   for (int i = 0; i < kNumberOfStages; i++) {
+      fStage[i].Reset();
+      fPending[i] = 0;
+      fTouched[i] = false;
+   }
+   fRunStart = fLast = fIntervalStart = daq_time_ns();
+   fRunStartWall = daq_wall_time_ns();
+   fRunStop = 0;
+   fLive = fIntervalLive = 0;
+   fEvents = fIntervalEvents = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+void DAQTimer::StopRun()
+{
+   fRunStop = daq_time_ns();
+}
+
+/*------------------------------------------------------------------*/
+
+uint64_t DAQTimer::Mark(DAQStage stage)
+{
+   uint64_t now = daq_time_ns();
+   uint64_t dt = now - fLast;
+
+   fPending[stage] += dt;
+   fTouched[stage] = true;
+   if (stage == kStageWaitTrigger) {
+      fLive += dt;
+      fIntervalLive += dt;
+   }
+   fLast = now;
+
+   return now;
+}
+
+/*------------------------------------------------------------------*/
+
+void DAQTimer::EndEvent()
+{
+   /* a stage may be marked several times per event, book the sum once */
+   for (int i = 0; i < kNumberOfStages; i++)
+      if (fTouched[i]) {
+         fStage[i].Add(fPending[i]);
+         fPending[i] = 0;
+         fTouched[i] = false;
+      }
+   fEvents++;
+   fIntervalEvents++;
+}
+
+/*------------------------------------------------------------------*/
+
+uint64_t DAQTimer::GetRunTime() const
+{
+   return (fRunStop ? fRunStop : daq_time_ns()) - fRunStart;
+}
+
+/*------------------------------------------------------------------*/
+
+double DAQTimer::GetDeadTimeFraction() const
+{
+   uint64_t t = GetRunTime();
+   if (t == 0)
+      return 0;
+   return 1.0 - (double) fLive / t;
+}
+
+/*------------------------------------------------------------------*/
+
+void DAQTimer::GetInterval(double *rate, double *deadTime)
+{
+   /* rate [1/s] and dead time fraction since the last call */
+   uint64_t now = daq_time_ns();
+   uint64_t t = now - fIntervalStart;
+
+   if (t > 0) {
+      *rate = fIntervalEvents * 1E9 / t;
+      *deadTime = 1.0 - (double) fIntervalLive / t;
+   } else {
+      *rate = 0;
+      *deadTime = 0;
+   }
+
+   fIntervalStart = now;
+   fIntervalLive = 0;
+   fIntervalEvents = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+void DAQTimer::PrintSummary(FILE *f) const
+{
+   fprintf(f, "%-12s %10s %12s %12s %12s %12s\n", "Stage", "Count", "Mean [us]", "p50 [us]", "p99 [us]", "Max [us]");
+   for (int i = 0; i < kNumberOfStages; i++) {
+      const LatencyHistogram &h = fStage[i];
+      if (h.GetCount() == 0)
+         continue;
+      fprintf(f, "%-12s %10llu %12.2lf %12.2lf %12.2lf %12.2lf\n", stage_name[i],
+              (unsigned long long) h.GetCount(), h.GetMean() / 1E3,
+              h.GetPercentile(0.50) / 1E3, h.GetPercentile(0.99) / 1E3, h.GetMax() / 1E3);
+   }
+   fprintf(f, "Events %llu in %1.3lf s, dead time %1.2lf %%\n", (unsigned long long) fEvents,
+           GetRunTime() / 1E9, GetDeadTimeFraction() * 100);
+}
+
+/*------------------------------------------------------------------*/
+
+int DAQTimer::WriteSummary(const char *filename) const
+{
+   /* same "name,value" layout as fit_params.txt */
+   FILE *f = fopen(filename, "w");
+   if (f == NULL) {
+      printf("Cannot open file \"%s\"\n", filename);
+      return 0;
+   }
+
+   fprintf(f, "Events,%llu\n", (unsigned long long) fEvents);
+   fprintf(f, "Run_ns,%llu\n", (unsigned long long) GetRunTime());
+   fprintf(f, "Live_ns,%llu\n", (unsigned long long) fLive);
+   fprintf(f, "DeadTime_Fraction,%1.6lf\n", GetDeadTimeFraction());
+   for (int i = 0; i < kNumberOfStages; i++) {
+      const LatencyHistogram &h = fStage[i];
+      fprintf(f, "%s_Count,%llu\n", stage_name[i], (unsigned long long) h.GetCount());
+      fprintf(f, "%s_Mean_ns,%1.1lf\n", stage_name[i], h.GetMean());
+      fprintf(f, "%s_P50_ns,%llu\n", stage_name[i], (unsigned long long) h.GetPercentile(0.50));
+      fprintf(f, "%s_P99_ns,%llu\n", stage_name[i], (unsigned long long) h.GetPercentile(0.99));
+      fprintf(f, "%s_Max_ns,%llu\n", stage_name[i], (unsigned long long) h.GetMax());
+   }
+   fclose(f);
+
+   return 1;
+}
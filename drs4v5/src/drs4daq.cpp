@@ -0,0 +1,327 @@
+/********************************************************************\
+
+  Name:         drs4daq.cpp
+
+  Contents:     Plain C interface to the live acquisition of a DRS4
+                evaluation board, for use from Python (drs4daq.py) or
+                other languages through libdrs4daq.so
+
+                The board is read through a DRSRawEvent, so decode()
+                calibrates only the inputs asked for. User pedestals
+                from calib/pedestal.cal are applied by the board
+                inside the calibration, spike removal through the
+                raw event. drs4_acquire() runs the complete arm, wait,
+                transfer, decode loop in C++, ctypes releases the GIL
+                for the duration of each call.
+
+                With drs4_set_live() every decoded event is also handed
+                to an EventSlot, from which a display thread takes the
+                latest one with drs4_live_event() at its own rate.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <atomic>
+
+#include "DRS.h"
+#include "drs4daq.h"
+#include "daqtimer.h"
+#include "rawevent.h"
+#include "pedestal.h"
+#include "spikes.h"
+#include "evslot.h"
+
+struct DRS4_DAQ {
+   DRS                *drs;
+   DRSBoard           *board;
+   DRSRawEvent        *raw;
+   SpikeRemover        spikes;
+   std::atomic<int>    abort;
+   EventSlot          *live;           // latest event for a display thread, optional
+   unsigned long long  trigger_ns;
+   char                error[256];
+};
+
+/*------------------------------------------------------------------*/
+
+static int drs4_set_error(DRS4_DAQ *d, const char *format, ...)
+{
+   va_list argptr;
+
+   va_start(argptr, format);
+   vsnprintf(d->error, sizeof(d->error), format, argptr);
+   va_end(argptr);
+
+   return -1;
+}
+
+/*------------------------------------------------------------------*/
+
+DRS4_DAQ *drs4_open(int board_index, double freq_ghz)
+{
+   char str[256];
+
+   DRS4_DAQ *d = new DRS4_DAQ;
+   d->drs = new DRS();
+   d->board = NULL;
+   d->raw = NULL;
+   d->live = NULL;
+   d->abort = 0;
+   d->trigger_ns = 0;
+   d->error[0] = 0;
+
+   if (board_index < 0 || board_index >= d->drs->GetNumberOfBoards()) {
+      printf("DRS4 evaluation board #%d not found, %d board(s) present\n", board_index,
+             d->drs->GetNumberOfBoards());
+      delete d->drs;
+      delete d;
+      return NULL;
+   }
+
+   if (d->drs->InitBoards(freq_ghz)) {
+      d->drs->GetError(str, sizeof(str));
+      printf("%s", str);
+   }
+
+   d->board = d->drs->GetBoard(board_index);
+   d->board->SetTranspMode(1);         // transparent mode needed for analog trigger
+   d->board->SetInputRange(0);         // -0.5V ... +0.5V
+   if (d->board->GetBoardType() >= 8)
+      d->board->EnableTrigger(1, 0);   // hardware trigger
+   d->raw = new DRSRawEvent(d->board);
+
+   return d;
+}
+
+/*------------------------------------------------------------------*/
+
+void drs4_close(DRS4_DAQ *d)
+{
+   if (d == NULL)
+      return;
+   delete d->live;
+   delete d->raw;
+   delete d->drs;
+   delete d;
+}
+
+/*------------------------------------------------------------------*/
+
+const char *drs4_error(DRS4_DAQ *d)
+{
+   return d->error;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_serial_number(DRS4_DAQ *d)
+{
+   return d->board->GetBoardSerialNumber();
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_configure(DRS4_DAQ *d, double range_v, int trigger_source, double trigger_level_mv,
+                   int negative_edge, double delay_ns)
+{
+   int i;
+
+   if (d->board->GetBoardType() < 8)
+      return drs4_set_error(d, "board type %d has no individual trigger levels", d->board->GetBoardType());
+
+   d->board->SetInputRange(range_v);
+   for (i = 0; i < DRS4DAQ_INPUTS; i++)
+      d->board->SetIndividualTriggerLevel(i, trigger_level_mv / 1000);
+   d->board->SetTriggerPolarity(negative_edge != 0);
+   d->board->SetTriggerSource(trigger_source);
+   d->board->SetTriggerDelayNs((int) delay_ns);
+
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_load_pedestal(DRS4_DAQ *d, const char *filename)
+{
+   PedestalTable pedestal;
+   int i, n;
+
+   n = pedestal.Load(filename);
+   if (n <= 0)
+      return drs4_set_error(d, "cannot load pedestals from \"%s\"", filename);
+
+   for (i = 0; i < PEDESTAL_CHANNELS && i < DRS4DAQ_INPUTS; i++)
+      if (pedestal.IsValid(i))
+         d->board->SetUserPedestal(0, 2 * i, pedestal.GetMean(i), kUserPedestalByCell);
+
+   return n;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_set_spike_removal(DRS4_DAQ *d, int flag)
+{
+   d->raw->SetSpikeRemover(flag ? &d->spikes : NULL);
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_arm(DRS4_DAQ *d)
+{
+   d->abort = 0;
+   return d->board->StartDomino();
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_wait(DRS4_DAQ *d, int timeout_ms)
+{
+   uint64_t start, now;
+
+   start = daq_time_ns();
+   while (d->board->IsBusy()) {
+      now = daq_time_ns();
+      if (d->abort || (timeout_ms >= 0 && now - start > (uint64_t) timeout_ms * 1000000ULL))
+         return 0;
+   }
+   d->trigger_ns = daq_time_ns();
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_transfer(DRS4_DAQ *d)
+{
+   int status;
+
+   status = d->raw->Transfer();
+   if (status < 0)
+      return drs4_set_error(d, "transfer failed with status %d", status);
+
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_decode(DRS4_DAQ *d, int input_mask, float *wave, float *time)
+{
+   EVSLOT_EVENT *e = NULL;
+   int i;
+
+   if (d->live) {
+      e = d->live->BeginWrite();
+      e->trigger_ns = d->trigger_ns;
+      e->trigger_cell = d->raw->GetTriggerCell();
+      e->valid = 0;
+   }
+
+   for (i = 0; i < DRS4DAQ_INPUTS; i++) {
+      if ((input_mask & (1 << i)) == 0)
+         continue;
+      if (wave)
+         memcpy(wave + i * DRS4DAQ_BINS, d->raw->GetWave(2 * i), DRS4DAQ_BINS * sizeof(float));
+      if (time)
+         memcpy(time + i * DRS4DAQ_BINS, d->raw->GetTime(2 * i), DRS4DAQ_BINS * sizeof(float));
+      if (e) {
+         memcpy(d->live->GetWave(e, 0, i), d->raw->GetWave(2 * i), DRS4DAQ_BINS * sizeof(float));
+         memcpy(d->live->GetTime(e, 0, i), d->raw->GetTime(2 * i), DRS4DAQ_BINS * sizeof(float));
+         e->valid |= 1 << i;
+      }
+   }
+
+   if (e)
+      d->live->Publish();
+
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_trigger_cell(DRS4_DAQ *d)
+{
+   return d->raw->GetTriggerCell();
+}
+
+/*------------------------------------------------------------------*/
+
+unsigned long long drs4_trigger_time_ns(DRS4_DAQ *d)
+{
+   return d->trigger_ns;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_acquire(DRS4_DAQ *d, int n, int input_mask, float *wave, float *time,
+                 unsigned long long *timestamp_ns, int timeout_ms)
+{
+   const int size = DRS4DAQ_INPUTS * DRS4DAQ_BINS;
+   int i;
+
+   d->abort = 0;
+   for (i = 0; i < n && !d->abort; i++) {
+      d->board->StartDomino();
+      if (!drs4_wait(d, timeout_ms))
+         break;
+      if (drs4_transfer(d) < 0)
+         return i > 0 ? i : -1;
+      drs4_decode(d, input_mask, wave ? wave + i * size : NULL, time ? time + i * size : NULL);
+      if (timestamp_ns)
+         timestamp_ns[i] = d->trigger_ns;
+   }
+
+   return i;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_set_live(DRS4_DAQ *d, int flag)
+{
+   /* not while another thread uses the board or the live event */
+   if (flag && d->live == NULL)
+      d->live = new EventSlot(1, DRS4DAQ_INPUTS, DRS4DAQ_BINS);
+   else if (!flag) {
+      delete d->live;
+      d->live = NULL;
+   }
+
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int drs4_live_event(DRS4_DAQ *d, const float **wave, const float **time, unsigned int *serial,
+                    unsigned long long *trigger_ns)
+{
+   const EVSLOT_EVENT *e;
+   bool updated;
+
+   if (d->live == NULL)
+      return drs4_set_error(d, "live event not enabled, see drs4_set_live()");
+
+   e = d->live->GetLatest(&updated);
+   if (e == NULL)
+      return drs4_set_error(d, "no event decoded yet");
+
+   if (wave)
+      *wave = e->wave;
+   if (time)
+      *time = e->time;
+   if (serial)
+      *serial = e->serial;
+   if (trigger_ns)
+      *trigger_ns = e->trigger_ns;
+
+   return updated ? 1 : 0;
+}
+
+/*------------------------------------------------------------------*/
+
+void drs4_abort(DRS4_DAQ *d)
+{
+   /* from another thread, ends drs4_wait() and drs4_acquire() */
+   d->abort = 1;
+}
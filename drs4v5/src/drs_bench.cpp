@@ -0,0 +1,395 @@
+/********************************************************************\
+
+  Name:         drs_bench.cpp
+
+  Contents:     Micro-benchmarks for the decode, calibration, timing
+                and analysis kernels. Runs on synthetic buffers and
+                needs no hardware, so it can be used to compare
+                changes on these hot paths.
+
+                Usage: drs_bench [-n iterations] [-d directory]
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+
+#include "DRS.h"
+#include <DRS4v5_lib.h>
+#include "daqtimer.h"
+#include "rawevent.h"
+#include "spikes.h"
+#include "persist.h"
+
+#define N_CHANNELS 4        // inputs used in muonDet, DRS channels 0,2,4,6
+#define N_FILE_EVENTS 100   // events in the synthetic drsosc file
+#define N_SPIKE_BATCH 16    // events per SpikeRemover batch
+
+/*------------------------------------------------------------------*/
+
+/* count heap allocations done through operator new */
+
+static unsigned long long n_alloc = 0;
+
+void *operator new(size_t size)
+{
+   n_alloc++;
+   void *p = malloc(size ? size : 1);
+   if (p == NULL)
+      throw std::bad_alloc();
+   return p;
+}
+
+void *operator new[](size_t size)
+{
+   return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+   free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+   free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+   free(p);
+}
+
+/*------------------------------------------------------------------*/
+
+/* deterministic pseudo random numbers, so runs are comparable */
+
+static unsigned int bench_seed = 12345;
+
+static unsigned int bench_rand()
+{
+   bench_seed = bench_seed * 1103515245 + 12345;
+   return (bench_seed >> 16) & 0x7FFF;
+}
+
+/*------------------------------------------------------------------*/
+
+/* board with synthetic calibration and waveform buffer */
+
+class BenchBoard : public DRSBoard {
+public:
+   BenchBoard() : DRSBoard(9, 0) {}
+
+   void Setup(int triggerCell)
+   {
+      int i, j, k;
+
+      fNominalFrequency = 5.12;
+      fTimingCalibratedFrequency = 5.12;
+      fVoltageCalibrationValid = true;
+      fStopCell[0] = triggerCell;
+
+      for (i = 0; i < kNumberOfChipsMax * kNumberOfChannelsMax; i++)
+         for (j = 0; j < kNumberOfBins; j++) {
+            fCellOffset[i][j] = 30000 + bench_rand() % 2000;
+            fCellGain[i][j] = 0.95 + 0.1 * bench_rand() / 32768.0;
+            fCellOffset2[i][j] = 32768 - 100 + bench_rand() % 200;
+         }
+      for (i = 0; i < kNumberOfChipsMax; i++)
+         for (j = 0; j < kNumberOfChannelsMax; j++)
+            for (k = 0; k < kNumberOfBins; k++)
+               fCellDT[i][j][k] = (0.9 + 0.2 * bench_rand() / 32768.0) / 5.12;
+
+      /* baseline noise plus a negative pulse on every input, 16-bit little endian as in TR_USB2 */
+      for (i = 0; i < N_CHANNELS; i++)
+         for (j = 0; j < kNumberOfBins; j++) {
+            unsigned short v = 32768 + bench_rand() % 64;
+            if (j > 400 && j < 440)
+               v -= 8000;
+            unsigned char *p = fWaveforms + kNumberOfBins * 2 * (2 * i) + j * 2;
+            p[0] = v & 0xFF;
+            p[1] = v >> 8;
+         }
+   }
+
+   unsigned char *GetBuffer() { return fWaveforms; }
+};
+
+/*------------------------------------------------------------------*/
+
+static BenchBoard bench_board;
+static int bench_tc = 517;
+static unsigned short bench_adc[N_CHANNELS][kNumberOfBins];
+static short bench_wfs[N_CHANNELS][kNumberOfBins];
+static short bench_spike_src[N_CHANNELS][kNumberOfBins];
+static short bench_spike_batch[N_SPIKE_BATCH][N_CHANNELS][kNumberOfBins];
+static SpikeRemover bench_spike_remover;
+static float bench_wave[8][kNumberOfBins];
+static float bench_time[8][kNumberOfBins];
+static double bench_energy;
+static double *bench_get_events_buffer;
+static char bench_drsosc_file[1000];
+static char bench_event_file[1000];
+static DRS_EVENT bench_event[1];
+static DRSRawEvent bench_raw(&bench_board);
+static PersistenceMap bench_persist(512, 0, 200, 256, -500, 500);
+
+typedef void (*BenchFunc)();
+
+/*------------------------------------------------------------------*/
+
+static void bench_decode()
+{
+   for (int i = 0; i < N_CHANNELS; i++)
+      bench_board.DecodeWave(0, 2 * i, bench_adc[i]);
+}
+
+static void bench_calibrate()
+{
+   for (int i = 0; i < N_CHANNELS; i++)
+      bench_board.CalibrateWaveform(0, 2 * i, bench_adc[i], bench_wfs[i], true, bench_tc, false, 0, true);
+}
+
+static void bench_get_wave_short()
+{
+   for (int i = 0; i < N_CHANNELS; i++)
+      bench_board.GetWave(0, 2 * i, bench_wfs[i], true, bench_tc);
+}
+
+static void bench_get_wave_float()
+{
+   for (int i = 0; i < N_CHANNELS; i++)
+      bench_board.GetWave(0, 2 * i, bench_wave[i]);
+}
+
+static void bench_get_time()
+{
+   for (int i = 0; i < N_CHANNELS; i++)
+      bench_board.GetTime(0, 2 * i, bench_tc, bench_time[i]);
+}
+
+static void bench_raw_event()
+{
+   /* what adc_mode does for a not saved event: one channel with its time axis */
+   bench_raw.Attach(bench_board.GetBuffer(), bench_tc);
+   bench_energy += get_channel_energy(bench_raw.GetWave(6), bench_raw.GetTime(6), -40, 10, 50, 5.12);
+}
+
+static void bench_spikes()
+{
+   short *wf[N_CHANNELS];
+
+   /* RemoveSymmetricSpikes works in place, restore input every call */
+   memcpy(bench_wfs, bench_spike_src, sizeof(bench_wfs));
+   for (int i = 0; i < N_CHANNELS; i++)
+      wf[i] = bench_wfs[i];
+   DRSBoard::RemoveSymmetricSpikes(wf, N_CHANNELS, 20, 2, 1000, 0, 3);
+}
+
+static void bench_spikes_batch()
+{
+   /* same events in one contiguous buffer, restored every call */
+   for (int i = 0; i < N_SPIKE_BATCH; i++)
+      memcpy(bench_spike_batch[i], bench_spike_src, sizeof(bench_spike_src));
+   bench_spike_remover.Process(&bench_spike_batch[0][0][0], N_CHANNELS, N_SPIKE_BATCH);
+}
+
+static void bench_raw_event_spikes()
+{
+   /* adc_mode with spike removal: all inputs calibrated and cleaned for one channel */
+   bench_raw.SetSpikeRemover(&bench_spike_remover);
+   bench_raw.Attach(bench_board.GetBuffer(), bench_tc);
+   bench_energy += get_channel_energy(bench_raw.GetWave(6), bench_raw.GetTime(6), -40, 10, 50, 5.12);
+   bench_raw.SetSpikeRemover(NULL);
+}
+
+static void bench_persistence()
+{
+   for (int i = 0; i < N_CHANNELS; i++)
+      bench_persist.Fill(0, bench_time[i], bench_wave[i], kNumberOfBins);
+}
+
+static void bench_get_energy()
+{
+   bench_energy += get_energy(bench_wave, bench_time, 2, -40, 10, 50, 5.12);
+}
+
+static void bench_get_events()
+{
+   get_events(bench_drsosc_file, bench_get_events_buffer, 0, N_FILE_EVENTS - 1, false);
+}
+
+static void bench_save_event()
+{
+   save_event_binary(bench_event_file, bench_event, 1);
+}
+
+/*------------------------------------------------------------------*/
+
+static void run_bench(const char *name, BenchFunc func, int nIter, int eventsPerCall, int samplesPerEvent)
+{
+   int i;
+   unsigned long long allocs;
+   uint64_t t;
+   double events, ns;
+
+   /* warm up caches and lazy initialization */
+   for (i = 0; i < nIter / 10 + 1; i++)
+      func();
+
+   allocs = n_alloc;
+   t = daq_time_ns();
+   for (i = 0; i < nIter; i++)
+      func();
+   t = daq_time_ns() - t;
+   allocs = n_alloc - allocs;
+
+   events = (double) nIter * eventsPerCall;
+   ns = (double) t;
+   printf("%-22s %10.0lf %12.1lf %10.3lf %12.0lf %12.2lf\n", name, events, ns / events,
+          ns / (events * samplesPerEvent), events * 1E9 / ns, allocs / events);
+}
+
+/*------------------------------------------------------------------*/
+
+static int write_drsosc_file(const char *filename, int nEvents)
+{
+   FHEADER fh;
+   THEADER th;
+   BHEADER bh;
+   EHEADER eh;
+   TCHEADER tch;
+   CHEADER ch;
+   unsigned int scaler = 1000;
+   unsigned short voltage[kNumberOfBins];
+   float bin_width[kNumberOfBins];
+   int i, j, n;
+
+   FILE *f = fopen(filename, "wb");
+   if (f == NULL) {
+      printf("Cannot open file \"%s\"\n", filename);
+      return 0;
+   }
+
+   memcpy(fh.tag, "DRS", 3);
+   fh.version = '2';
+   fwrite(&fh, sizeof(fh), 1, f);
+   memcpy(th.time_header, "TIME", 4);
+   fwrite(&th, sizeof(th), 1, f);
+   memcpy(bh.bn, "B#", 2);
+   bh.board_serial_number = 0;
+   fwrite(&bh, sizeof(bh), 1, f);
+   for (i = 0; i < N_CHANNELS; i++) {
+      ch.c[0] = 'C';
+      ch.cn[0] = '0';
+      ch.cn[1] = '0';
+      ch.cn[2] = '1' + i;
+      fwrite(&ch, sizeof(ch), 1, f);
+      for (j = 0; j < kNumberOfBins; j++)
+         bin_width[j] = (0.9 + 0.2 * bench_rand() / 32768.0) / 5.12;
+      fwrite(bin_width, sizeof(float), kNumberOfBins, f);
+   }
+
+   memset(&eh, 0, sizeof(eh));
+   memcpy(eh.event_header, "EHDR", 4);
+   memcpy(tch.tc, "T#", 2);
+   for (n = 0; n < nEvents; n++) {
+      eh.event_serial_number = n;
+      fwrite(&eh, sizeof(eh), 1, f);
+      fwrite(&bh, sizeof(bh), 1, f);
+      tch.trigger_cell = bench_rand() % kNumberOfBins;
+      fwrite(&tch, sizeof(tch), 1, f);
+      for (i = 0; i < N_CHANNELS; i++) {
+         ch.cn[2] = '1' + i;
+         fwrite(&ch, sizeof(ch), 1, f);
+         fwrite(&scaler, sizeof(scaler), 1, f);
+         for (j = 0; j < kNumberOfBins; j++)
+            voltage[j] = 32768 + bench_rand() % 64;
+         fwrite(voltage, sizeof(short), kNumberOfBins, f);
+      }
+   }
+
+   fclose(f);
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   int i, nIter = 10000;
+   const char *dir = "/tmp";
+
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-' && i + 1 < argc) {
+         if (argv[i][1] == 'n')
+            nIter = atoi(argv[++i]);
+         else if (argv[i][1] == 'd')
+            dir = argv[++i];
+         else
+            goto usage;
+      } else {
+ usage:
+         printf("usage: drs_bench [-n iterations] [-d directory]\n");
+         return 1;
+      }
+   }
+   if (nIter < 1)
+      nIter = 1;
+
+   bench_board.Setup(bench_tc);
+
+   /* inputs for kernels which do not decode themselves */
+   for (i = 0; i < N_CHANNELS; i++) {
+      bench_board.DecodeWave(0, 2 * i, bench_adc[i]);
+      bench_board.GetWave(0, 2 * i, bench_spike_src[i], true, bench_tc, -1, true);
+      bench_board.GetWave(0, 2 * i, bench_wave[i]);
+      bench_board.GetTime(0, 2 * i, bench_tc, bench_time[i]);
+   }
+
+   snprintf(bench_drsosc_file, sizeof(bench_drsosc_file), "%s/drs_bench_drsosc.dat", dir);
+   snprintf(bench_event_file, sizeof(bench_event_file), "%s/drs_bench_events.dat", dir);
+   if (!write_drsosc_file(bench_drsosc_file, N_FILE_EVENTS))
+      return 1;
+   bench_get_events_buffer = (double *) malloc(sizeof(double) * N_FILE_EVENTS * N_CHANNELS * kNumberOfBins * 2);
+
+   memcpy(bench_event[0].eheader.event_header, "muT", 4);
+   for (i = 0; i < N_CHANNELS; i++) {
+      bench_event[0].time.push_back(bench_time[i]);
+      bench_event[0].waveform.push_back(bench_wave[i]);
+   }
+   remove(bench_event_file);
+
+   printf("%-22s %10s %12s %10s %12s %12s\n", "Kernel", "Events", "ns/event", "ns/sample", "events/s",
+          "allocs/event");
+
+   run_bench("DecodeWave", bench_decode, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("CalibrateWaveform", bench_calibrate, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("GetWave(short)", bench_get_wave_short, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("GetWave(float)", bench_get_wave_float, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("GetTime", bench_get_time, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("DRSRawEvent(1 ch)", bench_raw_event, nIter, 1, kNumberOfBins);
+   run_bench("RemoveSymmetricSpikes", bench_spikes, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("SpikeRemover(batch)", bench_spikes_batch, nIter / N_SPIKE_BATCH + 1, N_SPIKE_BATCH,
+             N_CHANNELS * kNumberOfBins);
+   run_bench("DRSRawEvent(spikes)", bench_raw_event_spikes, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("PersistenceMap", bench_persistence, nIter, 1, N_CHANNELS * kNumberOfBins);
+   run_bench("get_energy", bench_get_energy, nIter, 1, kNumberOfBins);
+   run_bench("get_events", bench_get_events, nIter / N_FILE_EVENTS + 1, N_FILE_EVENTS,
+             N_CHANNELS * kNumberOfBins);
+   run_bench("save_event_binary", bench_save_event, nIter / 10 + 1, 1, N_CHANNELS * kNumberOfBins);
+
+   remove(bench_drsosc_file);
+   remove(bench_event_file);
+   free(bench_get_events_buffer);
+
+   return 0;
+}
@@ -0,0 +1,559 @@
+/********************************************************************\
+
+  Name:         evjournal.cpp
+
+  Contents:     Crash safe writing and recovery scan of muonDet
+                events.dat files, each event record closed by a
+                trailer with its length, sequence number and CRC-32C
+
+                A record is the old events.dat event (EHEADER, XHEADER,
+                number of channels, time and waveform per channel)
+                with EHEADER_FLAG_TRAILER set and an ETRAILER behind
+                it. All records of a file still have the same size,
+                so readers seeking by event number keep working.
+
+                Each record is assembled in memory and written with a
+                single append, so the file is always a sequence of
+                complete records followed by at most one torn record.
+                Writeback of the written range is started every few
+                MB without waiting for it, which bounds the data lost
+                on a power cut without adding dead time.
+
+                Scan() checks the records at disk speed with large
+                sequential reads. It finds the end of the valid part,
+                optionally resynchronizes past corrupt regions, and
+                builds the index written by evrecover.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include "evjournal.h"
+#include "crc32c.h"
+#include "daqtimer.h"
+
+#define EVJ_SCAN_BUFFER   (8 * 1024 * 1024)
+#define EVJ_VERIFY_BLOCK  (16 * 1024 * 1024)   // read per thread and step
+
+/*------------------------------------------------------------------*/
+
+static bool evj_is_record_start(const unsigned char *p)
+{
+   return p[0] == 'm' && p[1] == 'u' && p[2] == 'T' && (p[3] & EHEADER_FLAG_TRAILER);
+}
+
+/*------------------------------------------------------------------*/
+
+/* 1: valid record of *length bytes, 0: invalid, -1: more data needed */
+static int evj_check_record(const unsigned char *p, size_t n, unsigned int sequence, bool anySequence,
+                            size_t *length, const char **reason = NULL)
+{
+   const EHEADER *eh = (const EHEADER *) p;
+   const char *dummy;
+   ETRAILER tr;
+   size_t head, len;
+   int channels;
+
+   if (reason == NULL)
+      reason = &dummy;
+   *reason = "torn record";
+   if (n < sizeof(EHEADER))
+      return -1;
+   if (!evj_is_record_start(p)) {
+      *reason = "no event header";
+      return 0;
+   }
+
+   head = sizeof(EHEADER) + ((eh->event_header[3] & EHEADER_FLAG_XHEADER) ? sizeof(XHEADER) : 0);
+   if (n < head + sizeof(int))
+      return -1;
+   memcpy(&channels, p + head, sizeof(int));
+   if (channels < 1 || channels > EVJ_MAX_CHANNELS) {
+      *reason = "bad number of channels";
+      return 0;
+   }
+
+   len = EventJournal::RecordSize(eh, channels);
+   if (n < len)
+      return -1;
+
+   memcpy(&tr, p + len - sizeof(ETRAILER), sizeof(ETRAILER));
+   if (memcmp(tr.tag, "ETRL", 4) != 0 || tr.length != len) {
+      *reason = "bad trailer";
+      return 0;
+   }
+   if (!anySequence && tr.sequence != sequence) {
+      *reason = "sequence number out of order";
+      return 0;
+   }
+   if (crc32c(0, p, len - sizeof(tr.crc)) != tr.crc) {
+      *reason = "CRC mismatch";
+      return 0;
+   }
+
+   *length = len;
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+EventJournal::EventJournal()
+:  fFd(-1)
+    , fBuffer(NULL)
+    , fBufferSize(0)
+    , fSequence(0)
+    , fBytes(0)
+    , fFlushed(0)
+    , fFlushBytes(8 * 1024 * 1024)
+    , fRecovered(0)
+{
+}
+
+/*------------------------------------------------------------------*/
+
+EventJournal::~EventJournal()
+{
+   Close();
+   free(fBuffer);
+}
+
+/*------------------------------------------------------------------*/
+
+size_t EventJournal::RecordSize(const EHEADER *eh, int channels)
+{
+   return sizeof(EHEADER) + ((eh->event_header[3] & EHEADER_FLAG_XHEADER) ? sizeof(XHEADER) : 0) +
+          sizeof(int) + (size_t) channels * 2 * EVJ_BINS * sizeof(float) + sizeof(ETRAILER);
+}
+
+/*------------------------------------------------------------------*/
+
+int EventJournal::Open(const char *filename)
+{
+   EVJ_SCAN scan;
+   EHEADER eh;
+   FILE *f;
+
+   Close();
+   fRecovered = 0;
+
+   /* continue an existing journal after its last complete record */
+   if (!Scan(filename, &scan, true)) {
+      scan.valid_bytes = scan.file_bytes = 0;
+      scan.next_sequence = 0;
+   }
+   if (scan.valid_bytes > scan.first_bad) {
+      printf("\"%s\" has corrupt records, not appended, see evrecover\n", filename);
+      return 0;
+   }
+   if (scan.valid_bytes < scan.file_bytes) {
+      if (scan.records == 0) {
+         f = fopen(filename, "rb");
+         if (f == NULL || fread(&eh, sizeof(eh), 1, f) != 1 || !evj_is_record_start((unsigned char *) &eh)) {
+            if (f)
+               fclose(f);
+            if (scan.file_bytes >= sizeof(EHEADER)) {
+               printf("\"%s\" is not an event journal, not appended\n", filename);
+               return 0;
+            }
+         } else
+            fclose(f);
+      }
+      if (truncate(filename, scan.valid_bytes) < 0) {
+         printf("Cannot truncate torn record of \"%s\": %s\n", filename, strerror(errno));
+         return 0;
+      }
+      fRecovered = scan.file_bytes - scan.valid_bytes;
+      printf("Removed torn record of %llu bytes at the end of \"%s\"\n", fRecovered, filename);
+   }
+
+   fFd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+   if (fFd < 0) {
+      printf("Cannot open \"%s\": %s\n", filename, strerror(errno));
+      return 0;
+   }
+   fSequence = scan.next_sequence;
+   fBytes = fFlushed = scan.valid_bytes;
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+void EventJournal::Close(bool sync)
+{
+   if (fFd < 0)
+      return;
+   if (sync)
+      fdatasync(fFd);
+   close(fFd);
+   fFd = -1;
+}
+
+/*------------------------------------------------------------------*/
+
+int EventJournal::Append(const EHEADER *eh, const XHEADER *xh, int channels,
+                         float *const *time, float *const *wave)
+{
+   const size_t wsize = EVJ_BINS * sizeof(float);
+   size_t len, done;
+   unsigned char *p;
+   ETRAILER tr;
+   ssize_t n;
+   int i;
+
+   if (fFd < 0 || channels < 1 || channels > EVJ_MAX_CHANNELS)
+      return 0;
+
+   len = RecordSize(eh, channels);
+   if (len > fBufferSize) {
+      free(fBuffer);
+      fBuffer = (unsigned char *) malloc(len);
+      fBufferSize = fBuffer ? len : 0;
+      if (fBuffer == NULL)
+         return 0;
+   }
+
+   /* same layout as save_event_binary(), plus the trailer */
+   p = fBuffer;
+   memcpy(p, eh, sizeof(EHEADER));
+   ((EHEADER *) p)->event_header[3] |= EHEADER_FLAG_TRAILER;
+   p += sizeof(EHEADER);
+   if (eh->event_header[3] & EHEADER_FLAG_XHEADER) {
+      memcpy(p, xh, sizeof(XHEADER));
+      p += sizeof(XHEADER);
+   }
+   memcpy(p, &channels, sizeof(int));
+   p += sizeof(int);
+   for (i = 0; i < channels; i++) {
+      memcpy(p, time[i], wsize);
+      p += wsize;
+      memcpy(p, wave[i], wsize);
+      p += wsize;
+   }
+   memcpy(tr.tag, "ETRL", 4);
+   tr.length = (unsigned int) len;
+   tr.sequence = fSequence;
+   memcpy(p, &tr, sizeof(ETRAILER));
+   tr.crc = crc32c(0, fBuffer, len - sizeof(tr.crc));
+   memcpy(p + sizeof(ETRAILER) - sizeof(tr.crc), &tr.crc, sizeof(tr.crc));
+
+   for (done = 0; done < len; done += n) {
+      n = write(fFd, fBuffer + done, len - done);
+      if (n < 0) {
+         if (errno == EINTR) {
+            n = 0;
+            continue;
+         }
+         printf("Event journal write error: %s\n", strerror(errno));
+         return 0;
+      }
+   }
+   fSequence++;
+   fBytes += len;
+
+#ifdef OS_LINUX
+   /* start writeback, does not wait for the disk */
+   if (fFlushBytes && fBytes - fFlushed >= fFlushBytes) {
+      sync_file_range(fFd, fFlushed, fBytes - fFlushed, SYNC_FILE_RANGE_WRITE);
+      fFlushed = fBytes;
+   }
+#endif
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int EventJournal::Scan(const char *filename, EVJ_SCAN *result, bool salvage, std::vector<EVJ_INDEX> *index)
+{
+   unsigned char *buf;
+   unsigned long long pos;         // file offset of buf[0]
+   unsigned long long badStart;
+   size_t start, end, len;
+   bool eof, bad, resync;
+   EVJ_INDEX entry;
+   uint64_t t0;
+   struct stat st;
+   const EHEADER *eh;
+   XHEADER xh;
+   ssize_t n;
+   int fd, status;
+
+   memset(result, 0, sizeof(EVJ_SCAN));
+   t0 = daq_time_ns();
+
+   fd = open(filename, O_RDONLY);
+   if (fd < 0)
+      return 0;
+   if (fstat(fd, &st) == 0)
+      result->file_bytes = st.st_size;
+#ifdef OS_LINUX
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+   buf = (unsigned char *) malloc(EVJ_SCAN_BUFFER);
+   if (buf == NULL) {
+      close(fd);
+      return 0;
+   }
+
+   result->first_bad = result->file_bytes;
+   pos = badStart = 0;
+   start = end = 0;
+   eof = bad = resync = false;
+   for (;;) {
+      status = evj_check_record(buf + start, end - start, result->next_sequence, bad, &len);
+
+      if (status == 1) {
+         if (resync) {
+            result->skipped_bytes += pos + start - badStart;
+            resync = false;
+         }
+         eh = (const EHEADER *) (buf + start);
+         if (index) {
+            entry.offset = pos + start;
+            entry.serial = eh->event_serial_number;
+            entry.trigger_ns = 0;
+            if (eh->event_header[3] & EHEADER_FLAG_XHEADER) {
+               memcpy(&xh, buf + start + sizeof(EHEADER), sizeof(XHEADER));
+               entry.trigger_ns = xh.trigger_ns;
+            }
+            memcpy(&entry.sequence, buf + start + len - 2 * sizeof(unsigned int), sizeof(unsigned int));
+            index->push_back(entry);
+         }
+         memcpy(&result->next_sequence, buf + start + len - 2 * sizeof(unsigned int), sizeof(unsigned int));
+         result->next_sequence++;
+         result->records++;
+         start += len;
+         result->valid_bytes = pos + start;
+         continue;
+      }
+
+      if (status < 0 && !eof) {
+         /* keep the partial record, refill behind it */
+         memmove(buf, buf + start, end - start);
+         pos += start;
+         end -= start;
+         start = 0;
+         n = read(fd, buf + end, EVJ_SCAN_BUFFER - end);
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n <= 0)
+            eof = true;
+         else
+            end += n;
+         continue;
+      }
+
+      if (start == end && eof)
+         break;
+
+      /* invalid record, or torn record at the end of the file */
+      if (!bad) {
+         result->first_bad = pos + start;
+         bad = true;
+      }
+      if (!salvage)
+         break;
+      if (!resync) {
+         result->bad_regions++;
+         badStart = pos + start;
+         resync = true;
+      }
+
+      /* resynchronize on the next record start with a valid trailer */
+      for (start++; ; start++) {
+         if (end - start < 4) {
+            if (eof) {
+               start = end;
+               break;
+            }
+            memmove(buf, buf + start, end - start);
+            pos += start;
+            end -= start;
+            start = 0;
+            n = read(fd, buf + end, EVJ_SCAN_BUFFER - end);
+            if (n <= 0)
+               eof = true;
+            else
+               end += n;
+            continue;
+         }
+         if (evj_is_record_start(buf + start))
+            break;
+      }
+      if (start == end && eof)
+         break;
+   }
+   if (resync)
+      result->skipped_bytes += pos + end - badStart;
+
+   free(buf);
+   close(fd);
+   result->seconds = (daq_time_ns() - t0) / 1E9;
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int EventJournal::Verify(const char *filename, int nThreads, EVJ_VERIFY *result)
+{
+   /* all records of a file have the size of the first one, so the file
+      is cut into blocks of whole records which the threads take in
+      order, several reads are in flight at once as needed by SSDs */
+   unsigned long long nRecords, blockRecords, nBlocks;
+   std::atomic<unsigned long long> nextBlock(0), checked(0);
+   std::vector<std::thread> threads;
+   std::mutex mutex;
+   struct stat st;
+   EHEADER eh;
+   size_t len;
+   uint64_t t0;
+   int fd, i, channels;
+
+   memset(result, 0, sizeof(EVJ_VERIFY));
+   result->first_bad = -1;
+   t0 = daq_time_ns();
+
+   fd = open(filename, O_RDONLY);
+   if (fd < 0)
+      return 0;
+   if (fstat(fd, &st) < 0) {
+      close(fd);
+      return 0;
+   }
+   result->file_bytes = st.st_size;
+#ifdef OS_LINUX
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+   if (st.st_size == 0) {
+      close(fd);
+      return 1;
+   }
+
+   /* record size from the first record */
+   len = 0;
+   channels = 0;
+   if (pread(fd, &eh, sizeof(eh), 0) == (ssize_t) sizeof(eh) && evj_is_record_start((unsigned char *) &eh))
+      pread(fd, &channels, sizeof(int),
+            sizeof(EHEADER) + ((eh.event_header[3] & EHEADER_FLAG_XHEADER) ? sizeof(XHEADER) : 0));
+   if (channels < 1 || channels > EVJ_MAX_CHANNELS) {
+      result->first_bad = 0;
+      snprintf(result->error, sizeof(result->error), "%s", "no event journal record at the start");
+      close(fd);
+      result->seconds = (daq_time_ns() - t0) / 1E9;
+      return 1;
+   }
+   len = RecordSize(&eh, channels);
+   result->record_bytes = len;
+   nRecords = st.st_size / len;
+   blockRecords = EVJ_VERIFY_BLOCK / len + 1;
+   nBlocks = (nRecords + blockRecords - 1) / blockRecords;
+
+   if (nThreads < 1)
+      nThreads = 1;
+   if ((unsigned long long) nThreads > nBlocks)
+      nThreads = nBlocks > 0 ? (int) nBlocks : 1;
+   result->threads = nThreads;
+
+   for (i = 0; i < nThreads; i++)
+      threads.push_back(std::thread([&] {
+         unsigned char *buf = (unsigned char *) malloc(blockRecords * len);
+         unsigned long long b, r, first, n, done;
+         const char *why;
+         size_t l;
+         ssize_t got;
+
+         if (buf == NULL)
+            return;
+         for (;;) {
+            b = nextBlock++;
+            if (b >= nBlocks)
+               break;
+            first = b * blockRecords;
+            {
+               /* nothing to gain behind a corruption already found */
+               std::lock_guard<std::mutex> lock(mutex);
+               if (result->first_bad >= 0 && first > (unsigned long long) result->first_bad)
+                  break;
+            }
+            n = nRecords - first < blockRecords ? nRecords - first : blockRecords;
+            for (done = 0; done < n * len; done += got) {
+               got = pread(fd, buf + done, n * len - done, first * len + done);
+               if (got <= 0)
+                  break;
+            }
+            for (r = 0; r < n; r++) {
+               why = "read error";
+               if (done < (r + 1) * len ||
+                   evj_check_record(buf + r * len, len, (unsigned int) (first + r), false, &l, &why) != 1 ||
+                   l != len) {
+                  if (done >= (r + 1) * len && evj_check_record(buf + r * len, len, 0, true, &l) == 1)
+                     why = "record size differs from the first record";
+                  std::lock_guard<std::mutex> lock(mutex);
+                  if (result->first_bad < 0 || first + r < (unsigned long long) result->first_bad) {
+                     result->first_bad = first + r;
+                     snprintf(result->error, sizeof(result->error), "%s", why);
+                  }
+                  break;
+               }
+            }
+            checked += r;
+            if (r < n)
+               break;
+         }
+         free(buf);
+      }));
+   for (i = 0; i < nThreads; i++)
+      threads[i].join();
+
+   /* a partial record at the end is a torn write */
+   if (result->first_bad < 0 && (unsigned long long) st.st_size > nRecords * len) {
+      result->first_bad = nRecords;
+      snprintf(result->error, sizeof(result->error), "%s", "torn record at the end of the file");
+   }
+   result->records = result->first_bad < 0 ? nRecords : (unsigned long long) result->first_bad;
+   if (result->records > 0 && pread(fd, &eh, sizeof(eh), (result->records - 1) * len) == (ssize_t) sizeof(eh))
+      result->last_serial = eh.event_serial_number;
+   result->checked_bytes = checked * len;
+
+   close(fd);
+   result->seconds = (daq_time_ns() - t0) / 1E9;
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int EventJournal::WriteIndex(const char *filename, const std::vector<EVJ_INDEX> &index)
+{
+   EVJ_INDEX_HEADER h;
+   FILE *f;
+
+   f = fopen(filename, "wb");
+   if (f == NULL) {
+      printf("Cannot write index \"%s\": %s\n", filename, strerror(errno));
+      return 0;
+   }
+
+   memcpy(h.tag, "EIDX", 4);
+   h.version = EVJ_INDEX_VERSION;
+   h.size = sizeof(EVJ_INDEX);
+   h.records = (unsigned int) index.size();
+   fwrite(&h, sizeof(h), 1, f);
+   if (!index.empty())
+      fwrite(&index[0], sizeof(EVJ_INDEX), index.size(), f);
+   fclose(f);
+
+   return 1;
+}
@@ -0,0 +1,107 @@
+/********************************************************************\
+
+  Name:         evrecover.cpp
+
+  Contents:     Recovery of muonDet events.dat files after a crash or
+                power cut. Scans the event records, reports the last
+                valid one, writes an index of all valid records and
+                optionally cuts off the torn end of the file.
+
+                Usage: evrecover [-t] [-s] [-i index] events.dat
+
+                  -t  truncate the torn end of the file, not done if
+                      valid records follow a corrupt region
+                  -s  salvage, continue behind corrupt regions
+                  -i  index file, default <file>.idx
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "evjournal.h"
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   const char *filename = NULL;
+   std::string indexname;
+   bool trunc = false, salvage = false;
+   std::vector<EVJ_INDEX> index;
+   EVJ_SCAN scan;
+   int i;
+
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-') {
+         if (argv[i][1] == 't')
+            trunc = true;
+         else if (argv[i][1] == 's')
+            salvage = true;
+         else if (argv[i][1] == 'i' && i + 1 < argc)
+            indexname = argv[++i];
+         else
+            goto usage;
+      } else if (filename == NULL)
+         filename = argv[i];
+      else
+         goto usage;
+   }
+   if (filename == NULL) {
+ usage:
+      printf("usage: evrecover [-t] [-s] [-i index] events.dat\n");
+      return 1;
+   }
+   if (indexname.empty())
+      indexname = std::string(filename) + ".idx";
+
+   /* look behind a bad record before cutting anything off */
+   if (trunc)
+      salvage = true;
+
+   if (!EventJournal::Scan(filename, &scan, salvage, &index)) {
+      printf("Cannot read \"%s\"\n", filename);
+      return 1;
+   }
+
+   printf("%s: %llu bytes, %llu valid records", filename, scan.file_bytes, scan.records);
+   if (scan.seconds > 0)
+      printf(", scanned in %1.3lf s (%1.0lf MB/s)", scan.seconds, scan.file_bytes / scan.seconds / 1E6);
+   printf("\n");
+   if (scan.records == 0 && scan.file_bytes > 0)
+      printf("No records with trailer, file written before the journal format or not an events.dat\n");
+
+   if (scan.first_bad < scan.file_bytes) {
+      printf("First invalid record at offset %llu", scan.first_bad);
+      if (index.size() > 0)
+         printf(", last valid event #%u (sequence %u)", index.back().serial, index.back().sequence);
+      printf("\n");
+      if (salvage)
+         printf("%llu bad region(s), %llu bytes skipped\n", scan.bad_regions, scan.skipped_bytes);
+      else
+         printf("%llu bytes behind the last valid record\n", scan.file_bytes - scan.valid_bytes);
+   } else
+      printf("File is complete\n");
+
+   if (!EventJournal::WriteIndex(indexname.c_str(), index))
+      return 1;
+   printf("Index of %u records written to %s\n", (unsigned int) index.size(), indexname.c_str());
+
+   if (trunc && scan.valid_bytes < scan.file_bytes) {
+      if (scan.valid_bytes > scan.first_bad) {
+         printf("Not truncated, valid records follow the corrupt region\n");
+      } else if (scan.records == 0) {
+         printf("Not truncated, no valid record found\n");
+      } else if (truncate(filename, scan.valid_bytes) < 0) {
+         perror("truncate");
+         return 1;
+      } else
+         printf("Truncated to %llu bytes\n", scan.valid_bytes);
+   }
+
+   return 0;
+}
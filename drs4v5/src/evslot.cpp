@@ -0,0 +1,95 @@
+/********************************************************************\
+
+  Name:         evslot.cpp
+
+  Contents:     Triple buffered hand-off of the latest event from the
+                acquisition thread to a display thread, neither side
+                copies under a lock or waits for the other
+
+                Of the three event buffers the writer owns one (back),
+                the reader one (front) and the third (middle) holds
+                the latest complete event. Publish() swaps back and
+                middle with one atomic exchange and marks the middle
+                as new, GetLatest() swaps front and middle only if it
+                is new. The writer never waits, events published
+                faster than the reader looks are simply replaced, so
+                the display refreshes at its own rate.
+
+                One writer and one reader thread.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "evslot.h"
+
+#define EVSLOT_INDEX 0x3
+#define EVSLOT_NEW   0x4
+
+/*------------------------------------------------------------------*/
+
+EventSlot::EventSlot(int boards, int channels, int bins)
+:  fBoards(boards)
+    , fChannels(channels)
+    , fBins(bins)
+    , fMiddle(1)
+    , fBack(0)
+    , fFront(2)
+    , fPublished(0)
+    , fTaken(0)
+    , fHaveFront(false)
+{
+   size_t n;
+   int i;
+
+   if (fBoards < 1)
+      fBoards = 1;
+   if (fChannels < 1)
+      fChannels = 1;
+   if (fBins < 1)
+      fBins = 1;
+
+   n = (size_t) fBoards * fChannels * fBins;
+   fData.assign(6 * n, 0);
+   for (i = 0; i < 3; i++) {
+      memset(&fEvent[i], 0, sizeof(EVSLOT_EVENT));
+      fEvent[i].wave = &fData[(2 * i) * n];
+      fEvent[i].time = &fData[(2 * i + 1) * n];
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+EVSLOT_EVENT *EventSlot::BeginWrite()
+{
+   return &fEvent[fBack];
+}
+
+/*------------------------------------------------------------------*/
+
+void EventSlot::Publish()
+{
+   fEvent[fBack].serial = ++fPublished;
+
+   /* release: the event data is complete before the reader can take it */
+   fBack = fMiddle.exchange(fBack | EVSLOT_NEW, std::memory_order_acq_rel) & EVSLOT_INDEX;
+}
+
+/*------------------------------------------------------------------*/
+
+const EVSLOT_EVENT *EventSlot::GetLatest(bool *updated)
+{
+   bool n = false;
+
+   if (fMiddle.load(std::memory_order_relaxed) & EVSLOT_NEW) {
+      fFront = fMiddle.exchange(fFront, std::memory_order_acq_rel) & EVSLOT_INDEX;
+      fHaveFront = true;
+      fTaken++;
+      n = true;
+   }
+   if (updated)
+      *updated = n;
+
+   return fHaveFront ? &fEvent[fFront] : NULL;
+}
@@ -0,0 +1,88 @@
+/********************************************************************\
+
+  Name:         evverify.cpp
+
+  Contents:     Verification of muonDet runs, e.g. after copying them
+                to another machine. Every event record of events.dat
+                is checked for its structure, sequence number and
+                CRC-32C with several threads reading in parallel.
+
+                Usage: evverify [-j threads] run_directory|events.dat ...
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <string>
+#include <thread>
+
+#include "evjournal.h"
+#include "crc32c.h"
+
+/*------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+   int i, nThreads, nFiles = 0, nBad = 0;
+   unsigned long long bytes = 0;
+   double seconds = 0;
+   std::string filename;
+   EVJ_VERIFY v;
+   struct stat st;
+
+   nThreads = std::thread::hardware_concurrency();
+   if (nThreads < 1)
+      nThreads = 4;
+
+   for (i = 1; i < argc; i++) {
+      if (argv[i][0] == '-') {
+         if (argv[i][1] == 'j' && i + 1 < argc)
+            nThreads = atoi(argv[++i]);
+         else
+            goto usage;
+         continue;
+      }
+      nFiles++;
+
+      /* a run directory stands for its events.dat */
+      filename = argv[i];
+      if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+         filename += "/events.dat";
+
+      if (!EventJournal::Verify(filename.c_str(), nThreads, &v)) {
+         printf("%s: cannot read\n", filename.c_str());
+         nBad++;
+         continue;
+      }
+      bytes += v.checked_bytes;
+      seconds += v.seconds;
+
+      printf("%s: %llu events, %1.1lf MB in %1.3lf s", filename.c_str(), v.records, v.file_bytes / 1E6, v.seconds);
+      if (v.seconds > 0)
+         printf(" (%1.0lf MB/s)", v.checked_bytes / v.seconds / 1E6);
+      if (v.first_bad < 0)
+         printf(", OK\n");
+      else {
+         printf("\n   first corrupted event #%lld at offset %llu: %s", v.first_bad,
+                (unsigned long long) v.first_bad * v.record_bytes, v.error);
+         if (v.records > 0)
+            printf(", last good event serial %u", v.last_serial);
+         printf("\n");
+         nBad++;
+      }
+   }
+   if (nFiles == 0) {
+ usage:
+      printf("usage: evverify [-j threads] run_directory|events.dat ...\n");
+      return 1;
+   }
+
+   printf("\n%d file(s), %d corrupted, %1.1lf MB checked", nFiles, nBad, bytes / 1E6);
+   if (seconds > 0)
+      printf(" at %1.0lf MB/s", bytes / seconds / 1E6);
+   printf(", %d threads, CRC-32C %s\n", nThreads, crc32c_implementation());
+
+   return nBad ? 2 : 0;
+}
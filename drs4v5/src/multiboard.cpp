@@ -0,0 +1,314 @@
+/********************************************************************\
+
+  Name:         multiboard.cpp
+
+  Contents:     Synchronized acquisition of several DRS4 boards with
+                one readout thread per board and an event builder
+
+                Board 0 is the master, all other boards are slaves
+                in the daisy chain and trigger on EXT. Every cycle the
+                slaves are armed first, the master is armed only when
+                all slaves wait for its trigger, so that no slave can
+                miss a trigger distributed by the master.
+
+                Each readout thread pushes fragments (raw waveform
+                buffer, trigger cell, trigger bus, timestamp) into its
+                own bounded queue. The event builder takes one fragment
+                per board and matches them on their trigger number,
+                which the arming order keeps equal on all boards.
+                Host timestamps further apart than the tolerance are
+                only counted, they also show scheduling and USB
+                latency. Fragments with different trigger bus values
+                are not built into an event.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "multiboard.h"
+#include "daqtimer.h"
+
+/*------------------------------------------------------------------*/
+
+DRSMultiBoard::DRSMultiBoard(DRS *drs, int queueDepth)
+:  fDRS(drs)
+    , fNumberOfBoards(drs->GetNumberOfBoards())
+    , fEvents(0)
+    , fRunning(false)
+    , fBuilt(0)
+    , fBusMismatch(0)
+    , fTimeMismatch(0)
+    , fTolerance(5000000)
+    , fReadTriggerBus(true)
+{
+   int i;
+
+   for (i = 0; i < fNumberOfBoards; i++) {
+      fBoard.push_back(drs->GetBoard(i));
+      fQueue.push_back(new DRSRing<DRSFragment>(queueDepth));
+   }
+   fEvents = new DRSRing<DRSMultiEvent>(queueDepth / 4 + 1);
+
+   fArmed = new std::atomic<uint64_t>[fNumberOfBoards];
+   fStalls = new std::atomic<unsigned long long>[fNumberOfBoards];
+   fFragments = new std::atomic<unsigned long long>[fNumberOfBoards];
+   fDiscarded = new std::atomic<unsigned long long>[fNumberOfBoards];
+   for (i = 0; i < fNumberOfBoards; i++)
+      fArmed[i] = fStalls[i] = fFragments[i] = fDiscarded[i] = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+DRSMultiBoard::~DRSMultiBoard()
+{
+   Stop();
+
+   for (int i = 0; i < fNumberOfBoards; i++)
+      delete fQueue[i];
+   delete fEvents;
+   delete[] fArmed;
+   delete[] fStalls;
+   delete[] fFragments;
+   delete[] fDiscarded;
+}
+
+/*------------------------------------------------------------------*/
+
+int DRSMultiBoard::ConfigureDaisyChain(int masterTriggerSource)
+{
+   // Trigger configuration as in SetTriggerSource()
+   // OR  Bit0=CH1, Bit1=CH2,  Bit2=CH3,  Bit3=CH4,  Bit4=EXT
+   // AND Bit8=CH1, Bit9=CH2, Bit10=CH3, Bit11=CH4, Bit12=EXT
+   int i;
+
+   for (i = 0; i < fNumberOfBoards; i++) {
+      if (fBoard[i]->GetBoardType() < 8) {
+         printf("Board #%d (serial %d) cannot be used in a daisy chain\n", i, fBoard[i]->GetBoardSerialNumber());
+         return 0;
+      }
+   }
+
+   for (i = 0; i < fNumberOfBoards; i++) {
+      fBoard[i]->EnableTrigger(1, 0);
+      if (i == 0)
+         fBoard[i]->SetTriggerSource(masterTriggerSource);
+      else
+         fBoard[i]->SetTriggerSource(1 << 4);  // EXT from master
+   }
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int DRSMultiBoard::Start()
+{
+   int i;
+
+   if (fRunning || fNumberOfBoards == 0)
+      return 0;
+
+   for (i = 0; i < fNumberOfBoards; i++) {
+      fQueue[i]->Reset();
+      fArmed[i] = fStalls[i] = fFragments[i] = fDiscarded[i] = 0;
+   }
+   fEvents->Reset();
+   fBuilt = fBusMismatch = fTimeMismatch = 0;
+
+   fRunning = true;
+   for (i = 0; i < fNumberOfBoards; i++)
+      fThread.push_back(std::thread(&DRSMultiBoard::ReadoutLoop, this, i));
+   fThread.push_back(std::thread(&DRSMultiBoard::BuilderLoop, this));
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSMultiBoard::Stop()
+{
+   int i;
+
+   if (fThread.empty())
+      return;
+
+   fRunning = false;
+   for (i = 0; i < fNumberOfBoards; i++)
+      fQueue[i]->Stop();
+   fEvents->Stop();
+
+   for (i = 0; i < (int) fThread.size(); i++)
+      fThread[i].join();
+   fThread.clear();
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSMultiBoard::ReadoutLoop(int board)
+{
+   DRSBoard *b = fBoard[board];
+   DRSFragment *frag;
+   uint64_t cycle, ts;
+   int i;
+
+   for (cycle = 0; fRunning; cycle++) {
+
+      /* master waits until all slaves are armed for this cycle */
+      if (board == 0)
+         for (i = 1; i < fNumberOfBoards; i++)
+            while (fRunning && fArmed[i] <= cycle)
+               std::this_thread::yield();
+      if (!fRunning)
+         break;
+
+      b->StartDomino();
+      fArmed[board] = cycle + 1;
+
+      while (fRunning && b->IsBusy());
+      if (!fRunning)
+         break;
+      ts = daq_time_ns();
+
+      if (fQueue[board]->IsFull())
+         fStalls[board]++;
+      frag = fQueue[board]->BeginWrite();
+      if (frag == NULL)
+         break;
+
+      b->TransferWaves(frag->fData, 0, 8);
+      frag->fBoard = board;
+      frag->fSerial = b->GetBoardSerialNumber();
+      frag->fNumber = (unsigned int) cycle;
+      frag->fTimestamp = ts;
+      frag->fTriggerCell = b->GetStopCell(0);
+      frag->fTriggerBus = fReadTriggerBus ? b->GetTriggerBus() : 0;
+
+      fQueue[board]->EndWrite();
+      fFragments[board]++;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSMultiBoard::BuilderLoop()
+{
+   std::vector<DRSFragment *> head(fNumberOfBoards, (DRSFragment *) NULL);
+   DRSMultiEvent *event;
+   int i, low;
+   int64_t n, n0, dt;
+   bool bus;
+
+   for (;;) {
+      /* wait for one fragment of every board */
+      for (i = 0; i < fNumberOfBoards; i++)
+         while (head[i] == NULL) {
+            head[i] = fQueue[i]->BeginRead(100);
+            if (head[i] == NULL && !fRunning)
+               return;
+         }
+
+      /* fragments of one trigger carry the same trigger number, a
+         fragment with a lower number than the others lost its partners */
+      n0 = head[0]->fNumber;
+      for (i = 1, low = -1; i < fNumberOfBoards; i++) {
+         n = (int64_t) head[i]->fNumber;
+         if (n < n0) {
+            low = i;
+            break;
+         }
+         if (n > n0) {
+            low = 0;
+            break;
+         }
+      }
+      if (low >= 0) {
+         fQueue[low]->EndRead();
+         head[low] = NULL;
+         fDiscarded[low]++;
+         continue;
+      }
+
+      /* host timestamps include readout jitter, diagnostic only */
+      for (i = 1; i < fNumberOfBoards; i++) {
+         dt = (int64_t) (head[i]->fTimestamp - head[0]->fTimestamp);
+         if (dt < -(int64_t) fTolerance || dt > (int64_t) fTolerance) {
+            fTimeMismatch++;
+            break;
+         }
+      }
+
+      /* trigger bus as a further check, such an event is not built */
+      for (i = 1, bus = true; i < fNumberOfBoards && fReadTriggerBus; i++)
+         if (head[i]->fTriggerBus != head[0]->fTriggerBus)
+            bus = false;
+      if (!bus) {
+         for (i = 0; i < fNumberOfBoards; i++) {
+            fQueue[i]->EndRead();
+            head[i] = NULL;
+            fDiscarded[i]++;
+         }
+         fBusMismatch++;
+         continue;
+      }
+
+      event = fEvents->BeginWrite();
+      if (event == NULL)
+         return;
+
+      event->fNumber = (unsigned int) fBuilt;
+      event->fFragment.resize(fNumberOfBoards);
+      for (i = 0; i < fNumberOfBoards; i++) {
+         memcpy(&event->fFragment[i], head[i], sizeof(DRSFragment));
+         fQueue[i]->EndRead();
+         head[i] = NULL;
+      }
+
+      fEvents->EndWrite();
+      fBuilt++;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+DRSMultiEvent *DRSMultiBoard::GetEvent(int timeoutMs)
+{
+   return fEvents->BeginRead(timeoutMs);
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSMultiBoard::ReleaseEvent()
+{
+   fEvents->EndRead();
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSMultiBoard::GetBacklogStats(int board, DRSBacklogStats *stats)
+{
+   stats->fragments = fFragments[board];
+   stats->stalls = fStalls[board];
+   stats->discarded = fDiscarded[board];
+   stats->depth = (unsigned int) fQueue[board]->GetDepth();
+   stats->maxDepth = (unsigned int) fQueue[board]->GetMaxDepth();
+   stats->capacity = (unsigned int) fQueue[board]->GetCapacity();
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSMultiBoard::PrintBacklogStats(FILE *f)
+{
+   DRSBacklogStats s;
+
+   fprintf(f, "%-6s %-7s %12s %8s %10s %6s %6s\n", "Board", "Serial", "Fragments", "Stalls", "Discarded",
+           "Depth", "Max");
+   for (int i = 0; i < fNumberOfBoards; i++) {
+      GetBacklogStats(i, &s);
+      fprintf(f, "%-6d %-7d %12llu %8llu %10llu %3u/%-3u %6u\n", i, fBoard[i]->GetBoardSerialNumber(),
+              s.fragments, s.stalls, s.discarded, s.depth, s.capacity, s.maxDepth);
+   }
+   fprintf(f, "Events built %llu, rejected for trigger bus mismatch %llu, timestamps apart %llu, output queue %u/%u\n",
+           (unsigned long long) fBuilt, (unsigned long long) fBusMismatch, (unsigned long long) fTimeMismatch,
+           (unsigned int) fEvents->GetDepth(), (unsigned int) fEvents->GetCapacity());
+}
@@ -28,6 +28,7 @@
 /*cern root libs*/
 #include<climits>
 #include "TFile.h"
+#include "TROOT.h"
 #include "TTree.h"
 #include "TH1.h"
 #include "TPad.h"
@@ -60,11 +61,26 @@
 #include <chrono>
 #include <thread>
 #include <fstream>
+#include <sstream>
+#include <functional>
 
 /*  DRS4v5 libs*/
 #include "strlcpy.h"
 #include "DRS.h"
 #include <DRS4v5_lib.h>
+#include "daqtimer.h"
+#include "multiboard.h"
+#include "counter.h"
+#include "ratelog.h"
+#include "swtrigger.h"
+#include "rawevent.h"
+#include "pedestal.h"
+#include "tempmon.h"
+#include "spikes.h"
+#include "runwriter.h"
+#include "evjournal.h"
+#include "sigavg.h"
+#include "persist.h"
 
 #define UPADATE_STATS_INTERVAL 20
 /*------------------------------------------------------------------*/
@@ -103,8 +119,53 @@ static void* sleep_thread(void * seconds)
 	pthread_exit(NULL);
 }
 
+static void save_fit_params(const string &fname,TFitResultPtr &fit)
+{
+	fstream file;
+	file.open(fname.c_str(),ios::app|ios::out);
+	file<<"Pedestal_Gausian_Mean,"<<fit->Parameter(0)<<"\n";
+	file<<"Pedestal_Gausian_StD,"<<fit->Parameter(1)<<"\n";
+	file<<"Pedestal_Gausian_Normalization,"<<fit->Parameter(2)<<"\n";
+	file<<"Landau_Width,"<<fit->Parameter(3)<<"\n";
+	file<<"Landau_MPV,"<<fit->Parameter(4)<<"\n";
+	file<<"Landau_Norm,"<<fit->Parameter(5)<<"\n";
+	file<<"Landau_Gausian_Width,"<<fit->Parameter(6)<<"\n";
+	file.close();
+}
+
+/* per DRS cell pedestals if available, else the old per sample offsets,
+   both subtracted by the board inside the waveform calibration */
+static void set_pedestals(DRSBoard *b)
+{
+	vector<double*> calib_data;
+	int calib_channel[4]={0,1,2,3};
+	PedestalTable pedestal;
+
+	if(pedestal.Load("calib/pedestal.cal")>0)
+	{
+		cout<<"pedestal caliberation read from calib/pedestal.cal (per DRS cell)";
+		for(int i=0;i<4;i++)
+			if(pedestal.IsValid(i))
+				b->SetUserPedestal(0,2*i,pedestal.GetMean(i),kUserPedestalByCell);
+		return;
+	}
+	get_channel_offsets("calib/offset_calib.dat",&calib_data,calib_channel);
+	cout<<"offset caliberation read for "<<calib_data.size()<<"  channels ";
+	vector<double*>::iterator ditr=calib_data.begin();
+	for(int k=0;ditr!=calib_data.end();ditr++,k++)
+	{
+		cout<<calib_channel[k]<<"  ";
+		for (int j=0;j<1024;j++)
+			(*ditr)[j]*=1000;
+		if(calib_channel[k]>=0 and calib_channel[k]<4)
+			b->SetUserPedestal(0,2*calib_channel[k],*ditr,kUserPedestalBySample);
+	}
+}
+
 int adc_mode(DRSBoard *b);
 int counter_mode(DRSBoard *b);
+int multi_mode(DRS *drs);
+int averaging_mode(DRSBoard *b);
 
 int main()
 {
@@ -116,6 +177,7 @@ int main()
    int nBoards;
    DRS *drs;
    DRSBoard *b;
+   char str[256];
    drs = new DRS(); 			/* do initial scan */
    for (int i=0 ; i<drs->GetNumberOfBoards() ; i++) 
    {
@@ -130,9 +192,13 @@ int main()
       printf("No DRS4 evaluation board found\n");
       return 0;
    }
+   if (drs->InitBoards(5))		/* initialize all boards and set sampling frequency */
+   {
+      drs->GetError(str, sizeof(str));
+      printf("%s", str);
+   }
+   drs->PrintStartupReport(stdout);
    b = drs->GetBoard(0);		/* continue working with first board only */
-   b->Init();					/* initialize board */
-   b->SetFrequency(5, true);	/* set sampling frequency */
    b->SetTranspMode(1);			/* enable transparent mode needed for analog trigger */
    b->SetInputRange(0);			/* set input range to -0.5V ... +0.5V */
 
@@ -149,12 +215,18 @@ int main()
    	cout<<"\n Enter your choice : \n";
    	cout<<"\t 1 -> ADC Mode \n";
    	cout<<"\t 2 -> Counter Mode \n";
+   	cout<<"\t 3 -> Multi-board ADC Mode ["<<nBoards<<" boards, daisy chain] \n";
+   	cout<<"\t 4 -> Pedestal Caliberation [files from drsosc.config] \n";
+   	cout<<"\t 5 -> Averaging Mode [mean and RMS waveforms only] \n";
    	cout<<"\t 0 -> Exit \n\t";
    	cin>>choice;
    	
-	     if(choice==3)	return 0;
+	     if(choice==0)	return 0;
    	else if(choice==1)	adc_mode(b);
 	else if(choice==2)	counter_mode(b);
+	else if(choice==3)	multi_mode(drs);
+	else if(choice==4)	do_offset_caliberation();
+	else if(choice==5)	averaging_mode(b);
    delete drs;
 	
 	return 0;
@@ -167,7 +239,9 @@ int counter_mode(DRSBoard *b)
 	int choice=-1;
 	unsigned int tsecs=100;
 	double trig_level_ch[4]={-30.0,-30.0,-30.0,-30.0};
-	unsigned long int scount=0,dcount=0;
+	int trigger_source=0;
+	double resolving_time=20;
+	string run_name="defaultCounter",temp_str;
 	cout<<"\n Enter the Trigger logic : "<<endl;
 	cout<<"1  -> "<<" Single Channel Trigger  [ ch 2 ]"<<endl;
 	cout<<"2  -> "<<" Two Fold Coincidance Counter  [ ch 2 AND ch 3 ]"<<endl;
@@ -193,7 +267,8 @@ int counter_mode(DRSBoard *b)
 					cout<<"\n Enter the Trigger value for Channel 2 [in mV , with sign, falling edge ]  : ";
 					cin>>trig_level_ch[1];
 					b->SetIndividualTriggerLevel(2,trig_level_ch[1]/1000);
-					b->SetTriggerSource(0x0200);
+					trigger_source=0x0200;
+					b->SetTriggerSource(trigger_source);
 					if (DEBUG_MODE) b->SetTriggerSource(0x0010);
 				}
 				break;
@@ -205,7 +280,8 @@ int counter_mode(DRSBoard *b)
 					cin>>trig_level_ch[2];
 					b->SetIndividualTriggerLevel(2,trig_level_ch[1]/1000);
 					b->SetIndividualTriggerLevel(3,trig_level_ch[2]/1000);
-					b->SetTriggerSource(0x0E00);
+					trigger_source=0x0E00;
+					b->SetTriggerSource(trigger_source);
 					if (DEBUG_MODE) b->SetTriggerSource(0x0010);        //Ext triger
 
 				}
@@ -221,7 +297,8 @@ int counter_mode(DRSBoard *b)
 					b->SetIndividualTriggerLevel(2,trig_level_ch[1]/1000);
 					b->SetIndividualTriggerLevel(3,trig_level_ch[2]/1000);
 					b->SetIndividualTriggerLevel(4,trig_level_ch[3]/1000);
-					b->SetTriggerSource(0x600);
+					trigger_source=0x600;
+					b->SetTriggerSource(trigger_source);
 					if (DEBUG_MODE) b->SetTriggerSource(0x0010);        //Ext triger
 				}
 				break;
@@ -239,7 +316,8 @@ int counter_mode(DRSBoard *b)
 					b->SetIndividualTriggerLevel(2,trig_level_ch[1]/1000);
 					b->SetIndividualTriggerLevel(3,trig_level_ch[2]/1000);
 					b->SetIndividualTriggerLevel(4,trig_level_ch[3]/1000);
-					b->SetTriggerSource(0x0F00);
+					trigger_source=0x0F00;
+					b->SetTriggerSource(trigger_source);
 					if (DEBUG_MODE)  b->SetTriggerSource(0x0010);        //Ext triger
 					
 				}
@@ -254,6 +332,10 @@ int counter_mode(DRSBoard *b)
 	
 	b->SetTriggerPolarity(true);        // false :positive edge
 	cout<<"\n Enter the counter duration in seconds\t: ";	cin>>tsecs;
+	cout<<"\n Enter the coincidence resolving time in ns\t: ";	cin>>resolving_time;
+	cout<<"\n Enter the data run name \t:\t";	cin>>run_name;
+	temp_str="mkdir -p data/"+run_name;
+	system_return=system(temp_str.c_str());
 
 	//For exiting after n secs
 	 pthread_t tId;
@@ -262,27 +344,30 @@ int counter_mode(DRSBoard *b)
 	 pthread_t tId2;
 	 (void) pthread_create(&tId2, 0, exit_loop, 0);
     
+	 ScalerCounter counter(b, 100);	/* sample scalers every 100 ms */
+	 RateLogger rate_log;	/* 1 s records of singles, coincidences and accidentals */
+	 temp_str="data/"+run_name+"/rates.dat";
+	 if(rate_log.Open(temp_str.c_str(),(trigger_source>>8)&0xF,resolving_time,1000,daq_wall_time_ns()))
+		 counter.SetLogger(&rate_log);
+	 if(!counter.IsHardware())
+		 cout<<"\n No hardware scalers on this board, counting triggers in software";
      cout<<"\n The counter has started \n\n";
-	 while(!break_loop)
-	 {
-		b->StartDomino();
-		while (b->IsBusy());
-		scount++;
-		printf("\033[F \r Count = %lu \n ",scount);
-	 }
+	 counter.Run(&break_loop, stdout);
+	 
+	 break_loop=true;
 	cout<<"\n\n";
+	counter.PrintSummary(stdout);
+	rate_log.Close();
+	if(rate_log.GetRecords()>0)
+		printf("Coincidence rate %1.4lf Hz, estimated accidental rate %1.4lf Hz, %llu records in %s\n",
+				rate_log.GetCoincidenceRate(),rate_log.GetAccidentalRate(),rate_log.GetRecords(),temp_str.c_str());
 	return 0;
 
 }
 int adc_mode(DRSBoard *b)
 {
-    float time_array[4][1024];
-    float wave_array[4][1024];
     float trigger_level=-0.04;
 
-   vector<double*> calib_data;
-   int calib_channel[4]={0,1,2,3};
-   int calib_channel_id=0;
 
    fstream file;
    string run_name="defaultRun",energy_str,event_str,temp_str;
@@ -293,9 +378,17 @@ int adc_mode(DRSBoard *b)
    int updates_stats_interval=UPADATE_STATS_INTERVAL;
    int updates_Fit_interval=UPADATE_STATS_INTERVAL*50;
    int event_rate;
+   double trigger_rate,dead_time;
+   DAQTimer timer;
+   SoftwareTrigger swtrig;
+   SpikeRemover spikes;
+   DRSRawEvent raw(b);
+   RunWriter writer;		/* run directories, rollover from rollover.config */
+   EventJournal journal;	/* events.dat records with CRC trailer, see evrecover */
+   PersistenceMap persist(512,0,1024/b->GetNominalFrequency(),256,-500,500);	/* channel of interest, as the scope */
    
    time_t start_t = time(0);
-   time_t curr_t,diff,etime;
+   time_t curr_t,diff;
    tm* elapsed_t ;
    char* dt=ctime(&start_t);
    
@@ -345,42 +438,30 @@ int adc_mode(DRSBoard *b)
 				printf("ENTER VALID RANGE (1,2,..) OR -1 !!\n");
 				return 0;
 			}
+	char spike_option='n';
+	cout<<"Remove the DRS4 spikes common to all channels [y/n] ?\t:\t";
+		cin>>spike_option;
+	if(spike_option=='y' or spike_option=='Y')
+		raw.SetSpikeRemover(&spikes);	/* all four inputs in one pass before any use */
 	char remark_option='n';
-   	event_str="mkdir -p data/"+run_name;
-	system_return=system(event_str.c_str());
-	event_str="chmod -R 777 data/"+run_name;
-	system_return=system(event_str.c_str());
+	writer.LoadConfig("rollover.config");
+	if(!writer.Open("data",run_name.c_str()))	/* data/<run>, empty events.dat and eDeposit.txt */
+		return 1;
 	
 	cout<<"\n Do you want to enter any remarks [y/n] ?\t:\t";
 		cin>>remark_option;
 	if(remark_option=='y' or remark_option=='Y')
 		{
-			temp_str="nano data/"+run_name+"/remarks.txt";
+			temp_str="nano "+writer.GetPath("remarks.txt");
 			system_return=system(temp_str.c_str());
 		}
-	else
-	{ 
-		temp_str="touch data/"+run_name+"/remarks.txt";
-		system_return=system(temp_str.c_str());
-	}
    
-   energy_str="data/"+run_name+"/eDeposit.txt";
-   file.open(energy_str.c_str(), ios::out);/* open file to save waveforms */
-   if (!file.is_open()) 
+   energy_str=writer.GetPath("eDeposit.txt");
+   event_str=writer.GetPath("events.dat");
+   if(!journal.Open(event_str.c_str()))
    {
-      perror("ERROR: Cannot open file \"data.txt\"");
       return 1;
    }
-   file.close();
-   
-   event_str="data/"+run_name+"/events.dat";
-   file.open(event_str.c_str(), ios::out|ios::binary);/* open file to save waveforms */
-   if (!file.is_open())
-   {
-      perror("ERROR: Cannot open file \"data.txt\"");
-      return 1;
-   }
-   file.close();
 	system_return=system("clear");
 	cout<<"\n\t\t\t ADC MODE \n";
    	start_t = time(0);
@@ -392,15 +473,26 @@ int adc_mode(DRSBoard *b)
 	    	cout<<"\nwaveforms are written to\t:\t"<<event_str;
  		cout<<" [ One out of every "<<skip_evts<<" saved]";
     	}
+    if(writer.IsRolloverEnabled())
+    	{
+    	cout<<"\n";
+    	writer.PrintConfig(stdout);
+    	}
     if(infinite)
     	cout<<"\nOn cotinious run .. input 'q' then 'enter' to quit\n";
  	else 
  		cout<<"\nNumber of events to be monitored :\t"<<event_counter;
  	cout<<"\nChannel to be integrated  : "<<channel+1<<"\n\n";
  	cout<<"\nRemarks \t: \n\n";
- 	temp_str="cat data/"+run_name+"/remarks.txt";
+ 	temp_str="cat "+writer.GetPath("remarks.txt");
  	system_return=system(temp_str.c_str());
 	cout<<"\n\n";
+	if(swtrig.LoadConfig("swtrigger.config") and swtrig.IsEnabled())
+	{
+		swtrig.SetFrequency(b->GetNominalFrequency());
+		swtrig.PrintConfig(stdout);
+		cout<<"\n";
+	}
 	
    b->SetTriggerPolarity(true) ;        // true :negative edge
 //  b->SetTriggerPolarity(false);        // false :positive edge
@@ -431,15 +523,7 @@ int adc_mode(DRSBoard *b)
 	 event_rate = int(float(updates_stats_interval)/int(diff-curr_t+1));
 	 dt=ctime(&curr_t);
 	 fflush(stdout);
-	get_channel_offsets("calib/offset_calib.dat",&calib_data,calib_channel);
-    cout<<"offset caliberation read for "<<calib_data.size()<<"  channels ";
-	vector<double*>::iterator ditr=calib_data.begin();
-	for(int k=0;ditr!=calib_data.end();ditr++)
-		{	
-			cout<<calib_channel[k++]<<"  ";
-			for (int j=0;j<1024;j++)
-				(*ditr)[j]*=1000;
-		}
+	set_pedestals(b);
 	 cout<<"\n\n";
 	 cout<<"\tCurrent time\t:\t"<<dt;
 	 diff=curr_t-start_t;
@@ -450,6 +534,7 @@ int adc_mode(DRSBoard *b)
 	 cout<<elapsed_t->tm_sec<<"sec "<<"\n";
 	 cout<<"Total Number of Events\t:\t"<<eid<<"\n";
 	 cout<<"Rate of events = \t:\t"<<eid<<" / min \n";
+	 cout<<"Dead time \t\t:\t"<<0.0<<" % \n";
 	
 		//For exiting on 'q' 
 		 pthread_t tId;
@@ -457,20 +542,17 @@ int adc_mode(DRSBoard *b)
    
    DRS_EVENT muEvent[1];
    
-   for(int i=0;i<4;i++)
+   for(int i=0;i<4;i++)		/* set to the buffers of the raw event before saving */
    {
-	   muEvent[0].time.push_back(time_array[i]);
-	   muEvent[0].waveform.push_back(wave_array[i]);
+	   muEvent[0].time.push_back(NULL);
+	   muEvent[0].waveform.push_back(NULL);
    }
 	
-	for(int i=0;i<4;i++)
-		if(calib_channel[i]==channel)
-			calib_channel_id=i;
-	
 	strcpy(muEvent[0].eheader.event_header,"muT");
 	muEvent[0].eheader.millisecond=0;
 	muEvent[0].eheader.range=0;
 	int save_to_disc_count=0;
+	uint64_t trigger_ns=0;
 	
 	//Fitting function for the histogram
      TF1* fity = new TF1("fitey", langaufun, 5, 258, 4);
@@ -496,82 +578,177 @@ int adc_mode(DRSBoard *b)
     gStyle->SetOptStat(11);
     gStyle->SetOptFit(1111);
 
-    temp_str="data/"+run_name+"/qDep.png";
+    temp_str=writer.GetPath("qDep.png");
     //FitRsltPtr = qADC->Fit(fity, "QBMS");
     cout<<endl;
     c1->SaveAs(temp_str.c_str());
     c1->SaveAs("Monitor.png");
-	temp_str="data/"+run_name+"/event.root";
+	if(writer.IsRolloverEnabled())
+		ROOT::EnableThreadSafety();	/* old run files are closed by the writer thread */
+	temp_str=writer.GetPath("event.root");
 	TFile* afile= new TFile(temp_str.c_str(),"recreate");
     TTree* edepTree= new TTree("muEvents","muEvents");
     edepTree->Branch("QDep",&energy);
+    
+    /* per run bookkeeping for the rollover */
+    const unsigned long long event_bytes=sizeof(EHEADER)+sizeof(XHEADER)+sizeof(int)+4*2*1024*sizeof(float)+sizeof(ETRAILER);
+    unsigned long int run_eid=0;
+    int run_saved=0;
+    bool armed=false;
+    /* counters at the start of the run, the footer reports this run only */
+    uint64_t run_time0=0,run_live0=0;
+    unsigned long long run_spike_events0=0,run_spike_removed0=0,run_sw_events0=0,run_sw_passed0=0;
+    auto mark_run=[&]()
+    {
+    	run_time0=timer.GetRunTime();
+    	run_live0=timer.GetLiveTime();
+    	run_spike_events0=spikes.GetEvents();
+    	run_spike_removed0=spikes.GetRemoved();
+    	run_sw_events0=swtrig.GetEvents();
+    	run_sw_passed0=swtrig.GetPassed();
+    };
+    auto run_footer=[&]()
+    {
+    	ostringstream r;
+    	time_t t=(time_t)(writer.GetRunStartWall()/1000000000ULL);
+    	r<<"\n-------------------------------------------------\n";
+    	r<<"Run started at : "<<ctime(&t);
+    	t=time(0);
+    	r<<"Run stopped at : "<<ctime(&t);
+    	r<<"Triggers for channels :"<<trigger_level<<endl;
+    	r<<"Channel integrated:"<<channel+1<<endl;
+    	r<<"Number of events to be recorded [-1-> continious mode]: "<<event_counter<<endl;
+    	r<<"Number of events recorded : "<<eid-run_eid<<endl;
+    	r<<"Number of events skipped at a stretch : "<<skip_evts-1<<endl;
+    	r<<"Number of events saved to disc : "<<run_saved<<endl;
+    	uint64_t run_time=timer.GetRunTime()-run_time0;
+    	r<<"Dead time fraction : "<<(run_time ? 1.0-(double)(timer.GetLiveTime()-run_live0)/run_time : 0)<<endl;
+    	if(spike_option=='y' or spike_option=='Y')
+    		r<<"Events with spikes removed : "<<spikes.GetRemoved()-run_spike_removed0<<" / "<<spikes.GetEvents()-run_spike_events0<<endl;
+    	if(swtrig.IsEnabled())
+    	{
+    		unsigned long long passed=swtrig.GetPassed()-run_sw_passed0;
+    		r<<"Software trigger passed / rejected : "<<passed<<" / "<<swtrig.GetEvents()-run_sw_events0-passed<<endl;
+    	}
+    	if(writer.IsRolloverEnabled())
+    		r<<"Run segment : "<<writer.GetRun()<<" , events "<<run_eid+1<<" ... "<<eid<<endl;
+    	r<<"Run start wall clock [ns since epoch] : "<<timer.GetRunStartWall()<<endl;
+    	r<<"Run start monotonic clock [ns] : "<<timer.GetRunStart()<<endl;
+    	r<<"\n-------------------------------------------------\n";
+    	return r.str();
+    };
+    /* the old run's histogram is copied, file and tree handed over to the writer thread */
+    auto close_run=[&]()
+    {
+    	TFile *f=afile;
+    	TTree *t=edepTree;
+    	TH1D *h=(TH1D*)qADC->Clone();
+    	h->SetDirectory(0);
+    	return std::function<void()>([f,t,h]() {
+    		f->cd();
+    		h->Write();
+    		delete h;
+    		t->Write();
+    		delete t;
+    		f->Close();
+    		delete f;
+    	});
+    };
+    auto open_run=[&]()
+    {
+    	afile=new TFile(writer.GetPath("event.root").c_str(),"recreate");
+    	edepTree=new TTree("muEvents","muEvents");
+    	edepTree->Branch("QDep",&energy);
+    	qADC->Reset();
+    	energy_str=writer.GetPath("eDeposit.txt");
+    	event_str=writer.GetPath("events.dat");
+    	journal.Open(event_str.c_str());
+    	run_eid=eid;
+    	run_saved=0;
+    	mark_run();
+    };
     temp_str="xdg-open Monitor.png &";
  	system_return=system(temp_str.c_str());
 	// EVENT LOOP
 	
+	/* follow the board temperature with the archived voltage calibrations */
+	TemperatureMonitor tmon(b,10,0.5);
+	tmon.LoadCalibrations("calib");
+	tmon.AddBoardCalibration("calib");
+	cout<<"voltage caliberations for "<<tmon.GetNumberOfCalibrations()<<" temperatures\n";
+	tmon.Start();
+
+   writer.Start();
+   timer.StartRun();
+   mark_run();
    while( (infinite or (event_counter>eid)) and !break_loop) 
    {
-	  eid++;
-      b->StartDomino();							/* start board (activate domino wave) */
-      fflush(stdout);
+      tmon.Apply();							/* switch calibration between events only */
+      if(!armed)
+      {
+		b->StartDomino();						/* start board (activate domino wave) */
+		timer.Mark(kStageStartDomino);
+      }
+      armed=false;
       while (b->IsBusy());
+      trigger_ns=timer.Mark(kStageWaitTrigger);	/* trigger acknowledge, reused as event timestamp */
 
-      b->TransferWaves(0, 8); /* read all waveforms */
-      /* read time (X) array of first channel in ns */
-      /* decode waveform (Y) array of first channel in mV */
-     if( save_waveform) if(eid%skip_evts==0)
+      raw.Transfer(); /* read all waveforms, decoded only on demand */
+      timer.Mark(kStageTransfer);
+      if(swtrig.IsEnabled())
       {
-			b->GetTime(0, 0, b->GetTriggerCell(0), time_array[0]);
-			b->GetWave(0, 0, wave_array[0]);
-
-			b->GetTime(0, 2, b->GetTriggerCell(0), time_array[1]);
-			b->GetWave(0, 2, wave_array[1]);
-
-			b->GetTime(0, 4, b->GetTriggerCell(0), time_array[2]);
-			b->GetWave(0, 4, wave_array[2]);
+		/* reject on raw ADC before any calibration work */
+		bool accepted=swtrig.Accept(raw);
+		timer.Mark(kStageSwTrigger);
+		if(!accepted)
+		{
+			timer.EndEvent();
+			continue;
+		}
+      }
+	  eid++;
+      /* read time (X) array in ns */
+      /* decode waveform (Y) array in mV */
+     if(save_waveform and eid%skip_evts==0)
+      {
+			for(int i=0;i<4;i++)
+				muEvent[0].time[i]=raw.GetTime(2*i);
+			timer.Mark(kStageGetTime);
 
-			b->GetTime(0, 6, b->GetTriggerCell(0), time_array[3]);
-			b->GetWave(0, 6, wave_array[3]);
+			for(int i=0;i<4;i++)
+				muEvent[0].waveform[i]=raw.GetWave(2*i);
 			
-			etime = time(0);
-			elapsed_t = localtime(&etime);
-
 			muEvent[0].eheader.event_serial_number=eid;
-			muEvent[0].eheader.year=elapsed_t->tm_year;
-			muEvent[0].eheader.month=elapsed_t->tm_mon;
-			muEvent[0].eheader.day=elapsed_t->tm_mday;
-			muEvent[0].eheader.hour=elapsed_t->tm_hour;
-			muEvent[0].eheader.minute=elapsed_t->tm_min;
-			muEvent[0].eheader.second=elapsed_t->tm_sec;
-			
-			for(int i=0;i<4;i++)
-			for(int j=0;j<1024;j++)
-			{
-				wave_array[calib_channel[i]][j]-=calib_data[calib_channel[i]][j];
-			}
-			save_event_binary(event_str.c_str(),muEvent,1);
+			set_event_time(&muEvent[0],trigger_ns,timer.GetRunStart(),timer.GetRunStartWall());
+			timer.Mark(kStageDecode);
+			journal.Append(&muEvent[0].eheader,&muEvent[0].xheader,4,&muEvent[0].time[0],&muEvent[0].waveform[0]);
 			save_to_disc_count++;
+			run_saved++;
+			writer.AddEvent(event_bytes);
+			timer.Mark(kStageWrite);
       }
       else
       {
-		b->GetTime(0, 2*channel, b->GetTriggerCell(0), time_array[channel]);
-		b->GetWave(0, 2*channel, wave_array[channel]);
-		for(int i=0;i<1024;i++)
-			{
-				wave_array[channel][i]-=calib_data[calib_channel_id][i];
-			}
+		raw.GetTime(2*channel);
+		timer.Mark(kStageGetTime);
+		raw.GetWave(2*channel);
+		timer.Mark(kStageDecode);
+		writer.AddEvent(0);
       }
       
 	 //double get_energy(float waveform[8][102TCanvas* c1 = new TCanvas("c1", "c1", 800, 400);4],int channel, double trigger_level,double neg_offset,double integrate_window,double freq )
       
-      energy=get_energy(wave_array,time_array, channel, -40,10,50,5.12);
+      energy=get_channel_energy(raw.GetWave(2*channel),raw.GetTime(2*channel), -40,10,50,5.12);
       edepTree->Fill();
       qADC->Fill(energy);
+      persist.Fill(0,raw.GetTime(2*channel),raw.GetWave(2*channel),1024);
+      timer.Mark(kStageAnalysis);
       
 	  file.open(energy_str.c_str(), ios::out | ios::app);
 	  temp_str=to_string(eid)+","+to_string(energy)+"\n";
       file<<temp_str;
 	  file.close();
+      timer.Mark(kStageWrite);
 	
 	    if(eid%updates_Fit_interval==0)
          {
@@ -581,6 +758,8 @@ int adc_mode(DRSBoard *b)
              fity->SetParameters(&pary[3]); // for landau from 5-257
 //             fity->SetParameters(pary); // For totfunc
              FitRsltPtr = qADC->Fit(fity, "RQBMS");
+             edepTree->AutoSave("SaveSelf");	/* readable event.root even if muonDet dies */
+             persist.SaveImage(writer.GetPath("persistence.pgm").c_str());
 //             cout<<endl;
          }
 	   if(eid%updates_stats_interval==0)
@@ -591,10 +770,11 @@ int adc_mode(DRSBoard *b)
 	         cout<<"\033[F";
 	         cout<<"\033[F";
 	         cout<<"\033[F";
+	         cout<<"\033[F";
 	         cout<<"\033[F"; // for moving back a line
-	         diff=curr_t;
 	         curr_t = time(0);
-	         event_rate = (float(updates_stats_interval)*60/int(curr_t-diff));
+	         timer.GetInterval(&trigger_rate,&dead_time);
+	         event_rate = int(trigger_rate*60);
  			 dt=ctime(&curr_t);
  			 fflush(stdout);
 	         cout<<"\tCurrent time\t:\t"<<dt;
@@ -606,63 +786,335 @@ int adc_mode(DRSBoard *b)
 	         cout<<elapsed_t->tm_sec<<"sec "<<"\n";
 	         cout<<"Total Number of Events\t:\t"<<eid<<endl;
 	         cout<<"Rate of events = \t:\t"<<event_rate<<" / min \n";
+	         cout<<"Dead time \t\t:\t"<<dead_time*100<<" % \n";
 	         qADC->Draw();
-	         temp_str="data/"+run_name+"/qDep.png";
+	         temp_str=writer.GetPath("qDep.png");
 	         cout<<endl;
 	         c1->SaveAs(temp_str.c_str());
 	         c1->SaveAs("Monitor.png");
 	   }
 	  printf("\r\t\t\t\t\t\t\t\t\t!!");
       printf("\rEvent ID  %lu \t\t\t|\tcharge : %f  pC", eid,energy);
+      timer.Mark(kStageMonitor);
+      timer.EndEvent();
+      
+      if(writer.IsRolloverDue() and (infinite or (event_counter>eid)) and !break_loop)
+      {
+		/* re-arm first, a trigger during the switch waits in the board */
+		b->StartDomino();
+		timer.Mark(kStageStartDomino);
+		armed=true;
+		/* nothing is handed over or reset unless the next run directory exists */
+		if(writer.PrepareRollover())
+		{
+			if(FitRsltPtr>0)
+				save_fit_params(writer.GetPath("fit_params.txt"),FitRsltPtr);
+			FitRsltPtr=TFitResultPtr(0);
+			persist.Merge(0);
+			persist.SaveImage(writer.GetPath("persistence.pgm").c_str());
+			persist.Clear();
+			writer.Rollover(run_footer(),close_run(),open_run);
+		}
+      }
    }
+   timer.StopRun();
    
    break_loop=true;
    (void) pthread_join(tId, NULL);
-   	temp_str="data/"+run_name+"/remarks.txt";
-   	file.open(temp_str.c_str(),ios::app|ios::out);
-   	file<<"\n-------------------------------------------------\n";
-   	dt=ctime(&start_t);
-   	file<<"Run started at : "<<dt;
-   	curr_t=time(0);
-   	dt=ctime(&curr_t);
-   	file<<"Run stopped at : "<<dt;
-   	file<<"Triggers for channels :"<<trigger_level<<endl;
-   	file<<"Channel integrated:"<<channel+1<<endl;
-   	file<<"Number of events to be recorded [-1-> continious mode]: "<<event_counter<<endl;
-   	file<<"Number of events recorded : "<<eid<<endl;
-   	file<<"Number of events skipped at a stretch : "<<skip_evts-1<<endl;
-   	file<<"Number of events saved to disc : "<<save_to_disc_count<<endl;
-   	file<<"\n-------------------------------------------------\n";
-   	file.close();
+   	cout<<"\n\n";
+   	timer.PrintSummary(stdout);
+	tmon.Stop();
+	tmon.PrintSummary(stdout);
+   	if(swtrig.IsEnabled())
+   		swtrig.PrintStatistics(stdout);
+   	temp_str=writer.GetPath("timing.txt");
+   	timer.WriteSummary(temp_str.c_str());
    	
     if(FitRsltPtr>0)
     {
-       	temp_str="data/"+run_name+"/fit_params.txt";
-       	file.open(temp_str.c_str(),ios::app|ios::out);
-       	file<<"Pedestal_Gausian_Mean,"<<FitRsltPtr->Parameter(0)<<"\n";
-       	file<<"Pedestal_Gausian_StD,"<<FitRsltPtr->Parameter(1)<<"\n";
-       	file<<"Pedestal_Gausian_Normalization,"<<FitRsltPtr->Parameter(2)<<"\n";
-       	file<<"Landau_Width,"<<FitRsltPtr->Parameter(3)<<"\n";
-       	file<<"Landau_MPV,"<<FitRsltPtr->Parameter(4)<<"\n";
-       	file<<"Landau_Norm,"<<FitRsltPtr->Parameter(5)<<"\n";
-       	file<<"Landau_Gausian_Width,"<<FitRsltPtr->Parameter(6)<<"\n";
-       	file.close();
+       	save_fit_params(writer.GetPath("fit_params.txt"),FitRsltPtr);
     }
-   	// Histograms for online plotting
-    qADC->Write();
+   	journal.Close(true);
+   	persist.Merge(0);
+   	persist.SaveImage(writer.GetPath("persistence.pgm").c_str());
+   	// Histograms for online plotting, last run closed after any queued ones
+   	writer.Close(run_footer(),close_run());
+   	writer.PrintSummary(stdout);
 	delete qADC ;
 	delete c1 ;
-	edepTree->Write();
-    delete edepTree;
-	afile->Close();
-	delete afile;
 	delete fity ;
-   	event_str="chmod -R 777 data/"+run_name;
-	system_return=system(event_str.c_str());
 	cout<<"\n\n";
 	return 0;
 }
  
+int averaging_mode(DRSBoard *b)
+{
+	float trigger_level=-0.02;
+	int trigger_channel=1;
+	long int n_events=10000;
+	bool infinite=false;
+	char option='n';
+	double grid_start=0,grid_step=0.2;
+	int grid_points=0;
+	string run_name="defaultAverage",temp_str;
+	unsigned long int eid=0;
+	double trigger_rate,dead_time;
+	DAQTimer timer;
+	SoftwareTrigger swtrig;
+	SpikeRemover spikes;
+	DRSRawEvent raw(b);
+	SignalAverager avg(4);
+	float *wave[4],*time_axis[4];
+	time_t start_t=time(0);
+	
+	system_return=system("clear");
+	cout<<"\n\t\t\t AVERAGING MODE \n";
+	cout<<" Mean and RMS waveforms of all channels, no events written to disc\n\n";
+	cout<<"Enter the data run name \t:\t";	cin>>run_name;
+	cout<<"Enter the trigger channel [1,2,3 or 4, 5 for external] \t:\t";	cin>>trigger_channel;
+	if(trigger_channel<1 or trigger_channel>5)
+	{
+		cout<<"\n please enter a valid channel ID (1,2,3,4,5) !";
+		return 1;
+	}
+	if(trigger_channel<5)
+	{
+		cout<<"Enter the trigger level in mV  ( with sign, falling edge )\t:\t";
+		cin>>trigger_level;
+		trigger_level/=1000;
+	}
+	cout<<"Enter number of events to be averaged ( -1 for infinite loop ) : ";
+	cin>>n_events;
+	if(n_events<=-1)
+		infinite=true;
+	cout<<"Resample all events to a common time grid [y/n] ?\t:\t";
+	cin>>option;
+	if(option=='y' or option=='Y')
+	{
+		cout<<"Enter grid start, step in ns and number of points [e.g. 0 0.2 1000] :\t";
+		cin>>grid_start>>grid_step>>grid_points;
+		if(!avg.SetGrid(grid_start,grid_step,grid_points))
+			return 1;
+	}
+	cout<<"Remove the DRS4 spikes common to all channels [y/n] ?\t:\t";
+	cin>>option;
+	if(option=='y' or option=='Y')
+		raw.SetSpikeRemover(&spikes);
+	
+	temp_str="mkdir -p data/"+run_name;
+	system_return=system(temp_str.c_str());
+	string avg_str="data/"+run_name+"/average.txt";
+	
+	if(trigger_channel<5)
+	{
+		b->SetTriggerPolarity(true);	// true :negative edge
+		b->SetIndividualTriggerLevel(trigger_channel-1, trigger_level);
+		b->SetTriggerSource(1<<(trigger_channel+7));	// AND of the single channel
+	}
+	else
+		b->SetTriggerSource(0x0010);	// external trigger
+	b->SetTriggerDelayNs(50);
+	set_pedestals(b);
+	cout<<"\n";
+	if(swtrig.LoadConfig("swtrigger.config") and swtrig.IsEnabled())
+	{
+		swtrig.SetFrequency(b->GetNominalFrequency());
+		swtrig.PrintConfig(stdout);
+	}
+	if(avg.IsResampling())
+		printf("Resampled to %d points from %1.3lf ns in steps of %1.3lf ns\n",grid_points,grid_start,grid_step);
+	cout<<"Averaged waveforms written to\t:\t"<<avg_str<<"\n";
+	if(infinite)
+		cout<<"On cotinious run .. input 'q' then 'enter' to quit\n";
+	cout<<"\n";
+	
+	TemperatureMonitor tmon(b,10,0.5);
+	tmon.LoadCalibrations("calib");
+	tmon.AddBoardCalibration("calib");
+	tmon.Start();
+	
+	//For exiting on 'q' 
+	pthread_t tId;
+	(void) pthread_create(&tId, 0, exit_loop, 0);
+	
+	timer.StartRun();
+	while( (infinite or (n_events>(long int)eid)) and !break_loop) 
+	{
+		tmon.Apply();
+		b->StartDomino();
+		timer.Mark(kStageStartDomino);
+		while (b->IsBusy());
+		timer.Mark(kStageWaitTrigger);
+		
+		raw.Transfer();
+		timer.Mark(kStageTransfer);
+		if(swtrig.IsEnabled())
+		{
+			bool accepted=swtrig.Accept(raw);
+			timer.Mark(kStageSwTrigger);
+			if(!accepted)
+			{
+				timer.EndEvent();
+				continue;
+			}
+		}
+		eid++;
+		for(int i=0;i<4;i++)
+			time_axis[i]=raw.GetTime(2*i);
+		timer.Mark(kStageGetTime);
+		for(int i=0;i<4;i++)
+			wave[i]=raw.GetWave(2*i);
+		timer.Mark(kStageDecode);
+		avg.Add(time_axis,wave);
+		timer.Mark(kStageAnalysis);
+		
+		if(eid%(UPADATE_STATS_INTERVAL*50)==0)
+		{
+			/* small enough to rewrite, a stopped run keeps its average */
+			avg.Save(avg_str.c_str(),run_name.c_str());
+			timer.Mark(kStageWrite);
+		}
+		if(eid%UPADATE_STATS_INTERVAL==0)
+		{
+			timer.GetInterval(&trigger_rate,&dead_time);
+			printf("\rEvents averaged  %lu \t|\t%1.1lf Hz\t|\tdead time %1.1lf %%   ",eid,trigger_rate,dead_time*100);
+			fflush(stdout);
+		}
+		timer.Mark(kStageMonitor);
+		timer.EndEvent();
+	}
+	timer.StopRun();
+	
+	break_loop=true;
+	(void) pthread_join(tId, NULL);
+	cout<<"\n\n";
+	timer.PrintSummary(stdout);
+	tmon.Stop();
+	if(swtrig.IsEnabled())
+		swtrig.PrintStatistics(stdout);
+	
+	temp_str=run_name+", started "+ctime(&start_t);
+	temp_str.erase(temp_str.size()-1);	/* newline of ctime() */
+	if(avg.Save(avg_str.c_str(),temp_str.c_str()))
+		cout<<"Mean and RMS of "<<avg.GetEvents()<<" events written to "<<avg_str<<"\n";
+	temp_str="data/"+run_name+"/timing.txt";
+	timer.WriteSummary(temp_str.c_str());
+	cout<<"\n";
+	return 0;
+}
+
+int multi_mode(DRS *drs)
+{
+	// Board 0 is the master and triggers on the 3 fold coincidance as in ADC mode,
+	// all other boards are slaves on EXT via the daisy chain
+	DRSBoard *b;
+	DRSMultiEvent *ev;
+	DRSBacklogStats bstats;
+	string run_name="defaultRun",event_str;
+	float trigger_level=-40;
+	long int n_events=-1;
+	unsigned long int eid=0;
+	uint64_t run_start_mono,run_start_wall;
+	int nBoards=drs->GetNumberOfBoards();
+	int nChannels=4*nBoards;
+	
+	system_return=system("clear");
+	cout<<"\n\t\t\t MULTI-BOARD ADC MODE \n";
+	for(int i=1;i<nBoards;i++)
+	{
+		b=drs->GetBoard(i);		// Init() and SetFrequency() done by InitBoards()
+		b->SetTranspMode(1);
+		b->SetInputRange(0);
+	}
+	for(int i=0;i<nBoards;i++)
+	{
+		b=drs->GetBoard(i);
+		b->SetTriggerPolarity(true);
+		b->SetTriggerDelayNs(50);
+		printf("\t board %d : serial #%d %s\n",i,b->GetBoardSerialNumber(),i==0 ? "[master]" : "[slave]");
+	}
+	
+	cout<<"Enter the data run name \t:\t";   cin>>run_name;
+	cout<<"Enter the trigger level in mV  ( with sign )\t:\t";	cin>>trigger_level;
+	trigger_level/=1000;
+	cout<<"Enter number of events to be recorded ( -1 for infinite loop ) : ";	cin>>n_events;
+	
+	event_str="mkdir -p data/"+run_name;
+	system_return=system(event_str.c_str());
+	event_str="data/"+run_name+"/events.dat";
+	remove(event_str.c_str());
+	EventJournal journal;
+	if(!journal.Open(event_str.c_str()))
+		return 1;
+	
+	b=drs->GetBoard(0);
+	b->SetIndividualTriggerLevel(0, trigger_level);
+	b->SetIndividualTriggerLevel(1, trigger_level);
+	b->SetIndividualTriggerLevel(3, trigger_level);
+	
+	DRSMultiBoard mb(drs);
+	if(!mb.ConfigureDaisyChain(DEBUG_MODE ? 0x0010 : 0xB00))
+		return 1;
+	
+	vector<float> time_buffer(nChannels*1024),wave_buffer(nChannels*1024);
+	DRS_EVENT muEvent[1];
+	for(int i=0;i<nChannels;i++)
+	{
+		muEvent[0].time.push_back(&time_buffer[i*1024]);
+		muEvent[0].waveform.push_back(&wave_buffer[i*1024]);
+	}
+	strcpy(muEvent[0].eheader.event_header,"muT");
+	muEvent[0].eheader.millisecond=0;
+	muEvent[0].eheader.range=0;
+	
+	cout<<"\nOn cotinious run .. input 'q' then 'enter' to quit\n\n";
+	pthread_t tId;
+	(void) pthread_create(&tId, 0, exit_loop, 0);
+	
+	run_start_mono=daq_time_ns();
+	run_start_wall=daq_wall_time_ns();
+	mb.Start();
+	while((n_events<0 or (unsigned long int)n_events>eid) and !break_loop)
+	{
+		ev=mb.GetEvent(100);
+		if(ev==NULL) continue;
+		eid++;
+		
+		for(int i=0;i<nBoards;i++)
+		{
+			DRSFragment &f=ev->fFragment[i];
+			b=drs->GetBoard(i);
+			for(int k=0;k<4;k++)
+			{
+				b->GetTime(0, 2*k, f.fTriggerCell, muEvent[0].time[4*i+k]);
+				b->GetWave(f.fData, 0, 2*k, muEvent[0].waveform[4*i+k], true, f.fTriggerCell);
+			}
+		}
+		
+		muEvent[0].eheader.event_serial_number=ev->fNumber;
+		set_event_time(&muEvent[0],ev->fFragment[0].fTimestamp,run_start_mono,run_start_wall);
+		mb.ReleaseEvent();
+		
+		journal.Append(&muEvent[0].eheader,&muEvent[0].xheader,nChannels,&muEvent[0].time[0],&muEvent[0].waveform[0]);
+		
+		if(eid%UPADATE_STATS_INTERVAL==0)
+		{
+			mb.GetBacklogStats(0,&bstats);
+			printf("\rEvent ID  %lu \t|\tmaster queue %u/%u  ", eid, bstats.depth, bstats.capacity);
+			fflush(stdout);
+		}
+	}
+	mb.Stop();
+	journal.Close(true);
+	
+	break_loop=true;
+	(void) pthread_join(tId, NULL);
+	cout<<"\n\n";
+	mb.PrintBacklogStats(stdout);
+	cout<<"\n";
+	return 0;
+}
+
 Double_t langaufun(Double_t *x, Double_t *par) 
 {
 
@@ -0,0 +1,341 @@
+/********************************************************************\
+
+  Name:         pedestal.cpp
+
+  Contents:     Pedestal (offset) calibration of the waveforms, per
+                physical DRS cell and channel, from any number of
+                pedestal events
+
+                The input is one DRSOsc binary file per channel taken
+                without signal, channel n is taken from the n-th file.
+                Files are streamed event by event, one thread per file,
+                mean and variance are accumulated with Welford's method
+                both by physical cell (sample + trigger cell) and by
+                sample position after the trigger cell.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <thread>
+
+#include "drsoscBinary.h"
+#include "pedestal.h"
+
+/*------------------------------------------------------------------*/
+
+PedestalCalibration::PedestalCalibration()
+:  fMaxEvents(-1)
+{
+   struct timespec ts;
+
+   memset(fFile, 0, sizeof(fFile));
+   memset(fChannel, 0, sizeof(fChannel));
+   memset(fCellMean, 0, sizeof(fCellMean));
+   memset(fCellM2, 0, sizeof(fCellM2));
+   memset(fSampleMean, 0, sizeof(fSampleMean));
+   memset(fSampleM2, 0, sizeof(fSampleM2));
+   for (int i = 0; i < PEDESTAL_CHANNELS; i++) {
+      fChannel[i].channel = i;
+      fStatus[i] = 0;
+      fSerial[i] = fRange[i] = 0;
+   }
+
+   memset(&fHeader, 0, sizeof(fHeader));
+   memcpy(fHeader.tag, "PEDC", 4);
+   fHeader.version = PEDESTAL_VERSION;
+   fHeader.n_cells = PEDESTAL_CELLS;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   fHeader.created_wall_ns = (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*------------------------------------------------------------------*/
+
+static inline void welford(double &mean, double &m2, unsigned int n, double value)
+{
+   double d = value - mean;
+   mean += d / n;
+   m2 += d * (value - mean);
+}
+
+/*------------------------------------------------------------------*/
+
+void PedestalCalibration::ProcessFile(int c)
+{
+   FHEADER fh;
+   THEADER th;
+   BHEADER bh;
+   EHEADER eh;
+   TCHEADER tch;
+   CHEADER ch;
+   unsigned int scaler;
+   unsigned short voltage[PEDESTAL_CELLS];
+   float bin_width[PEDESTAL_CELLS];
+   PEDESTAL_CHANNEL *p = &fChannel[c];
+   int b, chn, i, cell, n_boards;
+   double v;
+
+   FILE *f = fopen(fFile[c], "rb");
+   if (f == NULL) {
+      fprintf(stderr, "Cannot find file \'%s\'\n", fFile[c]);
+      fStatus[c] = 1;
+      return;
+   }
+   setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+   if (fread(&fh, sizeof(fh), 1, f) != 1 || fh.tag[0] != 'D' || fh.tag[1] != 'R' || fh.tag[2] != 'S' ||
+       fh.version != '2') {
+      fprintf(stderr, "Found invalid file header in file \'%s\', aborting.\n", fFile[c]);
+      fclose(f);
+      fStatus[c] = 2;
+      return;
+   }
+   if (fread(&th, sizeof(th), 1, f) != 1 || memcmp(th.time_header, "TIME", 4) != 0) {
+      fprintf(stderr, "Invalid time header in file \'%s\', aborting.\n", fFile[c]);
+      fclose(f);
+      fStatus[c] = 4;
+      return;
+   }
+
+   /* board headers with time bin widths, not needed here */
+   for (b = 0;; b++) {
+      if (fread(&bh, sizeof(bh), 1, f) != 1)
+         break;
+      if (memcmp(bh.bn, "B#", 2) != 0) {
+         fseek(f, -4, SEEK_CUR);
+         break;
+      }
+      if (b == 0)
+         fSerial[c] = bh.board_serial_number;
+      for (chn = 0; chn < 4; chn++) {
+         if (fread(&ch, sizeof(ch), 1, f) != 1)
+            break;
+         if (ch.c[0] != 'C') {
+            fseek(f, -4, SEEK_CUR);
+            break;
+         }
+         if (fread(bin_width, sizeof(float), PEDESTAL_CELLS, f) != PEDESTAL_CELLS)
+            break;
+      }
+   }
+   n_boards = b;
+   if (n_boards != 1) {
+      fprintf(stderr, "File \'%s\' contains %d boards, only single board files are supported.\n", fFile[c],
+              n_boards);
+      fclose(f);
+      fStatus[c] = 5;
+      return;
+   }
+
+   while ((fMaxEvents < 0 || (int) p->n_events < fMaxEvents) && fread(&eh, sizeof(eh), 1, f) == 1) {
+      if (fread(&bh, sizeof(bh), 1, f) != 1 || memcmp(bh.bn, "B#", 2) != 0) {
+         fprintf(stderr, "Invalid board header in file \'%s\', event %u.\n", fFile[c], p->n_events);
+         fStatus[c] = 7;
+         break;
+      }
+      if (fread(&tch, sizeof(tch), 1, f) != 1 || memcmp(tch.tc, "T#", 2) != 0) {
+         fprintf(stderr, "Invalid trigger cell header in file \'%s\', event %u.\n", fFile[c], p->n_events);
+         fStatus[c] = 8;
+         break;
+      }
+
+      for (chn = 0; chn < 4; chn++) {
+         if (fread(&ch, sizeof(ch), 1, f) != 1)
+            break;
+         if (ch.c[0] != 'C') {
+            fseek(f, -4, SEEK_CUR);
+            break;
+         }
+         if (fread(&scaler, sizeof(scaler), 1, f) != 1 ||
+             fread(voltage, sizeof(short), PEDESTAL_CELLS, f) != PEDESTAL_CELLS)
+            break;
+         if (ch.cn[2] - '0' - 1 != c)
+            continue;
+
+         p->n_events++;
+         fRange[c] = eh.range;
+         for (i = 0; i < PEDESTAL_CELLS; i++) {
+            v = (voltage[i] / 65536. + eh.range / 1000.0 - 0.5) * 1000;   // mV
+
+            welford(fSampleMean[c][i], fSampleM2[c][i], p->n_events, v);
+
+            cell = (i + tch.trigger_cell) % PEDESTAL_CELLS;
+            p->cell_count[cell]++;
+            welford(fCellMean[c][cell], fCellM2[c][cell], p->cell_count[cell], v);
+         }
+      }
+   }
+   fclose(f);
+
+   for (i = 0; i < PEDESTAL_CELLS; i++) {
+      p->sample_mean[i] = (float) fSampleMean[c][i];
+      p->cell_mean[i] = (float) fCellMean[c][i];
+      p->sample_sigma[i] = p->n_events > 1 ? (float) sqrt(fSampleM2[c][i] / (p->n_events - 1)) : 0;
+      p->cell_sigma[i] = p->cell_count[i] > 1 ? (float) sqrt(fCellM2[c][i] / (p->cell_count[i] - 1)) : 0;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+int PedestalCalibration::Run()
+{
+   /* returns the number of calibrated channels, -1 on a read error */
+   std::thread worker[PEDESTAL_CHANNELS];
+   int i, n;
+
+   for (i = 0; i < PEDESTAL_CHANNELS; i++)
+      if (fFile[i])
+         worker[i] = std::thread(&PedestalCalibration::ProcessFile, this, i);
+   for (i = 0; i < PEDESTAL_CHANNELS; i++)
+      if (fFile[i])
+         worker[i].join();
+
+   fHeader.n_channels = 0;
+   for (i = 0, n = 0; i < PEDESTAL_CHANNELS; i++) {
+      if (fStatus[i])
+         return -1;
+      if (fChannel[i].n_events > 0) {
+         if (n == 0) {
+            fHeader.board_serial_number = fSerial[i];
+            fHeader.range = fRange[i];
+         } else if (fSerial[i] != fHeader.board_serial_number || fRange[i] != fHeader.range)
+            fprintf(stderr, "Pedestal file of CH%d is from board #%d, range %d mV, first channel from board #%d, range %d mV\n",
+                    i + 1, fSerial[i], fRange[i], fHeader.board_serial_number, fHeader.range);
+         n++;
+      }
+   }
+   fHeader.n_channels = n;
+
+   return n;
+}
+
+/*------------------------------------------------------------------*/
+
+int PedestalCalibration::Write(const char *filename) const
+{
+   FILE *f = fopen(filename, "wb");
+   if (f == NULL) {
+      fprintf(stderr, "Cannot create pedestal file \"%s\"\n", filename);
+      return 0;
+   }
+
+   bool ok = fwrite(&fHeader, sizeof(fHeader), 1, f) == 1;
+   for (int i = 0; i < PEDESTAL_CHANNELS; i++)
+      if (fChannel[i].n_events > 0)
+         ok = fwrite(&fChannel[i], sizeof(fChannel[i]), 1, f) == 1 && ok;
+   ok = fclose(f) == 0 && ok;
+
+   if (!ok)
+      fprintf(stderr, "Error writing pedestal file \"%s\"\n", filename);
+   return ok ? 1 : 0;
+}
+
+/*------------------------------------------------------------------*/
+
+int PedestalCalibration::WriteText(const char *filename) const
+{
+   FILE *f = fopen(filename, "wt");
+   if (f == NULL)
+      return 0;
+
+   fprintf(f, "# pedestal calibration version %u, board #%u, range %u mV\n", fHeader.version,
+           fHeader.board_serial_number, fHeader.range);
+   for (int i = 0; i < PEDESTAL_CHANNELS; i++) {
+      const PEDESTAL_CHANNEL *p = &fChannel[i];
+      if (p->n_events == 0)
+         continue;
+      fprintf(f, "# CH%d, %u events\n", i + 1, p->n_events);
+      fprintf(f, "# index, cell mean [mV], cell sigma [mV], cell count, sample mean [mV], sample sigma [mV]\n");
+      for (int j = 0; j < PEDESTAL_CELLS; j++)
+         fprintf(f, "%d,%1.3f,%1.3f,%u,%1.3f,%1.3f\n", j, p->cell_mean[j], p->cell_sigma[j], p->cell_count[j],
+                 p->sample_mean[j], p->sample_sigma[j]);
+   }
+   fclose(f);
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int PedestalCalibration::WriteLegacy(const char *filename) const
+{
+   /* same layout as the old toffset_calib.dat: channel id followed by
+      1024 doubles in V, by sample after the trigger cell */
+   FILE *f = fopen(filename, "wb");
+   if (f == NULL)
+      return 0;
+
+   for (int i = 0; i < PEDESTAL_CHANNELS; i++) {
+      if (fChannel[i].n_events == 0)
+         continue;
+      unsigned int id = i;
+      fwrite(&id, sizeof(id), 1, f);
+      for (int j = 0; j < PEDESTAL_CELLS; j++) {
+         double val = fChannel[i].sample_mean[j] / 1000.0;
+         fwrite(&val, sizeof(val), 1, f);
+      }
+   }
+   fclose(f);
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+PedestalTable::PedestalTable()
+{
+   memset(fValid, 0, sizeof(fValid));
+   memset(fMean, 0, sizeof(fMean));
+   memset(fSigma, 0, sizeof(fSigma));
+}
+
+/*------------------------------------------------------------------*/
+
+int PedestalTable::Load(const char *filename)
+{
+   /* returns the number of channels loaded, 0 if the file is missing or invalid */
+   PEDESTAL_HEADER h;
+   PEDESTAL_CHANNEL *p;
+   unsigned int i;
+   int n = 0;
+
+   FILE *f = fopen(filename, "rb");
+   if (f == NULL)
+      return 0;
+
+   if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.tag, "PEDC", 4) != 0 || h.version != PEDESTAL_VERSION ||
+       h.n_cells != PEDESTAL_CELLS || h.n_channels > PEDESTAL_CHANNELS) {
+      fprintf(stderr, "Invalid pedestal file \"%s\"\n", filename);
+      fclose(f);
+      return 0;
+   }
+
+   p = new PEDESTAL_CHANNEL;
+   for (i = 0; i < h.n_channels; i++) {
+      if (fread(p, sizeof(*p), 1, f) != 1 || p->channel < 0 || p->channel >= PEDESTAL_CHANNELS)
+         break;
+      memcpy(fMean[p->channel], p->cell_mean, sizeof(fMean[0]));
+      memcpy(fSigma[p->channel], p->cell_sigma, sizeof(fSigma[0]));
+      fValid[p->channel] = true;
+      n++;
+   }
+   delete p;
+   fclose(f);
+
+   return n;
+}
+
+/*------------------------------------------------------------------*/
+
+void PedestalTable::Subtract(int channel, float *wave, int triggerCell) const
+{
+   /* wave[i] is cell (i + triggerCell) % 1024, split at the wrap around */
+   const float *m = fMean[channel];
+   int i, n = PEDESTAL_CELLS - triggerCell;
+
+   for (i = 0; i < n; i++)
+      wave[i] -= m[i + triggerCell];
+   for (; i < PEDESTAL_CELLS; i++)
+      wave[i] -= m[i - n];
+}
@@ -0,0 +1,277 @@
+/********************************************************************\
+
+  Name:         persist.cpp
+
+  Contents:     Persistence (time x voltage density) map of many
+                waveforms, filled by several threads without locks
+                and readable while the filling goes on
+
+                Every filling thread counts into its own partial map.
+                The bin numbers of a waveform are computed four
+                samples at a time with SSE2, samples outside the map
+                go to an extra overflow bin so the increments need no
+                branch. Every SetMergeWaveforms() waveforms a thread
+                adds its partial map to the shared one with atomic
+                additions and clears it, so neither the filling
+                threads nor a reader taking a Snapshot() ever wait
+                for each other. A snapshot holds at least the
+                waveforms it reports, merges running at the same time
+                may be in it in part.
+
+                Clear() starts a new generation, partials filled
+                before are dropped at their merge. It waits for the
+                merges still adding to the map before it zeroes it,
+                and merges that come while it clears are put off to
+                the next one, so no counts of the old generation leak
+                into the new one and the waveform count always
+                matches the bins.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "persist.h"
+
+/*------------------------------------------------------------------*/
+
+PersistenceMap::PersistenceMap(int nx, double tMin, double tMax, int ny, double vMin, double vMax, int nThreads)
+:  fNx(nx)
+    , fNy(ny)
+    , fTMin(tMin)
+    , fTMax(tMax)
+    , fVMin(vMin)
+    , fVMax(vMax)
+    , fMergeWaveforms(PERSIST_MERGE)
+    , fThreads(nThreads)
+    , fWaveforms(0)
+    , fOverflow(0)
+    , fGeneration(0)
+{
+   int i;
+   size_t n;
+
+   fMerging.store(0, std::memory_order_relaxed);
+
+   if (fNx < 1)
+      fNx = 1;
+   if (fNy < 1)
+      fNy = 1;
+   if (fThreads < 1)
+      fThreads = 1;
+   if (fThreads > PERSIST_MAX_THREADS)
+      fThreads = PERSIST_MAX_THREADS;
+   fTScale = fTMax > fTMin ? (float) (fNx / (fTMax - fTMin)) : 1;
+   fVScale = fVMax > fVMin ? (float) (fNy / (fVMax - fVMin)) : 1;
+
+   n = (size_t) fNx * fNy;
+   fMap = new std::atomic<unsigned int>[n];
+   for (size_t j = 0; j < n; j++)
+      fMap[j].store(0, std::memory_order_relaxed);
+
+   for (i = 0; i < PERSIST_MAX_THREADS; i++)
+      fPartial[i] = NULL;
+   for (i = 0; i < fThreads; i++) {
+      fPartial[i] = new PERSIST_PARTIAL;
+      fPartial[i]->map.assign(n + 1, 0);
+      fPartial[i]->waveforms = 0;
+      fPartial[i]->generation = 0;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+PersistenceMap::~PersistenceMap()
+{
+   for (int i = 0; i < fThreads; i++)
+      delete fPartial[i];
+   delete[] fMap;
+}
+
+/*------------------------------------------------------------------*/
+
+void PersistenceMap::Fill(int thread, const float *time, const float *wave, int n)
+{
+   PERSIST_PARTIAL *p;
+   unsigned int *m;
+   const int overflow = fNx * fNy;
+   int i = 0, ix, iy;
+   float fx, fy;
+
+   if (thread < 0 || thread >= fThreads)
+      return;
+   p = fPartial[thread];
+   m = &p->map[0];
+   if (p->waveforms == 0)
+      p->generation = fGeneration.load(std::memory_order_acquire);
+
+#ifdef __SSE2__
+   {
+      const __m128 t0 = _mm_set1_ps((float) fTMin), ts = _mm_set1_ps(fTScale);
+      const __m128 v0 = _mm_set1_ps((float) fVMin), vs = _mm_set1_ps(fVScale);
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 nx = _mm_set1_ps((float) fNx), ny = _mm_set1_ps((float) fNy);
+      const __m128i ovf = _mm_set1_epi32(overflow);
+      __m128 t = _mm_set_ps(3, 2, 1, 0);
+      const __m128 four = _mm_set1_ps(4);
+      int idx[4];
+
+      for (; i + 4 <= n; i += 4) {
+         if (time)
+            t = _mm_loadu_ps(time + i);
+         __m128 x = _mm_mul_ps(_mm_sub_ps(t, t0), ts);
+         __m128 y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(wave + i), v0), vs);
+         if (!time)
+            t = _mm_add_ps(t, four);
+
+         /* false for NaN as well */
+         __m128 ok = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmplt_ps(x, nx)),
+                                _mm_and_ps(_mm_cmpge_ps(y, zero), _mm_cmplt_ps(y, ny)));
+         __m128i ix4 = _mm_cvttps_epi32(_mm_and_ps(x, ok));
+         __m128i iy4 = _mm_cvttps_epi32(_mm_and_ps(y, ok));
+         /* iy * nx + ix in float, exact below 2^24 bins */
+         __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(iy4), nx), _mm_cvtepi32_ps(ix4)));
+         __m128i okI = _mm_castps_si128(ok);
+         b = _mm_or_si128(_mm_and_si128(okI, b), _mm_andnot_si128(okI, ovf));
+         _mm_storeu_si128((__m128i *) idx, b);
+
+         m[idx[0]]++;
+         m[idx[1]]++;
+         m[idx[2]]++;
+         m[idx[3]]++;
+      }
+   }
+#endif
+   for (; i < n; i++) {
+      fx = ((time ? time[i] : (float) i) - (float) fTMin) * fTScale;
+      fy = (wave[i] - (float) fVMin) * fVScale;
+      if (fx >= 0 && fx < fNx && fy >= 0 && fy < fNy) {
+         ix = (int) fx;
+         iy = (int) fy;
+         m[iy * fNx + ix]++;
+      } else
+         m[overflow]++;
+   }
+
+   if (++p->waveforms >= (unsigned long long) fMergeWaveforms)
+      Merge(thread);
+}
+
+/*------------------------------------------------------------------*/
+
+void PersistenceMap::Merge(int thread)
+{
+   PERSIST_PARTIAL *p;
+   unsigned int *m, g;
+   size_t i, n = (size_t) fNx * fNy;
+
+   if (thread < 0 || thread >= fThreads)
+      return;
+   p = fPartial[thread];
+   if (p->waveforms == 0)
+      return;
+   m = &p->map[0];
+
+   /* announce the merge before looking at the generation, a Clear()
+      either sees it and waits or this merge sees the clear running */
+   fMerging.fetch_add(1, std::memory_order_seq_cst);
+   g = fGeneration.load(std::memory_order_seq_cst);
+   if (g & 1) {
+      /* being cleared, keep the partial for the next merge */
+      fMerging.fetch_sub(1, std::memory_order_release);
+      return;
+   }
+
+   /* filled before a Clear(), thrown away; filled while it ran, kept */
+   if (p->generation == g || p->generation == g - 1) {
+      for (i = 0; i < n; i++)
+         if (m[i])
+            fMap[i].fetch_add(m[i], std::memory_order_relaxed);
+      fOverflow.fetch_add(m[n], std::memory_order_relaxed);
+      fWaveforms.fetch_add(p->waveforms, std::memory_order_release);
+   }
+   fMerging.fetch_sub(1, std::memory_order_release);
+
+   std::fill(p->map.begin(), p->map.end(), 0);
+   p->waveforms = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+unsigned long long PersistenceMap::Snapshot(unsigned int *map, unsigned int *maximum) const
+{
+   size_t i, n = (size_t) fNx * fNy;
+   unsigned long long w;
+   unsigned int c, mx = 0;
+
+   /* waveforms first, the bins read afterwards hold at least these */
+   w = fWaveforms.load(std::memory_order_acquire);
+   for (i = 0; i < n; i++) {
+      c = fMap[i].load(std::memory_order_relaxed);
+      map[i] = c;
+      if (c > mx)
+         mx = c;
+   }
+   if (maximum)
+      *maximum = mx;
+
+   return w;
+}
+
+/*------------------------------------------------------------------*/
+
+void PersistenceMap::Clear()
+{
+   size_t i, n = (size_t) fNx * fNy;
+
+   std::lock_guard<std::mutex> lock(fClearMutex);
+
+   /* partials started before are dropped at their next merge, the
+      ones already adding to the map are waited for */
+   fGeneration.fetch_add(1, std::memory_order_seq_cst);
+   while (fMerging.load(std::memory_order_acquire) != 0)
+      std::this_thread::yield();
+
+   for (i = 0; i < n; i++)
+      fMap[i].store(0, std::memory_order_relaxed);
+   fOverflow.store(0, std::memory_order_relaxed);
+   fWaveforms.store(0, std::memory_order_relaxed);
+   fGeneration.fetch_add(1, std::memory_order_release);
+}
+
+/*------------------------------------------------------------------*/
+
+int PersistenceMap::SaveImage(const char *filename) const
+{
+   /* binary PGM, time to the right, voltage up, counts on a log scale */
+   std::vector<unsigned int> map((size_t) fNx * fNy);
+   std::vector<unsigned char> row(fNx);
+   unsigned int maximum;
+   double scale;
+   int x, y;
+
+   Snapshot(&map[0], &maximum);
+   scale = maximum > 0 ? 255 / log(1.0 + maximum) : 0;
+
+   FILE *f = fopen(filename, "wb");
+   if (f == NULL) {
+      printf("Cannot write persistence map to \"%s\"\n", filename);
+      return 0;
+   }
+   fprintf(f, "P5\n# %lg..%lg ns, %lg..%lg mV\n%d %d\n255\n", fTMin, fTMax, fVMin, fVMax, fNx, fNy);
+   for (y = fNy - 1; y >= 0; y--) {
+      for (x = 0; x < fNx; x++)
+         row[x] = (unsigned char) (log(1.0 + map[(size_t) y * fNx + x]) * scale + 0.5);
+      fwrite(&row[0], 1, fNx, f);
+   }
+   fclose(f);
+
+   return 1;
+}
@@ -0,0 +1,170 @@
+/********************************************************************\
+
+  Name:         ratelog.cpp
+
+  Contents:     Binary time series of singles and coincidence counts
+                with an estimate of the accidental coincidences
+
+                Samples from the ScalerCounter are summed up to one
+                fixed-size record per interval and appended to the
+                file, so memory use does not grow with the run length.
+                The stdio buffer is flushed every 10 s.
+
+                For an N-fold coincidence of channels with singles
+                rates R1..RN and resolving time tau, the accidental
+                rate is N * tau^(N-1) * R1 * ... * RN.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ratelog.h"
+
+#define RLOG_FLUSH_INTERVAL 10.0   // s
+
+/*------------------------------------------------------------------*/
+
+RateLogger::RateLogger()
+:  fFile(NULL)
+    , fInterval(1)
+    , fT(0)
+    , fDt(0)
+    , fTotalTime(0)
+    , fTotalCoincidences(0)
+    , fTotalAccidental(0)
+    , fLastFlush(0)
+    , fRecords(0)
+{
+   memset(&fHeader, 0, sizeof(fHeader));
+   memset(fCount, 0, sizeof(fCount));
+}
+
+/*------------------------------------------------------------------*/
+
+RateLogger::~RateLogger()
+{
+   Close();
+}
+
+/*------------------------------------------------------------------*/
+
+double RateLogger::AccidentalRate(const double *rate, int channelMask, double resolvingTime)
+{
+   double r = 1;
+   int i, n = 0;
+
+   for (i = 0; i < 4; i++)
+      if (channelMask & (1 << i)) {
+         r *= rate[i];
+         n++;
+      }
+   if (n < 2)
+      return 0;
+
+   for (i = 1; i < n; i++)
+      r *= resolvingTime;
+
+   return n * r;
+}
+
+/*------------------------------------------------------------------*/
+
+int RateLogger::Open(const char *filename, int channelMask, double resolvingTimeNs, int intervalMs,
+                     uint64_t startWallNs)
+{
+   int i;
+
+   Close();
+
+   fFile = fopen(filename, "wb");
+   if (fFile == NULL) {
+      printf("Cannot open file \"%s\"\n", filename);
+      return 0;
+   }
+
+   memcpy(fHeader.tag, "RLOG", 4);
+   fHeader.version = RLOG_VERSION;
+   fHeader.channel_mask = channelMask & 0xF;
+   for (i = 0, fHeader.fold = 0; i < 4; i++)
+      if (channelMask & (1 << i))
+         fHeader.fold++;
+   fHeader.resolving_time = resolvingTimeNs * 1E-9;
+   fHeader.start_wall_ns = startWallNs;
+   fHeader.interval_ms = intervalMs > 0 ? intervalMs : 1000;
+   fwrite(&fHeader, sizeof(fHeader), 1, fFile);
+
+   fInterval = fHeader.interval_ms / 1000.0;
+   fT = fDt = 0;
+   memset(fCount, 0, sizeof(fCount));
+   fTotalTime = fTotalCoincidences = fTotalAccidental = 0;
+   fLastFlush = 0;
+   fRecords = 0;
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+void RateLogger::Add(double t, double dt, const double *counts)
+{
+   /* counts per scaler during the last dt seconds */
+   if (fFile == NULL)
+      return;
+
+   for (int i = 0; i < kNumberOfScalers; i++)
+      fCount[i] += counts[i];
+   fDt += dt;
+   fT = t;
+
+   if (fDt >= fInterval)
+      WriteRecord();
+
+   if (fT - fLastFlush >= RLOG_FLUSH_INTERVAL) {
+      fflush(fFile);
+      fLastFlush = fT;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void RateLogger::WriteRecord()
+{
+   RLOG_RECORD r;
+   double rate[4];
+   int i;
+
+   if (fDt <= 0)
+      return;
+
+   for (i = 0; i < 4; i++)
+      rate[i] = fCount[i] / fDt;
+
+   r.t = fT;
+   r.dt = (float) fDt;
+   for (i = 0; i < RLOG_SINGLES; i++)
+      r.singles[i] = (float) fCount[i];
+   r.coincidences = (float) fCount[kScalerTrigger];
+   r.accidental = (float) (AccidentalRate(rate, fHeader.channel_mask, fHeader.resolving_time) * fDt);
+   fwrite(&r, sizeof(r), 1, fFile);
+
+   fTotalTime += fDt;
+   fTotalCoincidences += r.coincidences;
+   fTotalAccidental += r.accidental;
+   fRecords++;
+
+   fDt = 0;
+   memset(fCount, 0, sizeof(fCount));
+}
+
+/*------------------------------------------------------------------*/
+
+void RateLogger::Close()
+{
+   if (fFile == NULL)
+      return;
+
+   WriteRecord();
+   fclose(fFile);
+   fFile = NULL;
+}
@@ -0,0 +1,163 @@
+/********************************************************************\
+
+  Name:         rawevent.cpp
+
+  Contents:     One event of an evaluation board held as the raw
+                TransferWaves buffer, channels are decoded, calibrated
+                and given a time axis only when first asked for
+
+                The trigger cell is read once per event. A channel is
+                decoded at most once, the calibrated waveform reuses the
+                decoded ADC samples (e.g. after the software trigger
+                looked at them) and the short to mV conversion uses the
+                precision taken once per channel. Results stay valid
+                until the next Transfer() or Attach().
+
+                With a SpikeRemover set, the first waveform asked for
+                calibrates all four inputs in cell order into one
+                contiguous buffer, removes the spikes common to the
+                chip in one pass and rotates them back.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rawevent.h"
+#include "spikes.h"
+
+/*------------------------------------------------------------------*/
+
+DRSRawEvent::DRSRawEvent(DRSBoard *board)
+:  fBoard(board)
+    , fData(NULL)
+    , fOwnData(NULL)
+    , fTriggerCell(0)
+    , fADCValid(0)
+    , fWaveValid(0)
+    , fTimeValid(0)
+    , fSpikeRemover(NULL)
+    , fDecoded(0)
+    , fCalibrated(0)
+    , fTimed(0)
+{
+   fOwnData = (unsigned char *) malloc(DRS_RAW_EVENT_SIZE);
+   assert(fOwnData);
+   memset(fOwnData, 0, DRS_RAW_EVENT_SIZE);
+   fData = fOwnData;
+}
+
+/*------------------------------------------------------------------*/
+
+DRSRawEvent::~DRSRawEvent()
+{
+   free(fOwnData);
+}
+
+/*------------------------------------------------------------------*/
+
+int DRSRawEvent::Transfer()
+{
+   /* read all channels of the board into the own buffer, this also
+      updates the stop cell of the board */
+   int status = fBoard->TransferWaves(fOwnData, 0, DRS_RAW_EVENT_CHANNELS - 1);
+
+   Attach(fOwnData, fBoard->GetStopCell(0));
+   return status;
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSRawEvent::Attach(unsigned char *buffer, int triggerCell)
+{
+   fData = buffer;
+   fTriggerCell = triggerCell;
+   fADCValid = fWaveValid = fTimeValid = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+const unsigned short *DRSRawEvent::GetADC(int channel)
+{
+   assert(channel >= 0 && channel < DRS_RAW_EVENT_CHANNELS);
+
+   if ((fADCValid & (1 << channel)) == 0) {
+      fBoard->DecodeWave(fData, 0, channel, fADC[channel]);
+      fADCValid |= 1 << channel;
+      fDecoded++;
+   }
+
+   return fADC[channel];
+}
+
+/*------------------------------------------------------------------*/
+
+float *DRSRawEvent::GetWave(int channel)
+{
+   short waveS[kNumberOfBins];
+   double precision;
+   int i;
+
+   assert(channel >= 0 && channel < DRS_RAW_EVENT_CHANNELS);
+
+   if ((fWaveValid & (1 << channel)) == 0) {
+      if (fSpikeRemover && channel % 2 == 0 && channel < 2 * DRS_RAW_EVENT_INPUTS &&
+          fBoard->GetChannelCascading() == 1) {
+         CalibrateInputs();
+         return fWave[channel];
+      }
+      if (fBoard->GetChannelCascading() == 1) {
+         /* same as GetWave(chip, channel, float *) but on the cached ADC samples */
+         fBoard->CalibrateWaveform(0, channel, (unsigned short *) GetADC(channel), waveS, true, fTriggerCell,
+                                   false, 0, true);
+         precision = fBoard->GetPrecision();
+         for (i = 0; i < kNumberOfBins; i++)
+            fWave[channel][i] = static_cast < float >(waveS[i] * precision);
+      } else
+         fBoard->GetWave(fData, 0, channel, fWave[channel], true, fTriggerCell);
+      fWaveValid |= 1 << channel;
+      fCalibrated++;
+   }
+
+   return fWave[channel];
+}
+
+/*------------------------------------------------------------------*/
+
+void DRSRawEvent::CalibrateInputs()
+{
+   double precision;
+   int i, j;
+
+   for (i = 0; i < DRS_RAW_EVENT_INPUTS; i++)
+      fBoard->CalibrateWaveform(0, 2 * i, (unsigned short *) GetADC(2 * i), fSpikeWave[i], true, fTriggerCell,
+                                true, 0, true);
+
+   fSpikeRemover->Process(fSpikeWave[0], DRS_RAW_EVENT_INPUTS);
+
+   /* back to the sample order of GetWave() */
+   precision = fBoard->GetPrecision();
+   for (i = 0; i < DRS_RAW_EVENT_INPUTS; i++) {
+      for (j = 0; j < kNumberOfBins; j++)
+         fWave[2 * i][j] = static_cast < float >(fSpikeWave[i][(j + fTriggerCell) % kNumberOfBins] * precision);
+      fWaveValid |= 1 << (2 * i);
+   }
+   fCalibrated += DRS_RAW_EVENT_INPUTS;
+}
+
+/*------------------------------------------------------------------*/
+
+float *DRSRawEvent::GetTime(int channel)
+{
+   assert(channel >= 0 && channel < DRS_RAW_EVENT_CHANNELS);
+
+   if ((fTimeValid & (1 << channel)) == 0) {
+      fBoard->GetTime(0, channel, fTriggerCell, fTime[channel]);
+      fTimeValid |= 1 << channel;
+      fTimed++;
+   }
+
+   return fTime[channel];
+}
@@ -0,0 +1,458 @@
+/********************************************************************\
+
+  Name:         runwriter.cpp
+
+  Contents:     Run directories of the muonDet ADC mode with rollover
+                to a new run by event count, file size or wall time
+                while the acquisition keeps running
+
+                The first run goes to data/<name> as before, the
+                following ones to data/<name>_001, data/<name>_002 ...
+                skipping directories which exist already, so no
+                earlier run is overwritten.
+                A worker thread creates the directory of the next run
+                with empty events.dat and eDeposit.txt and a copy of
+                the remarks ahead of time. Rollover() then only swaps
+                the directory name in the readout thread and runs the
+                caller's open function (new ROOT file). Closing the
+                old run (ROOT file, remarks footer, permissions) is
+                queued to the worker in order. If no directory can be
+                made, PrepareRollover() fails before the caller hands
+                anything over and the current run simply goes on.
+
+                The caller re-arms the board before Rollover(), so a
+                trigger arriving during the switch is held by the
+                board and the gap between two runs is not dead time.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "runwriter.h"
+
+/*------------------------------------------------------------------*/
+
+RunWriter::RunWriter()
+:  fRun(0)
+    , fNextRun(0)
+    , fRuns(0)
+    , fNextReady(false)
+    , fPreparing(false)
+    , fFailed(false)
+    , fMaxEvents(0)
+    , fMaxBytes(0)
+    , fMaxSeconds(0)
+    , fEvents(0)
+    , fBytes(0)
+    , fRunStart(0)
+    , fRunStartWall(0)
+    , fStop(false)
+{
+}
+
+/*------------------------------------------------------------------*/
+
+RunWriter::~RunWriter()
+{
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop = true;
+   }
+   fWake.notify_all();
+   if (fThread.joinable())
+      fThread.join();
+}
+
+/*------------------------------------------------------------------*/
+
+int RunWriter::LoadConfig(const char *filename)
+{
+   /* same layout as swtrigger.config, "-key" line followed by the value */
+   char line[256], key[256];
+   unsigned long long events = fMaxEvents;
+   double megabytes = fMaxBytes / 1E6, minutes = fMaxSeconds / 60;
+
+   FILE *f = fopen(filename, "r");
+   if (f == NULL)
+      return 0;
+
+   key[0] = 0;
+   while (fgets(line, sizeof(line), f)) {
+      if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+         continue;
+      if (line[0] == '-') {
+         sscanf(line + 1, "%255s", key);
+         continue;
+      }
+
+      if (strcmp(key, "events") == 0)
+         events = strtoull(line, NULL, 0);
+      else if (strcmp(key, "megabytes") == 0)
+         megabytes = atof(line);
+      else if (strcmp(key, "minutes") == 0)
+         minutes = atof(line);
+      else
+         printf("Run rollover: unknown key \"-%s\" in \"%s\"\n", key, filename);
+      key[0] = 0;
+   }
+   fclose(f);
+
+   SetRollover(events, megabytes, minutes);
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::SetRollover(unsigned long long events, double megabytes, double minutes)
+{
+   fMaxEvents = events;
+   fMaxBytes = megabytes > 0 ? (unsigned long long) (megabytes * 1E6) : 0;
+   fMaxSeconds = minutes > 0 ? minutes * 60 : 0;
+}
+
+/*------------------------------------------------------------------*/
+
+std::string RunWriter::RunDir(int run) const
+{
+   char str[16];
+
+   if (run == 0)
+      return fBase;
+   snprintf(str, sizeof(str), "_%03d", run);
+   return fBase + str;
+}
+
+/*------------------------------------------------------------------*/
+
+int RunWriter::Prepare(const std::string &dir)
+{
+   /* returns -1 if a following run's directory exists already */
+   FILE *f;
+
+   if (mkdir(dir.c_str(), 0777) < 0) {
+      if (errno == EEXIST && dir != fBase)
+         return -1;
+      if (errno != EEXIST) {
+         printf("Cannot create run directory \"%s\": %s\n", dir.c_str(), strerror(errno));
+         return 0;
+      }
+   }
+   chmod(dir.c_str(), 0777);
+
+   /* empty data files, remarks of the first run are kept if it existed */
+   f = fopen((dir + "/events.dat").c_str(), "wb");
+   if (f == NULL) {
+      printf("Cannot create \"%s/events.dat\"\n", dir.c_str());
+      return 0;
+   }
+   fclose(f);
+   f = fopen((dir + "/eDeposit.txt").c_str(), "w");
+   if (f == NULL) {
+      printf("Cannot create \"%s/eDeposit.txt\"\n", dir.c_str());
+      return 0;
+   }
+   fclose(f);
+   f = fopen((dir + "/remarks.txt").c_str(), dir == fBase ? "a" : "w");
+   if (f == NULL) {
+      printf("Cannot create \"%s/remarks.txt\"\n", dir.c_str());
+      return 0;
+   }
+   if (dir != fBase) {
+      fputs(fRemarks.c_str(), f);
+      fprintf(f, "\nContinuation of run %s\n", fBase.c_str());
+   }
+   fclose(f);
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::Finish(const std::string &dir, const std::string &footer)
+{
+   FILE *f;
+   DIR *d;
+   struct dirent *e;
+
+   f = fopen((dir + "/remarks.txt").c_str(), "a");
+   if (f) {
+      fputs(footer.c_str(), f);
+      fclose(f);
+   }
+
+   /* as "chmod -R 777" of the run directory, which holds no subdirectories */
+   d = opendir(dir.c_str());
+   if (d == NULL)
+      return;
+   while ((e = readdir(d)) != NULL)
+      if (e->d_name[0] != '.')
+         chmod((dir + "/" + e->d_name).c_str(), 0777);
+   closedir(d);
+   chmod(dir.c_str(), 0777);
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::Queue(const std::function<void()> &job)
+{
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fJobs.push_back(job);
+   }
+   fWake.notify_all();
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::Worker()
+{
+   std::function<void()> job;
+
+   for (;;) {
+      {
+         std::unique_lock<std::mutex> lock(fMutex);
+         fWake.wait(lock, [this] { return fStop || !fJobs.empty(); });
+         if (fJobs.empty())
+            return;
+         job = fJobs.front();
+         fJobs.pop_front();
+      }
+      job();
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+int RunWriter::PrepareFree(int run, int *created)
+{
+   /* first run index from run on without a directory */
+   int i, status;
+
+   for (i = 0; i < 1000; i++, run++) {
+      status = Prepare(RunDir(run));
+      if (status > 0) {
+         *created = run;
+         return 1;
+      }
+      if (status == 0)
+         return 0;
+      printf("Run directory \"%s\" exists, not overwritten\n", RunDir(run).c_str());
+   }
+   return 0;
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::QueuePrepare(int run)
+{
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fPreparing = true;
+   }
+   Queue([this, run] {
+      int created = 0;
+      bool ok = PrepareFree(run, &created) != 0;
+      {
+         std::lock_guard<std::mutex> lock(fMutex);
+         if (ok) {
+            fNextDir = RunDir(created);
+            fNextRun = created;
+         }
+         fNextReady = ok;
+         fPreparing = false;
+      }
+      fWake.notify_all();
+   });
+}
+
+/*------------------------------------------------------------------*/
+
+int RunWriter::Open(const char *baseDir, const char *runName)
+{
+   if (mkdir(baseDir, 0777) < 0 && errno != EEXIST) {
+      printf("Cannot create data directory \"%s\": %s\n", baseDir, strerror(errno));
+      return 0;
+   }
+
+   fBase = std::string(baseDir) + "/" + runName;
+   fRun = 0;
+   fRuns = 1;
+   fDir = fBase;
+   fEvents = fBytes = 0;
+   fFailed = false;
+
+   return Prepare(fDir);
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::Start()
+{
+   char line[256];
+   FILE *f;
+
+   /* remarks entered for the first run are repeated in all following runs */
+   fRemarks.clear();
+   f = fopen(GetPath("remarks.txt").c_str(), "r");
+   if (f) {
+      while (fgets(line, sizeof(line), f))
+         fRemarks += line;
+      fclose(f);
+   }
+
+   fRunStart = daq_time_ns();
+   fRunStartWall = daq_wall_time_ns();
+
+   /* without rollover everything stays in the readout thread as before */
+   if (IsRolloverEnabled()) {
+      fThread = std::thread(&RunWriter::Worker, this);
+      QueuePrepare(fRun + 1);
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+bool RunWriter::IsRolloverDue() const
+{
+   if (fEvents == 0 || fFailed)
+      return false;
+   if (fMaxEvents && fEvents >= fMaxEvents)
+      return true;
+   if (fMaxBytes && fBytes >= fMaxBytes)
+      return true;
+   if (fMaxSeconds > 0 && (daq_time_ns() - fRunStart) / 1E9 >= fMaxSeconds)
+      return true;
+   return false;
+}
+
+/*------------------------------------------------------------------*/
+
+int RunWriter::PrepareRollover()
+{
+   int created = 0;
+
+   /* normally prepared long ago, waits only for a rollover right after the last one */
+   std::unique_lock<std::mutex> lock(fMutex);
+   fWake.wait(lock, [this] { return !fPreparing; });
+   if (fNextReady)
+      return 1;
+
+   lock.unlock();
+   if (!PrepareFree(fRun + 1, &created)) {
+      printf("No directory for the next run, run %s goes on\n", fDir.c_str());
+      fFailed = true;
+      return 0;
+   }
+   lock.lock();
+   fNextDir = RunDir(created);
+   fNextRun = created;
+   fNextReady = true;
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int RunWriter::Rollover(const std::string &footer, const std::function<void()> &close,
+                        const std::function<void()> &open)
+{
+   uint64_t start = daq_time_ns();
+   std::string old = fDir;
+
+   if (!PrepareRollover())
+      return 0;
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fDir = fNextDir;
+      fRun = fNextRun;
+      fNextReady = false;
+   }
+   fRuns++;
+   fEvents = fBytes = 0;
+   fRunStart = daq_time_ns();
+   fRunStartWall = daq_wall_time_ns();
+
+   open();
+
+   Queue(close);
+   Queue([this, old, footer] { Finish(old, footer); });
+   QueuePrepare(fRun + 1);
+
+   fSwitch.Add(daq_time_ns() - start);
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::Close(const std::string &footer, const std::function<void()> &close)
+{
+   std::string old = fDir;
+
+   if (!fThread.joinable()) {
+      close();
+      Finish(old, footer);
+      return;
+   }
+
+   Queue(close);
+   Queue([this, old, footer] { Finish(old, footer); });
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop = true;
+   }
+   fWake.notify_all();
+   fThread.join();
+
+   /* directory prepared for a run which never started */
+   if (fNextReady) {
+      unlink((fNextDir + "/events.dat").c_str());
+      unlink((fNextDir + "/eDeposit.txt").c_str());
+      unlink((fNextDir + "/remarks.txt").c_str());
+      rmdir(fNextDir.c_str());
+      fNextReady = false;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::PrintConfig(FILE *f) const
+{
+   const char *sep = "";
+
+   fprintf(f, "Run rollover after");
+   if (fMaxEvents) {
+      fprintf(f, " %llu events", fMaxEvents);
+      sep = " or";
+   }
+   if (fMaxBytes) {
+      fprintf(f, "%s %1.1lf MB of events.dat", sep, fMaxBytes / 1E6);
+      sep = " or";
+   }
+   if (fMaxSeconds > 0)
+      fprintf(f, "%s %1.1lf minutes", sep, fMaxSeconds / 60);
+   fprintf(f, ", next runs in %s_001, %s_002 ...\n", fBase.c_str(), fBase.c_str());
+}
+
+/*------------------------------------------------------------------*/
+
+void RunWriter::PrintSummary(FILE *f) const
+{
+   if (!IsRolloverEnabled())
+      return;
+
+   fprintf(f, "Run rollover: %d run(s) in %s", fRuns, fBase.c_str());
+   if (fRun > 0)
+      fprintf(f, " ... %s", RunDir(fRun).c_str());
+   fprintf(f, "\n");
+   if (fSwitch.GetCount() > 0)
+      fprintf(f, "  switch latency mean %1.3lf ms, p99 %1.3lf ms, max %1.3lf ms, board armed during the switch\n",
+              fSwitch.GetMean() / 1E6, fSwitch.GetPercentile(99) / 1E6, fSwitch.GetMax() / 1E6);
+}
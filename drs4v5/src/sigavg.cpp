@@ -0,0 +1,278 @@
+/********************************************************************\
+
+  Name:         sigavg.cpp
+
+  Contents:     Averaging of calibrated waveforms over many triggers,
+                keeping only the mean and RMS waveform of each channel
+
+                Waveforms from DRSRawEvent start at the trigger cell,
+                so bin i of all events is the same delay after the
+                trigger. Without a grid the bins are averaged as they
+                are, together with their time. With a grid every event
+                is first interpolated linearly onto start + i * step,
+                which takes out the cell width differences between
+                trigger cells.
+
+                Sums are kept relative to the first event, so the
+                squares stay small for signals on a large offset, and
+                are added four points at a time with SSE2 into float
+                sums which go to double every SIGAVG_BLOCK events.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "sigavg.h"
+
+/*------------------------------------------------------------------*/
+
+SignalAverager::SignalAverager(int channels)
+:  fChannels(channels)
+    , fPoints(SIGAVG_BINS)
+    , fResample(false)
+    , fGridStart(0)
+    , fGridStep(0)
+    , fEvents(0)
+    , fBlockEvents(0)
+{
+   if (fChannels < 1)
+      fChannels = 1;
+   if (fChannels > SIGAVG_MAX_CHANNELS)
+      fChannels = SIGAVG_MAX_CHANNELS;
+   Reset();
+}
+
+/*------------------------------------------------------------------*/
+
+int SignalAverager::SetGrid(double start, double step, int points)
+{
+   if (points <= 0) {
+      fResample = false;
+      fPoints = SIGAVG_BINS;
+   } else {
+      if (step <= 0 || points > SIGAVG_MAX_POINTS) {
+         printf("Signal averager: invalid grid of %d points, step %lg ns\n", points, step);
+         return 0;
+      }
+      fResample = true;
+      fGridStart = start;
+      fGridStep = step;
+      fPoints = points;
+   }
+   Reset();
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+void SignalAverager::Reset()
+{
+   size_t n = (size_t) fChannels * fPoints;
+
+   fEvents = 0;
+   fBlockEvents = 0;
+   fRef.assign(n, 0);
+   fRefTime.assign(n, 0);
+   fBlockSum.assign(n, 0);
+   fBlockSum2.assign(n, 0);
+   fBlockTime.assign(n, 0);
+   fSum.assign(n, 0);
+   fSum2.assign(n, 0);
+   fTimeSum.assign(n, 0);
+   fSample.assign(fPoints, 0);
+}
+
+/*------------------------------------------------------------------*/
+
+void SignalAverager::Resample(const float *time, const float *wave, float *out) const
+{
+   /* both axes ascending, one walk over the bins; points outside the
+      sampled window hold the first or last sample */
+   int i, k = 0;
+   double t;
+
+   for (i = 0; i < fPoints; i++) {
+      t = fGridStart + i * fGridStep;
+      while (k < SIGAVG_BINS - 2 && time[k + 1] < t)
+         k++;
+      if (t <= time[0])
+         out[i] = wave[0];
+      else if (t >= time[SIGAVG_BINS - 1])
+         out[i] = wave[SIGAVG_BINS - 1];
+      else
+         out[i] = (float) (wave[k] + (wave[k + 1] - wave[k]) * (t - time[k]) / (time[k + 1] - time[k]));
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+static void sigavg_add(float *sum, float *sum2, const float *x, const float *ref, int n)
+{
+   int i = 0;
+
+#ifdef __SSE2__
+   for (; i + 4 <= n; i += 4) {
+      __m128 d = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(ref + i));
+      _mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), d));
+      if (sum2)
+         _mm_storeu_ps(sum2 + i, _mm_add_ps(_mm_loadu_ps(sum2 + i), _mm_mul_ps(d, d)));
+   }
+#endif
+   for (; i < n; i++) {
+      float d = x[i] - ref[i];
+      sum[i] += d;
+      if (sum2)
+         sum2[i] += d * d;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void SignalAverager::Add(float *const *time, float *const *wave)
+{
+   int ch;
+   size_t o;
+   const float *x;
+
+   for (ch = 0; ch < fChannels; ch++) {
+      o = (size_t) ch * fPoints;
+      if (fResample) {
+         Resample(time[ch], wave[ch], &fSample[0]);
+         x = &fSample[0];
+      } else
+         x = wave[ch];
+
+      if (fEvents == 0) {
+         memcpy(&fRef[o], x, fPoints * sizeof(float));
+         if (!fResample)
+            memcpy(&fRefTime[o], time[ch], fPoints * sizeof(float));
+      }
+
+      sigavg_add(&fBlockSum[o], &fBlockSum2[o], x, &fRef[o], fPoints);
+      if (!fResample)
+         sigavg_add(&fBlockTime[o], NULL, time[ch], &fRefTime[o], fPoints);
+   }
+
+   fEvents++;
+   if (++fBlockEvents == SIGAVG_BLOCK)
+      Flush();
+}
+
+/*------------------------------------------------------------------*/
+
+void SignalAverager::Flush()
+{
+   size_t i, n = (size_t) fChannels * fPoints;
+
+   if (fBlockEvents == 0)
+      return;
+   for (i = 0; i < n; i++) {
+      fSum[i] += fBlockSum[i];
+      fSum2[i] += fBlockSum2[i];
+      fTimeSum[i] += fBlockTime[i];
+   }
+   std::fill(fBlockSum.begin(), fBlockSum.end(), 0);
+   std::fill(fBlockSum2.begin(), fBlockSum2.end(), 0);
+   std::fill(fBlockTime.begin(), fBlockTime.end(), 0);
+   fBlockEvents = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+void SignalAverager::GetTime(int channel, double *t)
+{
+   size_t o = (size_t) channel * fPoints;
+   int i;
+
+   Flush();
+   for (i = 0; i < fPoints; i++) {
+      if (fResample)
+         t[i] = fGridStart + i * fGridStep;
+      else if (fEvents == 0)
+         t[i] = 0;
+      else
+         t[i] = fRefTime[o + i] + fTimeSum[o + i] / fEvents;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void SignalAverager::GetMean(int channel, double *mean)
+{
+   size_t o = (size_t) channel * fPoints;
+   int i;
+
+   Flush();
+   for (i = 0; i < fPoints; i++)
+      mean[i] = fEvents ? fRef[o + i] + fSum[o + i] / fEvents : 0;
+}
+
+/*------------------------------------------------------------------*/
+
+void SignalAverager::GetRMS(int channel, double *rms)
+{
+   /* spread of the single waveforms around the mean, the error
+      of the mean is rms / sqrt(events) */
+   size_t o = (size_t) channel * fPoints;
+   double m, v;
+   int i;
+
+   Flush();
+   for (i = 0; i < fPoints; i++) {
+      if (fEvents == 0) {
+         rms[i] = 0;
+         continue;
+      }
+      m = fSum[o + i] / fEvents;
+      v = fSum2[o + i] / fEvents - m * m;
+      rms[i] = v > 0 ? sqrt(v) : 0;
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+int SignalAverager::Save(const char *filename, const char *comment)
+{
+   std::vector<double> t(fChannels * fPoints), mean(fChannels * fPoints), rms(fChannels * fPoints);
+   int ch, i;
+
+   FILE *f = fopen(filename, "w");
+   if (f == NULL) {
+      printf("Cannot write averaged waveforms to \"%s\"\n", filename);
+      return 0;
+   }
+
+   for (ch = 0; ch < fChannels; ch++) {
+      GetTime(ch, &t[ch * fPoints]);
+      GetMean(ch, &mean[ch * fPoints]);
+      GetRMS(ch, &rms[ch * fPoints]);
+   }
+
+   if (comment)
+      fprintf(f, "# %s\n", comment);
+   fprintf(f, "# %llu events averaged, %d points per channel", fEvents, fPoints);
+   if (fResample)
+      fprintf(f, ", resampled from %lg ns in steps of %lg ns", fGridStart, fGridStep);
+   fprintf(f, "\n# ");
+   for (ch = 0; ch < fChannels; ch++)
+      fprintf(f, "%st%d_ns,mean%d_mV,rms%d_mV", ch ? "," : "", ch + 1, ch + 1, ch + 1);
+   fprintf(f, "\n");
+
+   for (i = 0; i < fPoints; i++) {
+      for (ch = 0; ch < fChannels; ch++)
+         fprintf(f, "%s%1.4lf,%1.4lf,%1.4lf", ch ? "," : "", t[ch * fPoints + i],
+                 mean[ch * fPoints + i], rms[ch * fPoints + i]);
+      fprintf(f, "\n");
+   }
+   fclose(f);
+
+   return 1;
+}
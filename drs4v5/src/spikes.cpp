@@ -0,0 +1,325 @@
+/********************************************************************\
+
+  Name:         spikes.cpp
+
+  Contents:     Removal of the symmetric DRS4 spikes on all channels
+                of a chip, for single events or batches of events in
+                one contiguous buffer
+
+                Same algorithm as the former DRSBoard::
+                RemoveSymmetricSpikes(), which now calls Remove(). The
+                spike test of the two halves of a channel is the same
+                test on the window starting at bin p, so it is done
+                once per channel over the whole waveform, eight bins
+                at a time with SSE2 for the usual spike width of 2,
+                together with the peak-to-peak of both halves.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "spikes.h"
+
+#define SPIKE_MAX_CHANNELS 10         // kNumberOfChannelsMax
+
+/*------------------------------------------------------------------*/
+
+SpikeRemover::SpikeRemover(short diffThreshold, int spikeWidth, short maxPeakToPeak,
+                           short spikeVoltage, int nTimeRegionThreshold)
+:  fDiffThreshold(diffThreshold)
+    , fSpikeWidth(spikeWidth)
+    , fMaxPeakToPeak(maxPeakToPeak)
+    , fSpikeVoltage(spikeVoltage)
+    , fNTimeRegionThreshold(nTimeRegionThreshold)
+    , fEvents(0)
+    , fRemoved(0)
+{
+}
+
+/*------------------------------------------------------------------*/
+
+#ifdef __SSE2__
+static inline __m128i spike_lo32(__m128i x)
+{
+   return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+}
+
+static inline __m128i spike_hi32(__m128i x)
+{
+   return _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+}
+#endif
+
+/*------------------------------------------------------------------*/
+
+static void spike_scan(const short *w, int width, short diffThreshold,
+                       unsigned char hit[SPIKE_BINS], short maximum[2], short minimum[2])
+{
+   /* hit[p] = 1 if the average of w[p .. p+width-1] is more than
+      diffThreshold above its neighbors w[p-1] and w[p+width], for
+      1 <= p <= SPIKE_BINS-1-width */
+   const short diffThreshold2 = diffThreshold + diffThreshold;
+   int i, p, k, s, q, last;
+
+   last = SPIKE_BINS - 1 - width;
+   p = 1;
+
+   if (width == 2) {
+#ifdef __SSE2__
+      const __m128i t2 = _mm_set1_epi32(diffThreshold2);
+      const __m128i one = _mm_set1_epi8(1);
+      for (; p + 10 <= SPIKE_BINS; p += 8) {
+         __m128i a = _mm_loadu_si128((const __m128i *) (w + p - 1));
+         __m128i b = _mm_loadu_si128((const __m128i *) (w + p));
+         __m128i c = _mm_loadu_si128((const __m128i *) (w + p + 1));
+         __m128i d = _mm_loadu_si128((const __m128i *) (w + p + 2));
+         __m128i lo = _mm_sub_epi32(_mm_add_epi32(spike_lo32(b), spike_lo32(c)),
+                                    _mm_add_epi32(spike_lo32(a), spike_lo32(d)));
+         __m128i hi = _mm_sub_epi32(_mm_add_epi32(spike_hi32(b), spike_hi32(c)),
+                                    _mm_add_epi32(spike_hi32(a), spike_hi32(d)));
+         __m128i m = _mm_packs_epi32(_mm_cmpgt_epi32(lo, t2), _mm_cmpgt_epi32(hi, t2));
+         m = _mm_and_si128(_mm_packs_epi16(m, m), one);
+         _mm_storel_epi64((__m128i *) (hit + p), m);
+      }
+#endif
+      for (; p <= last; p++)
+         hit[p] = (w[p] + w[p+1]) - (w[p-1] + w[p+2]) > diffThreshold2;
+   } else {
+      for (; p <= last; p++) {
+         for (k = 0, s = 0; k < width; k++)
+            s += w[p+k];
+         /* s/width - (w[p-1]+w[p+width])/2 > diffThreshold, in integers */
+         q = (w[p-1] + w[p+width]) / 2;
+         hit[p] = s > width * (q + diffThreshold);
+      }
+   }
+
+   for (i = 0; i < 2; i++) {
+      const short *h = w + i * SPIKE_BINS / 2;
+#ifdef __SSE2__
+      __m128i mx = _mm_loadu_si128((const __m128i *) h);
+      __m128i mn = mx;
+      short r[8];
+      for (k = 8; k < SPIKE_BINS / 2; k += 8) {
+         __m128i x = _mm_loadu_si128((const __m128i *) (h + k));
+         mx = _mm_max_epi16(mx, x);
+         mn = _mm_min_epi16(mn, x);
+      }
+      _mm_storeu_si128((__m128i *) r, mx);
+      maximum[i] = r[0];
+      for (k = 1; k < 8; k++)
+         if (r[k] > maximum[i])
+            maximum[i] = r[k];
+      _mm_storeu_si128((__m128i *) r, mn);
+      minimum[i] = r[0];
+      for (k = 1; k < 8; k++)
+         if (r[k] < minimum[i])
+            minimum[i] = r[k];
+#else
+      maximum[i] = minimum[i] = h[0];
+      for (k = 1; k < SPIKE_BINS / 2; k++) {
+         if (h[k] > maximum[i])
+            maximum[i] = h[k];
+         if (h[k] < minimum[i])
+            minimum[i] = h[k];
+      }
+#endif
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+bool SpikeRemover::Remove(short **wf, int nwf, short diffThreshold, int spikeWidth,
+                          short maxPeakToPeak, short spikeVoltage, int nTimeRegionThreshold)
+{
+   // Remove a specific kind of spike on DRS4.
+   // This spike has some features,
+   //  - Common on all the channels on a chip
+   //  - Constant heigh and width
+   //  - Two spikes per channel
+   //  - Symmetric to cell #0.
+   //
+   // This is not general purpose spike-removing function.
+   //
+   // wf                   : Waveform data. cell#0 must be at bin0,
+   //                        and number of bins must be SPIKE_BINS.
+   // nwf                  : Number of channels which "wf" holds.
+   // diffThreshold        : Amplitude threshold to find peak
+   // spikeWidth           : Width of spike
+   // maxPeakToPeak        : When peak-to-peak is larger than this, the channel
+   //                        is not used to find spikes.
+   // spikeVoltage         : Amplitude of spikes. When it is 0, it is calculated in this function
+   //                        from voltage difference from neighboring bins.
+   // nTimeRegionThreshold : Requirement of number of time regions having spike at common position.
+   //                        Total number of time regions is 2*"nwf".
+
+   if (!wf || !nwf || !diffThreshold || spikeWidth <= 0 || nwf > SPIKE_MAX_CHANNELS) {
+      return false;
+   }
+
+   int            ibin, jbin, last;
+   int            iwf;
+   short          maximum[2], minimum[2];
+   unsigned char  hit[SPIKE_BINS];
+   int            spikeCountSum[SPIKE_BINS / 2] = {0};
+   bool           largePulse[SPIKE_MAX_CHANNELS * 2] = {0};
+   const short    maxShort = 0xFFFF>>1;
+   const short    minShort = -maxShort - 1;
+
+   // last bin of either half for which the spike test is defined
+   last = SPIKE_BINS - 1 - spikeWidth;
+   if (last > SPIKE_BINS / 2 - 1)
+      last = SPIKE_BINS / 2 - 1;
+
+   // search spike
+   for (iwf = 0; iwf < nwf; iwf++) {
+      spike_scan(wf[iwf], spikeWidth, diffThreshold, hit, maximum, minimum);
+
+      // first half, window starting at bin ibin
+      if (maximum[0] != minShort && minimum[0] != maxShort &&
+          (!maxPeakToPeak || maximum[0] - minimum[0] < maxPeakToPeak)) {
+         for (ibin = 1; ibin <= last; ibin++)
+            spikeCountSum[ibin] += hit[ibin];
+         largePulse[iwf] = false;
+      } else {
+         largePulse[iwf] = true;
+      }
+
+      // second half, window ending at bin SPIKE_BINS-1-ibin
+      if (maximum[1] != minShort && minimum[1] != maxShort &&
+          maximum[1] - minimum[1] < maxPeakToPeak) {
+         for (ibin = 1; ibin <= last; ibin++)
+            spikeCountSum[ibin] += hit[SPIKE_BINS - ibin - spikeWidth];
+         largePulse[iwf + nwf] = false;
+      } else {
+         largePulse[iwf + nwf] = true;
+      }
+   }
+
+   // Find common spike
+   int commonSpikeBin = -1;
+   int commonSpikeMax = -1;
+   for (ibin = 0; ibin < SPIKE_BINS / 2; ibin++) {
+      if (commonSpikeMax < spikeCountSum[ibin]) {
+         commonSpikeMax = spikeCountSum[ibin];
+         commonSpikeBin = ibin;
+      }
+   }
+
+   if (spikeCountSum[commonSpikeBin] < nTimeRegionThreshold)
+      return false;
+
+   if (spikeVoltage == 0) {
+      // Estimate spike amplitude
+      double  baseline      = 0;
+      int    nBaseline      = 0;
+      double  peakAmplitude = 0;
+      int    nPeakAmplitude = 0;
+      for (iwf = 0; iwf < nwf; iwf++) {
+         // first half
+         if (!largePulse[iwf]) {
+            // baseline
+            if ((jbin = commonSpikeBin - 1) >= 0 && jbin < SPIKE_BINS) {
+               baseline += wf[iwf][jbin];
+               nBaseline++;
+            }
+            if ((jbin = commonSpikeBin + spikeWidth + 1) >= 0 && jbin < SPIKE_BINS) {
+               baseline += wf[iwf][jbin];
+               nBaseline++;
+            }
+            // spike
+            for (ibin = 0; ibin < spikeWidth; ibin++) {
+               if ((jbin = commonSpikeBin + ibin) >= 0 && jbin < SPIKE_BINS) {
+                  peakAmplitude += wf[iwf][jbin];
+                  nPeakAmplitude++;
+               }
+            }
+         }
+
+         // second half
+         if (!largePulse[iwf + nwf]) {
+            // baseline
+            if ((jbin = SPIKE_BINS - 1 - commonSpikeBin + 1) >= 0 && jbin < SPIKE_BINS) {
+               baseline += wf[iwf][jbin];
+               nBaseline++;
+            }
+            if ((jbin = SPIKE_BINS - 1 - commonSpikeBin - spikeWidth - 1) >= 0 && jbin < SPIKE_BINS) {
+               baseline += wf[iwf][jbin];
+               nBaseline++;
+            }
+            // spike
+            for (ibin = 0; ibin < spikeWidth; ibin++) {
+               if ((jbin = SPIKE_BINS - 1 - commonSpikeBin - ibin) >= 0 && jbin < SPIKE_BINS) {
+                  peakAmplitude += wf[iwf][jbin];
+                  nPeakAmplitude++;
+               }
+            }
+         }
+      }
+      if (nBaseline && nPeakAmplitude) {
+         baseline /= nBaseline;
+         peakAmplitude /= nPeakAmplitude;
+         spikeVoltage = static_cast<short>(peakAmplitude - baseline);
+      } else {
+         spikeVoltage = 0;
+      }
+   }
+
+   // Remove spike
+   if (spikeVoltage <= 0)
+      return false;
+
+   for (iwf = 0; iwf < nwf; iwf++) {
+      for (ibin = 0; ibin < spikeWidth; ibin++) {
+         if ((jbin = commonSpikeBin + ibin) >= 0 && jbin < SPIKE_BINS) {
+            wf[iwf][jbin] -= spikeVoltage;
+         }
+         if ((jbin = SPIKE_BINS - 1 - commonSpikeBin - ibin) >= 0 && jbin < SPIKE_BINS) {
+            wf[iwf][jbin] -= spikeVoltage;
+         }
+      }
+   }
+
+   return true;
+}
+
+/*------------------------------------------------------------------*/
+
+int SpikeRemover::Process(short *wf, int nwf, int nEvents)
+{
+   short *w[SPIKE_MAX_CHANNELS];
+   int i, j, n;
+
+   if (nwf > SPIKE_MAX_CHANNELS)
+      return 0;
+
+   for (i = n = 0; i < nEvents; i++) {
+      for (j = 0; j < nwf; j++)
+         w[j] = wf + (i * nwf + j) * SPIKE_BINS;
+      if (Remove(w, nwf, fDiffThreshold, fSpikeWidth, fMaxPeakToPeak, fSpikeVoltage, fNTimeRegionThreshold))
+         n++;
+   }
+   fEvents += nEvents;
+   fRemoved += n;
+
+   return n;
+}
+
+/*------------------------------------------------------------------*/
+
+bool SpikeRemover::Process(short **wf, int nwf)
+{
+   bool removed;
+
+   removed = Remove(wf, nwf, fDiffThreshold, fSpikeWidth, fMaxPeakToPeak, fSpikeVoltage, fNTimeRegionThreshold);
+   fEvents++;
+   if (removed)
+      fRemoved++;
+
+   return removed;
+}
@@ -0,0 +1,278 @@
+/********************************************************************\
+
+  Name:         swtrigger.cpp
+
+  Contents:     Software coincidence / veto filter on raw ADC samples,
+                applied before waveform calibration
+
+                Works on the ADC samples of the raw event, so a
+                rejected event costs only the decoding of the channels
+                looked at and one min/max pass per channel. The
+                baseline of every channel is the mean of the first bins
+                of the search region, a channel fires when it crosses
+                baseline - threshold (falling pulses, negative
+                threshold) or baseline + threshold (rising).
+
+                An event is accepted if at least N of the channels in
+                the mask fire within the coincidence window and none of
+                the veto channels fires. Raw samples still contain the
+                cell offsets, so thresholds should be somewhat looser
+                than the ones used after calibration.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "swtrigger.h"
+
+/*------------------------------------------------------------------*/
+
+SoftwareTrigger::SoftwareTrigger()
+:  fEnabled(false)
+    , fMask(0)
+    , fMinFired(0)
+    , fVeto(0)
+    , fWindowNs(0)
+    , fFrequency(5.12)
+    , fWindowBins(0)
+    , fFirstBin(10)
+    , fLastBin(kNumberOfBins - 10)
+{
+   for (int i = 0; i < SWTRIGGER_CHANNELS; i++) {
+      SetThreshold(i, -40);
+      fCrossing[i] = -1;
+   }
+   ResetStatistics();
+}
+
+/*------------------------------------------------------------------*/
+
+void SoftwareTrigger::ResetStatistics()
+{
+   fEvents = fPassed = 0;
+   fRejectedMultiplicity = fRejectedWindow = fRejectedVeto = 0;
+}
+
+/*------------------------------------------------------------------*/
+
+void SoftwareTrigger::SetFrequency(double ghz)
+{
+   fFrequency = ghz;
+   fWindowBins = (int) (fWindowNs * fFrequency + 0.5);
+}
+
+/*------------------------------------------------------------------*/
+
+void SoftwareTrigger::SetThreshold(int channel, double mV)
+{
+   fThresholdMV[channel] = mV;
+   fThreshold[channel] = (int) (fabs(mV) * SWTRIGGER_COUNTS_PER_MV + 0.5);
+}
+
+/*------------------------------------------------------------------*/
+
+void SoftwareTrigger::SetPattern(int mask, int minFired, int veto, double windowNs)
+{
+   fMask = mask & ((1 << SWTRIGGER_CHANNELS) - 1);
+   fVeto = veto & ((1 << SWTRIGGER_CHANNELS) - 1) & ~fMask;
+   fMinFired = minFired;
+   fWindowNs = windowNs;
+   fWindowBins = (int) (fWindowNs * fFrequency + 0.5);
+}
+
+/*------------------------------------------------------------------*/
+
+void SoftwareTrigger::SetRegion(int firstBin, int lastBin)
+{
+   if (firstBin < 0)
+      firstBin = 0;
+   if (lastBin > kNumberOfBins)
+      lastBin = kNumberOfBins;
+   if (lastBin - firstBin < 2 * SWTRIGGER_BASELINE_BINS) {
+      printf("Software trigger region %d..%d too small, using full range\n", firstBin, lastBin);
+      firstBin = 0;
+      lastBin = kNumberOfBins;
+   }
+   fFirstBin = firstBin;
+   fLastBin = lastBin;
+}
+
+/*------------------------------------------------------------------*/
+
+int SoftwareTrigger::LoadConfig(const char *filename)
+{
+   /* same layout as drsosc.config: "-key" line followed by the values,
+      lines starting with '#' are comments */
+   char line[256], key[256];
+   double th[SWTRIGGER_CHANNELS];
+   int mask = fMask, n = fMinFired, veto = fVeto, first = fFirstBin, last = fLastBin;
+   double window = fWindowNs;
+   int i;
+
+   FILE *f = fopen(filename, "r");
+   if (f == NULL)
+      return 0;
+
+   key[0] = 0;
+   while (fgets(line, sizeof(line), f)) {
+      if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+         continue;
+      if (line[0] == '-') {
+         sscanf(line + 1, "%255s", key);
+         continue;
+      }
+
+      if (strcmp(key, "enable") == 0)
+         fEnabled = atoi(line) != 0;
+      else if (strcmp(key, "threshold") == 0) {
+         if (sscanf(line, "%lf %lf %lf %lf", &th[0], &th[1], &th[2], &th[3]) == SWTRIGGER_CHANNELS)
+            for (i = 0; i < SWTRIGGER_CHANNELS; i++)
+               SetThreshold(i, th[i]);
+         else
+            printf("Software trigger: need %d thresholds in \"%s\"\n", SWTRIGGER_CHANNELS, filename);
+      } else if (strcmp(key, "mask") == 0)
+         mask = (int) strtol(line, NULL, 0);
+      else if (strcmp(key, "n") == 0)
+         n = atoi(line);
+      else if (strcmp(key, "veto") == 0)
+         veto = (int) strtol(line, NULL, 0);
+      else if (strcmp(key, "window") == 0)
+         window = atof(line);
+      else if (strcmp(key, "region") == 0)
+         sscanf(line, "%d %d", &first, &last);
+      else
+         printf("Software trigger: unknown key \"-%s\" in \"%s\"\n", key, filename);
+      key[0] = 0;
+   }
+   fclose(f);
+
+   SetPattern(mask, n, veto, window);
+   SetRegion(first, last);
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int SoftwareTrigger::FindCrossing(const unsigned short *adc, int channel)
+{
+   const unsigned short *p = adc + fFirstBin;
+   int n = fLastBin - fFirstBin;
+   int i, sum = 0, level;
+
+   for (i = 0; i < SWTRIGGER_BASELINE_BINS; i++)
+      sum += p[i];
+
+   if (fThresholdMV[channel] < 0) {
+      level = sum / SWTRIGGER_BASELINE_BINS - fThreshold[channel];
+      if (level < 0)
+         return -1;
+
+      /* branch free minimum first, the compiler vectorizes this loop */
+      unsigned short m = 0xFFFF;
+      for (i = 0; i < n; i++)
+         m = p[i] < m ? p[i] : m;
+      if (m > level)
+         return -1;
+
+      for (i = 0; i < n; i++)
+         if (p[i] <= level)
+            break;
+   } else {
+      level = sum / SWTRIGGER_BASELINE_BINS + fThreshold[channel];
+      if (level > 0xFFFF)
+         return -1;
+
+      unsigned short m = 0;
+      for (i = 0; i < n; i++)
+         m = p[i] > m ? p[i] : m;
+      if (m < level)
+         return -1;
+
+      for (i = 0; i < n; i++)
+         if (p[i] >= level)
+            break;
+   }
+
+   return fFirstBin + i;
+}
+
+/*------------------------------------------------------------------*/
+
+bool SoftwareTrigger::Accept(DRSRawEvent &event)
+{
+   int t[SWTRIGGER_CHANNELS];
+   int i, j, k, n, remaining;
+
+   fEvents++;
+   for (i = 0; i < SWTRIGGER_CHANNELS; i++)
+      fCrossing[i] = -1;
+
+   /* coincidence channels, stop as soon as N cannot be reached any more */
+   for (i = 0, remaining = 0; i < SWTRIGGER_CHANNELS; i++)
+      if (fMask & (1 << i))
+         remaining++;
+   for (i = 0, n = 0; i < SWTRIGGER_CHANNELS && n + remaining >= fMinFired; i++) {
+      if ((fMask & (1 << i)) == 0)
+         continue;
+      remaining--;
+      fCrossing[i] = FindCrossing(event.GetADC(2 * i), i);
+      if (fCrossing[i] >= 0) {
+         /* insertion sort, at most four entries */
+         for (k = n; k > 0 && t[k - 1] > fCrossing[i]; k--)
+            t[k] = t[k - 1];
+         t[k] = fCrossing[i];
+         n++;
+      }
+   }
+   if (n < fMinFired) {
+      fRejectedMultiplicity++;
+      return false;
+   }
+
+   /* N crossings within the window */
+   if (fWindowBins > 0 && fMinFired > 1) {
+      for (j = 0; j + fMinFired - 1 < n; j++)
+         if (t[j + fMinFired - 1] - t[j] <= fWindowBins)
+            break;
+      if (j + fMinFired - 1 >= n) {
+         fRejectedWindow++;
+         return false;
+      }
+   }
+
+   for (i = 0; i < SWTRIGGER_CHANNELS; i++)
+      if (fVeto & (1 << i)) {
+         fCrossing[i] = FindCrossing(event.GetADC(2 * i), i);
+         if (fCrossing[i] >= 0) {
+            fRejectedVeto++;
+            return false;
+         }
+      }
+
+   fPassed++;
+   return true;
+}
+
+/*------------------------------------------------------------------*/
+
+void SoftwareTrigger::PrintConfig(FILE *f) const
+{
+   fprintf(f, "Software trigger : %d of mask 0x%X within %1.1lf ns, veto 0x%X, thresholds", fMinFired, fMask,
+           fWindowNs, fVeto);
+   for (int i = 0; i < SWTRIGGER_CHANNELS; i++)
+      fprintf(f, " %1.1lf", fThresholdMV[i]);
+   fprintf(f, " mV, bins %d..%d\n", fFirstBin, fLastBin);
+}
+
+/*------------------------------------------------------------------*/
+
+void SoftwareTrigger::PrintStatistics(FILE *f) const
+{
+   fprintf(f, "Software trigger : %llu events, %llu passed (%1.2lf %%), rejected %llu multiplicity, "
+           "%llu window, %llu veto\n", fEvents, fPassed, fEvents ? 100.0 * fPassed / fEvents : 0.0,
+           fRejectedMultiplicity, fRejectedWindow, fRejectedVeto);
+}
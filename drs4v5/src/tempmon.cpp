@@ -0,0 +1,349 @@
+/********************************************************************\
+
+  Name:         tempmon.cpp
+
+  Contents:     Temperature monitor selecting the voltage calibration
+                of a board from a set of calibrations taken at
+                different temperatures
+
+                The cell offsets and gains of the DRS4 drift with the
+                board temperature, while the EEPROM holds only the
+                calibration of the last CalibrateVolt(). Each
+                calibration is therefore archived as
+                <dir>/voltcal_<serial>_<T>C.cal, and all archived
+                calibrations of the board are loaded at run start.
+
+                A monitor thread reads the temperature sensor every
+                few seconds. This is a single register access,
+                serialized with the readout by the interface lock.
+                If the temperature moved by more than the threshold,
+                the thread interpolates the tables linearly between
+                the two closest calibrations into a spare buffer.
+                Apply(), called by the readout loop between events,
+                copies a prepared buffer into the board, so one event
+                is never calibrated with a mix of two tables.
+
+                Without USE_DRS_MUTEX the board must not be accessed
+                from two threads. Apply() then samples the sensor
+                itself once per interval.
+
+\********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+
+#include "tempmon.h"
+#include "daqtimer.h"
+
+/*------------------------------------------------------------------*/
+
+TemperatureMonitor::TemperatureMonitor(DRSBoard *board, double intervalS, double threshold)
+:  fBoard(board)
+    , fIntervalS(intervalS > 0 ? intervalS : 10)
+    , fThreshold(threshold)
+    , fNext(new DRSVoltageCalibration)
+    , fPending(false)
+    , fTemperature(0)
+    , fApplied(board->GetCalibratedTemperature())
+    , fSamples(0)
+    , fSwitches(0)
+    , fLastSample(0)
+    , fRunning(false)
+    , fStop(false)
+{
+}
+
+/*------------------------------------------------------------------*/
+
+TemperatureMonitor::~TemperatureMonitor()
+{
+   Stop();
+   for (unsigned int i = 0; i < fSet.size(); i++)
+      delete fSet[i];
+   delete fNext;
+}
+
+/*------------------------------------------------------------------*/
+
+int TemperatureMonitor::AddCalibration(const DRSVoltageCalibration *c)
+{
+   unsigned int i;
+
+   if (fabs(c->range - fBoard->GetCalibratedInputRange()) > 0.001) {
+      printf("Voltage calibration at %1.1lf deg. C is for range %1.2lf V instead of %1.2lf V, ignored\n",
+             c->temperature, c->range, fBoard->GetCalibratedInputRange());
+      return (int) fSet.size();
+   }
+
+   /* replace a calibration at the same temperature, keep the list sorted */
+   for (i = 0; i < fSet.size(); i++) {
+      if (fabs(fSet[i]->temperature - c->temperature) < 0.05) {
+         memcpy(fSet[i], c, sizeof(DRSVoltageCalibration));
+         return (int) fSet.size();
+      }
+      if (fSet[i]->temperature > c->temperature)
+         break;
+   }
+
+   DRSVoltageCalibration *s = new DRSVoltageCalibration;
+   memcpy(s, c, sizeof(DRSVoltageCalibration));
+   fSet.insert(fSet.begin() + i, s);
+
+   return (int) fSet.size();
+}
+
+/*------------------------------------------------------------------*/
+
+int TemperatureMonitor::AddBoardCalibration(const char *dir)
+{
+   bool archived;
+   unsigned int i;
+
+   DRSVoltageCalibration *c = new DRSVoltageCalibration;
+   if (!fBoard->GetVoltageCalibration(c)) {
+      delete c;
+      return 0;
+   }
+
+   archived = false;
+   for (i = 0; i < fSet.size(); i++)
+      if (fabs(fSet[i]->temperature - c->temperature) < 0.05)
+         archived = true;
+
+   AddCalibration(c);
+   if (dir && !archived)
+      SaveCalibration(dir, c);
+
+   delete c;
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int TemperatureMonitor::SaveCalibration(const char *dir, const DRSVoltageCalibration *c) const
+{
+   TEMPMON_HEADER h;
+   char filename[1000];
+   FILE *f;
+
+   snprintf(filename, sizeof(filename), "%s/voltcal_%d_%1.1lfC.cal", dir,
+            fBoard->GetBoardSerialNumber(), c->temperature);
+   f = fopen(filename, "wb");
+   if (f == NULL) {
+      printf("Cannot write voltage calibration file \"%s\"\n", filename);
+      return 0;
+   }
+
+   memset(&h, 0, sizeof(h));
+   memcpy(h.tag, "DRST", 4);
+   h.version = TEMPMON_VERSION;
+   h.board_serial_number = fBoard->GetBoardSerialNumber();
+   h.size = sizeof(DRSVoltageCalibration);
+
+   if (fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(c, sizeof(DRSVoltageCalibration), 1, f) != 1) {
+      printf("Error writing voltage calibration file \"%s\"\n", filename);
+      fclose(f);
+      return 0;
+   }
+   fclose(f);
+
+   return 1;
+}
+
+/*------------------------------------------------------------------*/
+
+int TemperatureMonitor::LoadCalibrations(const char *dir)
+{
+   TEMPMON_HEADER h;
+   char prefix[64], filename[1000];
+   struct dirent *entry;
+   DIR *d;
+   FILE *f;
+   int n;
+
+   d = opendir(dir);
+   if (d == NULL)
+      return 0;
+
+   DRSVoltageCalibration *c = new DRSVoltageCalibration;
+   snprintf(prefix, sizeof(prefix), "voltcal_%d_", fBoard->GetBoardSerialNumber());
+   n = 0;
+   while ((entry = readdir(d)) != NULL) {
+      if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0)
+         continue;
+
+      snprintf(filename, sizeof(filename), "%s/%s", dir, entry->d_name);
+      f = fopen(filename, "rb");
+      if (f == NULL)
+         continue;
+      if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.tag, "DRST", 4) != 0 ||
+          h.version != TEMPMON_VERSION || h.size != sizeof(DRSVoltageCalibration) ||
+          h.board_serial_number != fBoard->GetBoardSerialNumber() ||
+          fread(c, sizeof(DRSVoltageCalibration), 1, f) != 1) {
+         printf("Invalid voltage calibration file \"%s\", ignored\n", filename);
+         fclose(f);
+         continue;
+      }
+      fclose(f);
+
+      AddCalibration(c);
+      n++;
+   }
+   closedir(d);
+   delete c;
+
+   return n;
+}
+
+/*------------------------------------------------------------------*/
+
+void TemperatureMonitor::Interpolate(double temperature, DRSVoltageCalibration *c) const
+{
+   const DRSVoltageCalibration *a, *b;
+   unsigned int i, j;
+   double w;
+
+   if (fSet.size() == 0)
+      return;
+
+   /* clamp to the calibrated temperatures */
+   if (temperature <= fSet[0]->temperature) {
+      memcpy(c, fSet[0], sizeof(DRSVoltageCalibration));
+      return;
+   }
+   if (temperature >= fSet[fSet.size()-1]->temperature) {
+      memcpy(c, fSet[fSet.size()-1], sizeof(DRSVoltageCalibration));
+      return;
+   }
+
+   for (i = 1; i < fSet.size() - 1; i++)
+      if (fSet[i]->temperature > temperature)
+         break;
+   a = fSet[i-1];
+   b = fSet[i];
+   w = (temperature - a->temperature) / (b->temperature - a->temperature);
+
+   c->temperature = temperature;
+   c->range = a->range;
+   for (i = 0; i < kNumberOfChipsMax * kNumberOfChannelsMax; i++)
+      for (j = 0; j < kNumberOfBins; j++) {
+         /* zero offset marks a stuck cell in either calibration */
+         if (a->offset[i][j] == 0 || b->offset[i][j] == 0)
+            c->offset[i][j] = 0;
+         else
+            c->offset[i][j] = (unsigned short) (a->offset[i][j] * (1-w) + b->offset[i][j] * w + 0.5);
+         c->offset2[i][j] = (unsigned short) (a->offset2[i][j] * (1-w) + b->offset2[i][j] * w + 0.5);
+         c->gain[i][j] = a->gain[i][j] * (1-w) + b->gain[i][j] * w;
+      }
+}
+
+/*------------------------------------------------------------------*/
+
+void TemperatureMonitor::Sample()
+{
+   double t, tc;
+
+   t = fBoard->GetTemperature();
+   fTemperature = t;
+   fSamples++;
+
+   if (fSet.size() < 2 || fPending)
+      return;
+
+   tc = t;
+   if (tc < fSet[0]->temperature)
+      tc = fSet[0]->temperature;
+   if (tc > fSet[fSet.size()-1]->temperature)
+      tc = fSet[fSet.size()-1]->temperature;
+
+   if (fabs(tc - fApplied) < fThreshold)
+      return;
+
+   Interpolate(tc, fNext);
+   fPending = true;
+}
+
+/*------------------------------------------------------------------*/
+
+void TemperatureMonitor::Worker()
+{
+   std::unique_lock<std::mutex> lock(fMutex);
+   while (!fStop) {
+      lock.unlock();
+      Sample();
+      lock.lock();
+      fWake.wait_for(lock, std::chrono::duration<double>(fIntervalS), [this] { return fStop; });
+   }
+}
+
+/*------------------------------------------------------------------*/
+
+void TemperatureMonitor::Start()
+{
+   if (fRunning)
+      return;
+
+   fRunning = true;
+   fStop = false;
+   fLastSample = daq_time_ns();
+#ifdef USE_DRS_MUTEX
+   fThread = std::thread(&TemperatureMonitor::Worker, this);
+#else
+   Sample();
+#endif
+}
+
+/*------------------------------------------------------------------*/
+
+void TemperatureMonitor::Stop()
+{
+   if (!fRunning)
+      return;
+
+   {
+      std::lock_guard<std::mutex> lock(fMutex);
+      fStop = true;
+   }
+   fWake.notify_all();
+   if (fThread.joinable())
+      fThread.join();
+   fRunning = false;
+}
+
+/*------------------------------------------------------------------*/
+
+bool TemperatureMonitor::Apply()
+{
+#ifndef USE_DRS_MUTEX
+   if (fRunning && daq_time_ns() - fLastSample >= fIntervalS * 1E9) {
+      fLastSample = daq_time_ns();
+      Sample();
+   }
+#endif
+
+   if (!fPending)
+      return false;
+
+   fBoard->SetVoltageCalibration(fNext);
+   fApplied = fNext->temperature;
+   fSwitches++;
+   fPending = false;
+
+   return true;
+}
+
+/*------------------------------------------------------------------*/
+
+void TemperatureMonitor::PrintSummary(FILE *f) const
+{
+   unsigned int i;
+
+   fprintf(f, "Board temperature %1.1lf deg. C, calibration at %1.1lf deg. C, %llu readings, %llu switches\n",
+           GetTemperature(), GetCalibrationTemperature(), GetSamples(), fSwitches);
+   fprintf(f, "Voltage calibrations at");
+   for (i = 0; i < fSet.size(); i++)
+      fprintf(f, " %1.1lf", fSet[i]->temperature);
+   fprintf(f, " deg. C\n");
+}